@@ -92,3 +92,18 @@ DEFINE_double(replan_lateral_distance_threshold, 0.5,
               "The lateral distance threshold of replan");
 DEFINE_double(replan_longitudinal_distance_threshold, 2.5,
               "The longitudinal distance threshold of replan");
+
+// hdmap
+DEFINE_int32(hdmap_load_threads, 0,
+             "Number of threads that build the elements and spatial indices "
+             "of a map while it is loaded; 0 uses one per hardware thread");
+DEFINE_bool(hdmap_use_index_file, false,
+            "Whether LoadMapFromFile loads the spatial indices of a map from "
+            "<map file>.index, and writes that file when it is missing or "
+            "was built for another version of the map");
+DEFINE_bool(hdmap_compact_index, false,
+            "Whether the spatial indices of a map store their sort keys and "
+            "segment copies as floats, for less memory and the same results");
+DEFINE_int32(hdmap_lane_kdtree_min_segments, 64,
+             "Lanes with at least this many center line segments find their "
+             "nearest segment with a KD-tree; shorter ones scan them all");
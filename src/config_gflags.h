@@ -61,3 +61,9 @@ DECLARE_bool(enable_map_reference_unify);
 // parameters for trajectory stitching and reinit planning starting point.
 DECLARE_double(replan_lateral_distance_threshold);
 DECLARE_double(replan_longitudinal_distance_threshold);
+
+// hdmap
+DECLARE_int32(hdmap_load_threads);
+DECLARE_bool(hdmap_use_index_file);
+DECLARE_bool(hdmap_compact_index);
+DECLARE_int32(hdmap_lane_kdtree_min_segments);
@@ -24,14 +24,15 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <cstddef>
 #include <fstream>
+#include <limits>
 #include <string>
 
 #include "google/protobuf/util/json_util.h"
 #include "nlohmann/json.hpp"
-#include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 
 namespace apollo {
@@ -42,6 +43,82 @@ using std::istreambuf_iterator;
 using std::string;
 using std::vector;
 
+namespace {
+
+// Reads a mapped file in blocks, and drops the pages of the blocks that have
+// been parsed, so that the mapping does not add the size of the file to the
+// peak memory of the parse. A dropped page that is read again is just read
+// from the file again.
+class MappedFileInputStream : public google::protobuf::io::ZeroCopyInputStream {
+ public:
+  static constexpr int kBlockSize = 4 << 20;
+
+  MappedFileInputStream(const void *data, int size)
+      : data_(static_cast<const char *>(data)),
+        input_(data, size, kBlockSize) {}
+
+  bool Next(const void **data, int *size) override {
+    if (!input_.Next(data, size)) {
+      return false;
+    }
+    // The parser may still hold the previous block, so keep it.
+    const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const char *block = static_cast<const char *>(*data);
+    if (block - data_ > kBlockSize) {
+      const size_t end =
+          (block - data_ - kBlockSize) / page_size * page_size;
+      if (end > released_) {
+        madvise(const_cast<char *>(data_) + released_, end - released_,
+                MADV_DONTNEED);
+        released_ = end;
+      }
+    }
+    return true;
+  }
+  void BackUp(int count) override { input_.BackUp(count); }
+  bool Skip(int count) override { return input_.Skip(count); }
+  int64_t ByteCount() const override { return input_.ByteCount(); }
+
+ private:
+  const char *data_;
+  google::protobuf::io::ArrayInputStream input_;
+  size_t released_ = 0;
+};
+
+bool HasBinaryExtension(const std::string &file_name) {
+  static const std::string kBinExt = ".bin";
+  return file_name.size() >= kBinExt.size() &&
+         std::equal(kBinExt.rbegin(), kBinExt.rend(), file_name.rbegin());
+}
+
+// Parses content read or mapped from file_name, trying the formats in the
+// order GetProtoFromFile does. Only a mapping may drop its parsed pages.
+bool GetProtoFromContent(const std::string &file_name, std::string_view content,
+                         const bool mapped,
+                         google::protobuf::Message *message) {
+  const int size = static_cast<int>(content.size());
+  const auto parse_binary = [&]() {
+    if (mapped) {
+      MappedFileInputStream input(content.data(), size);
+      return message->ParseFromZeroCopyStream(&input);
+    }
+    google::protobuf::io::ArrayInputStream input(content.data(), size);
+    return message->ParseFromZeroCopyStream(&input);
+  };
+  const auto parse_text = [&]() {
+    google::protobuf::io::ArrayInputStream input(content.data(), size);
+    return google::protobuf::TextFormat::Parse(&input, message);
+  };
+  if (HasBinaryExtension(file_name) ? parse_binary() || parse_text()
+                                    : parse_text() || parse_binary()) {
+    return true;
+  }
+  AERROR << "Failed to parse file " << file_name << " as a proto.";
+  return false;
+}
+
+}  // namespace
+
 bool SetProtoToASCIIFile(const google::protobuf::Message &message,
                          int file_descriptor) {
   using google::protobuf::TextFormat;
@@ -113,25 +190,47 @@ bool SetProtoToBinaryFile(const google::protobuf::Message &message,
 
 bool GetProtoFromBinaryFile(const std::string &file_name,
                             google::protobuf::Message *message) {
-  std::fstream input(file_name, std::ios::in | std::ios::binary);
-  if (!input.good()) {
+  int file_descriptor = open(file_name.c_str(), O_RDONLY);
+  if (file_descriptor < 0) {
     AERROR << "Failed to open file " << file_name << " in binary mode.";
     return false;
   }
-  // Create a CodedInputStream that reads from the ifstream.
-  google::protobuf::io::IstreamInputStream istream_input(&input);
-  google::protobuf::io::CodedInputStream coded_input_stream(&istream_input);
-
-  // Set the total byte limit if needed.
-  coded_input_stream.SetTotalBytesLimit(671088640,671088640);
-
-  // Parse the binary proto message from the CodedInputStream.
-  if (!message->ParseFromCodedStream(&coded_input_stream)) {
-    AERROR << "Failed to parse file " << file_name << " as binary proto.";
+  struct stat file_stat;
+  if (fstat(file_descriptor, &file_stat) != 0) {
+    AERROR << "Failed to stat file " << file_name << ".";
+    close(file_descriptor);
+    return false;
+  }
+  // A message is at most INT_MAX bytes long, however it is read.
+  const size_t size = static_cast<size_t>(file_stat.st_size);
+  if (size > static_cast<size_t>(std::numeric_limits<int>::max())) {
+    AERROR << "File " << file_name << " is too large for a binary proto.";
+    close(file_descriptor);
     return false;
   }
 
-  return true;
+  // Parse a regular file straight from a mapping of it, which saves copying
+  // every byte through stream buffers. The pages are read once, front to
+  // back, and dropped behind the parse.
+  void *data = MAP_FAILED;
+  if (S_ISREG(file_stat.st_mode) && size > 0) {
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+  }
+  bool success = false;
+  if (data != MAP_FAILED) {
+    madvise(data, size, MADV_SEQUENTIAL);
+    MappedFileInputStream input(data, static_cast<int>(size));
+    success = message->ParseFromZeroCopyStream(&input);
+    munmap(data, size);
+  } else {
+    google::protobuf::io::FileInputStream input(file_descriptor);
+    success = message->ParseFromZeroCopyStream(&input);
+  }
+  close(file_descriptor);
+  if (!success) {
+    AERROR << "Failed to parse file " << file_name << " as binary proto.";
+  }
+  return success;
 }
 
 bool GetProtoFromFile(const std::string &file_name,
@@ -147,6 +246,51 @@ bool GetProtoFromFile(const std::string &file_name,
          GetProtoFromBinaryFile(file_name, message);
 }
 
+bool GetProtoFromFile(
+    const std::string &file_name, google::protobuf::Message *message,
+    const std::function<void(std::string_view)> &content_visitor) {
+  int file_descriptor = open(file_name.c_str(), O_RDONLY);
+  if (file_descriptor < 0) {
+    AERROR << "Failed to open file " << file_name << ".";
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(file_descriptor, &file_stat) != 0) {
+    AERROR << "Failed to stat file " << file_name << ".";
+    close(file_descriptor);
+    return false;
+  }
+  const size_t size = static_cast<size_t>(file_stat.st_size);
+  if (size > static_cast<size_t>(std::numeric_limits<int>::max())) {
+    AERROR << "File " << file_name << " is too large for a proto.";
+    close(file_descriptor);
+    return false;
+  }
+  void *data = MAP_FAILED;
+  if (S_ISREG(file_stat.st_mode) && size > 0) {
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+  }
+  close(file_descriptor);
+
+  if (data == MAP_FAILED) {
+    std::string content;
+    if (!GetContent(file_name, &content)) {
+      AERROR << "Failed to read file " << file_name << ".";
+      return false;
+    }
+    content_visitor(content);
+    return GetProtoFromContent(file_name, content, false, message);
+  }
+  const std::string_view content(static_cast<const char *>(data), size);
+  madvise(data, size, MADV_SEQUENTIAL);
+  content_visitor(content);
+  // The parse reads the pages again from the page cache, not the disk.
+  madvise(data, size, MADV_DONTNEED);
+  const bool success = GetProtoFromContent(file_name, content, true, message);
+  munmap(data, size);
+  return success;
+}
+
 bool GetProtoFromJsonFile(const std::string &file_name,
                           google::protobuf::Message *message) {
   using google::protobuf::util::JsonParseOptions;
@@ -29,7 +29,9 @@
 
 #include <cstdio>
 #include <fstream>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "google/protobuf/io/zero_copy_stream_impl.h"
@@ -85,6 +87,8 @@ bool SetProtoToBinaryFile(const google::protobuf::Message &message,
  * @brief Parses the content of the file specified by the file_name as binary
  *        representation of protobufs, and merges the parsed content to the
  *        proto.
+ *        A regular file is parsed from a memory mapping of it; any file
+ *        may hold up to INT_MAX bytes, the most a message can take.
  * @param file_name The name of the file to parse whose content.
  * @param message The proto to carry the parsed content in the specified file.
  * @return If the action is successful.
@@ -103,6 +107,19 @@ bool GetProtoFromBinaryFile(const std::string &file_name,
 bool GetProtoFromFile(const std::string &file_name,
                       google::protobuf::Message *message);
 
+/**
+ * @brief Parses the file like GetProtoFromFile, and passes the raw content
+ *        of the file to content_visitor before the parse, from the same
+ *        read of the file.
+ * @param file_name The name of the file to parse whose content.
+ * @param message The proto to carry the parsed content in the specified file.
+ * @param content_visitor Called once with the content of the file.
+ * @return If the action is successful.
+ */
+bool GetProtoFromFile(
+    const std::string &file_name, google::protobuf::Message *message,
+    const std::function<void(std::string_view)> &content_visitor);
+
 /**
  * @brief Parses the content of the json file specified by the file_name as ascii
  *        representation of protobufs, and merges the parsed content to the
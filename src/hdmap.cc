@@ -30,6 +30,37 @@ int HDMap::LoadMapFromProto(const Map& map_proto) {
   return impl_.LoadMapFromProto(map_proto);
 }
 
+int HDMap::LoadMapFromProto(Map&& map_proto) {
+  ADEBUG << "Loading HDMap with header: "
+         << map_proto.header().ShortDebugString();
+  return impl_.LoadMapFromProto(std::move(map_proto));
+}
+
+int HDMap::LoadSnapshot(const std::string& map_filename) {
+  AINFO << "Loading HDMap snapshot: " << map_filename << " ...";
+  return impl_.LoadSnapshot(map_filename);
+}
+
+int HDMap::AddLane(const Lane& lane) {
+  ADEBUG << "Adding lane: " << lane.id().id();
+  return impl_.AddLane(lane);
+}
+
+int HDMap::RemoveLane(const Id& id) {
+  ADEBUG << "Removing lane: " << id.id();
+  return impl_.RemoveLane(id);
+}
+
+int HDMap::GetKDTreeQueryHistograms(
+    std::map<std::string, common::math::AABoxKDTreeQueryHistograms>*
+        histograms) const {
+  return impl_.GetKDTreeQueryHistograms(histograms);
+}
+
+void HDMap::ClearKDTreeQueryHistograms() {
+  impl_.ClearKDTreeQueryHistograms();
+}
+
 LaneInfoConstPtr HDMap::GetLaneById(const Id& id) const {
   return impl_.GetLaneById(id);
 }
@@ -78,6 +109,10 @@ PNCJunctionInfoConstPtr HDMap::GetPNCJunctionById(const Id& id) const {
   return impl_.GetPNCJunctionById(id);
 }
 
+LaneInfoConstPtr HDMap::GetLaneByHandle(ElementHandle handle) const {
+  return impl_.GetLaneByHandle(handle);
+}
+
 int HDMap::GetLanes(const apollo::common::PointENU& point, double distance,
                     std::vector<LaneInfoConstPtr>* lanes) const {
   return impl_.GetLanes(point, distance, lanes);
@@ -144,6 +179,130 @@ int HDMap::GetNearestLane(const common::PointENU& point,
   return impl_.GetNearestLane(point, nearest_lane, nearest_s, nearest_l);
 }
 
+int HDMap::GetNearestLane(const common::PointENU& point,
+                          const double max_distance,
+                          LaneInfoConstPtr* nearest_lane, double* nearest_s,
+                          double* nearest_l) const {
+  return impl_.GetNearestLane(point, max_distance, nearest_lane, nearest_s,
+                              nearest_l);
+}
+
+int HDMap::GetLanes(const apollo::common::PointENU& point, double distance,
+                    QueryContext* context,
+                    std::vector<const LaneInfo*>* lanes) const {
+  return impl_.GetLanes(point, distance, context, lanes);
+}
+
+int HDMap::GetJunctions(const apollo::common::PointENU& point, double distance,
+                        QueryContext* context,
+                        std::vector<const JunctionInfo*>* junctions) const {
+  return impl_.GetJunctions(point, distance, context, junctions);
+}
+
+int HDMap::GetSignals(const apollo::common::PointENU& point, double distance,
+                      QueryContext* context,
+                      std::vector<const SignalInfo*>* signals) const {
+  return impl_.GetSignals(point, distance, context, signals);
+}
+
+int HDMap::GetCrosswalks(const apollo::common::PointENU& point, double distance,
+                         QueryContext* context,
+                         std::vector<const CrosswalkInfo*>* crosswalks) const {
+  return impl_.GetCrosswalks(point, distance, context, crosswalks);
+}
+
+int HDMap::GetStopSigns(const apollo::common::PointENU& point, double distance,
+                        QueryContext* context,
+                        std::vector<const StopSignInfo*>* stop_signs) const {
+  return impl_.GetStopSigns(point, distance, context, stop_signs);
+}
+
+int HDMap::GetYieldSigns(const apollo::common::PointENU& point, double distance,
+                         QueryContext* context,
+                         std::vector<const YieldSignInfo*>* yield_signs) const {
+  return impl_.GetYieldSigns(point, distance, context, yield_signs);
+}
+
+int HDMap::GetClearAreas(const apollo::common::PointENU& point, double distance,
+                         QueryContext* context,
+                         std::vector<const ClearAreaInfo*>* clear_areas) const {
+  return impl_.GetClearAreas(point, distance, context, clear_areas);
+}
+
+int HDMap::GetSpeedBumps(const apollo::common::PointENU& point, double distance,
+                         QueryContext* context,
+                         std::vector<const SpeedBumpInfo*>* speed_bumps) const {
+  return impl_.GetSpeedBumps(point, distance, context, speed_bumps);
+}
+
+int HDMap::GetParkingSpaces(
+    const apollo::common::PointENU& point, double distance,
+    QueryContext* context,
+    std::vector<const ParkingSpaceInfo*>* parking_spaces) const {
+  return impl_.GetParkingSpaces(point, distance, context, parking_spaces);
+}
+
+int HDMap::GetPNCJunctions(
+    const apollo::common::PointENU& point, double distance,
+    QueryContext* context,
+    std::vector<const PNCJunctionInfo*>* pnc_junctions) const {
+  return impl_.GetPNCJunctions(point, distance, context, pnc_junctions);
+}
+
+int HDMap::GetRoads(const apollo::common::PointENU& point, double distance,
+                    QueryContext* context,
+                    std::vector<const RoadInfo*>* roads) const {
+  return impl_.GetRoads(point, distance, context, roads);
+}
+
+int HDMap::GetNearestLane(const apollo::common::PointENU& point,
+                          const LaneInfo** nearest_lane, double* nearest_s,
+                          double* nearest_l) const {
+  return impl_.GetNearestLane(point, nearest_lane, nearest_s, nearest_l);
+}
+
+int HDMap::GetNearestLane(const apollo::common::PointENU& point,
+                          const double max_distance,
+                          const LaneInfo** nearest_lane, double* nearest_s,
+                          double* nearest_l) const {
+  return impl_.GetNearestLane(point, max_distance, nearest_lane, nearest_s,
+                              nearest_l);
+}
+
+int HDMap::GetKNearestLanes(const apollo::common::PointENU& point, const int k,
+                            const double max_distance,
+                            std::vector<LaneInfoConstPtr>* lanes,
+                            std::vector<double>* nearest_s,
+                            std::vector<double>* nearest_l) const {
+  return impl_.GetKNearestLanes(point, k, max_distance, lanes, nearest_s,
+                                nearest_l);
+}
+
+int HDMap::GetNearestLaneBatch(
+    const std::vector<apollo::common::math::Vec2d>& points,
+    const int num_threads, std::vector<LaneProjection>* results) const {
+  return impl_.GetNearestLaneBatch(points, num_threads, results);
+}
+
+int HDMap::GetNearestLaneSegment(
+    const apollo::common::math::Vec2d& point, const LaneSegmentBox* seed,
+    const LaneSegmentBox** nearest_segment) const {
+  return impl_.GetNearestLaneSegment(point, seed, nearest_segment);
+}
+
+int HDMap::GetLaneSegments(
+    const apollo::common::math::Vec2d& point, const double distance,
+    std::vector<const LaneSegmentBox*>* segments) const {
+  return impl_.GetLaneSegments(point, distance, segments);
+}
+
+int HDMap::GetLanesBatch(
+    const std::vector<apollo::common::math::Vec2d>& points,
+    const double distance, const int num_threads,
+    std::vector<std::vector<ElementHandle>>* lane_handles) const {
+  return impl_.GetLanesBatch(points, distance, num_threads, lane_handles);
+}
+
 int HDMap::GetNearestLaneWithHeading(const apollo::common::PointENU& point,
                                      const double distance,
                                      const double central_heading,
@@ -201,6 +360,41 @@ int HDMap::GetStopSignAssociatedLanes(
   return impl_.GetStopSignAssociatedLanes(id, lanes);
 }
 
+int HDMap::GetObjectsInPolygon(const apollo::common::math::Polygon2d& polygon,
+                               const MapElementTypeMask type_mask,
+                               MapObjects* objects) const {
+  return impl_.GetObjectsInPolygon(polygon, type_mask, objects);
+}
+
+int HDMap::GetObjectsInBox(const apollo::common::math::Box2d& box,
+                           const MapElementTypeMask type_mask,
+                           MapObjects* objects) const {
+  return impl_.GetObjectsInBox(box, type_mask, objects);
+}
+
+int HDMap::GetObjectsAlongPath(
+    const std::vector<apollo::common::math::Vec2d>& path,
+    const double distance, const MapElementTypeMask type_mask,
+    MapObjects* objects) const {
+  return impl_.GetObjectsAlongPath(path, distance, type_mask, objects);
+}
+
+int HDMap::GetLanesInPolygon(const apollo::common::math::Polygon2d& polygon,
+                             std::vector<LaneInfoConstPtr>* lanes) const {
+  return impl_.GetLanesInPolygon(polygon, lanes);
+}
+
+int HDMap::GetLanesInBox(const apollo::common::math::Box2d& box,
+                         std::vector<LaneInfoConstPtr>* lanes) const {
+  return impl_.GetLanesInBox(box, lanes);
+}
+
+int HDMap::GetLanesAlongPath(
+    const std::vector<apollo::common::math::Vec2d>& path,
+    const double distance, std::vector<LaneInfoConstPtr>* lanes) const {
+  return impl_.GetLanesAlongPath(path, distance, lanes);
+}
+
 int HDMap::GetLocalMap(const apollo::common::PointENU& point,
                        const std::pair<double, double>& range,
                        Map* local_map) const {
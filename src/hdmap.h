@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
@@ -49,6 +50,9 @@ namespace hdmap {
  * @class HDMap
  *
  * @brief High-precision map loader interface.
+ *
+ * Once a map is loaded the const query methods may be called concurrently
+ * from multiple threads, as long as no lanes are being added or removed.
  */
 class HDMap {
  public:
@@ -66,6 +70,69 @@ class HDMap {
    */
   int LoadMapFromProto(const Map& map_proto);
 
+  /**
+   * @brief load map from a given protobuf message without copying it. The
+   * elements of the map refer into the message, so moving it in keeps a
+   * single copy of the map data in memory.
+   * @param map_proto map data in protobuf format, which the map takes over
+   * and leaves empty
+   * @return 0:success, otherwise failed
+   */
+  int LoadMapFromProto(Map&& map_proto);
+
+  /**
+   * @brief load a proto map file with its prebuilt spatial indices, which
+   * are kept in <map_filename>.index, whatever FLAGS_hdmap_use_index_file
+   * says. If that file is missing, or was saved for other map file content,
+   * the indices are built and saved there, so the first load writes the
+   * snapshot and later ones skip building the indices. The map itself is
+   * still parsed and its elements built on every load.
+   * @param map_filename path of a proto map file; OpenDRIVE maps have no
+   * snapshot
+   * @return 0:success, otherwise failed
+   */
+  int LoadSnapshot(const std::string& map_filename);
+
+  /**
+   * @brief add a lane to the loaded map, or replace the lane with the same
+   * id, updating the spatial indices in place instead of reloading the map.
+   * The lane takes part in queries right away, with the overlaps and roads
+   * that refer to it; the loaded map proto is left as it was. Must not run
+   * concurrently with queries, and LaneTrackers must be reset afterwards.
+   * Elements and lane segments that queries returned before stay valid
+   * until the next map load, including those of a replaced lane, which no
+   * longer take part in queries; the handle of a replaced lane resolves to
+   * nullptr from then on.
+   * @param lane the lane
+   * @return 0:success, otherwise failed
+   */
+  int AddLane(const Lane& lane);
+
+  /**
+   * @brief remove a lane from the loaded map, updating the spatial indices
+   * in place. The same restrictions and guarantees as for AddLane apply.
+   * @param id lane id
+   * @return 0:success, otherwise failed
+   */
+  int RemoveLane(const Id& id);
+
+  /**
+   * @brief get histograms of the work the spatial index queries of each
+   * layer did since the map was loaded, with their costliest query points,
+   * to tell which map regions slow queries come from. They are only kept
+   * when built with APOLLO_HDMAP_KDTREE_STATS.
+   * @param histograms the histograms by layer name, e.g. "lane"
+   * @return 0:success, otherwise failed (including when they are not kept)
+   */
+  int GetKDTreeQueryHistograms(
+      std::map<std::string, apollo::common::math::AABoxKDTreeQueryHistograms>*
+          histograms) const;
+
+  /**
+   * @brief clear the histograms GetKDTreeQueryHistograms returns
+   */
+  void ClearKDTreeQueryHistograms();
+
   LaneInfoConstPtr GetLaneById(const Id& id) const;
   JunctionInfoConstPtr GetJunctionById(const Id& id) const;
   SignalInfoConstPtr GetSignalById(const Id& id) const;
@@ -79,6 +146,13 @@ class HDMap {
   ParkingSpaceInfoConstPtr GetParkingSpaceById(const Id& id) const;
   PNCJunctionInfoConstPtr GetPNCJunctionById(const Id& id) const;
   RSUInfoConstPtr GetRSUById(const Id& id) const;
+  /**
+   * @brief get a lane by the handle reported by the batch queries
+   * @param handle lane handle, valid until the next map load
+   * @return the lane, or nullptr if the handle is invalid or its lane was
+   * removed or replaced since
+   */
+  LaneInfoConstPtr GetLaneByHandle(ElementHandle handle) const;
 
   /**
    * @brief get all lanes in certain range
@@ -192,6 +266,240 @@ class HDMap {
   int GetNearestLane(const apollo::common::PointENU& point,
                      LaneInfoConstPtr* nearest_lane, double* nearest_s,
                      double* nearest_l) const;
+  /**
+   * @brief get nearest lane from target point within a distance, which
+   * bounds the search from the start and so is faster off the map or in
+   * sparse areas than filtering the result of the unbounded search
+   * @param point the target point
+   * @param max_distance lanes farther than this are ignored
+   * @param nearest_lane the nearest lane
+   * @param nearest_s the offset from lane start point along lane center line
+   * @param nearest_l the lateral offset from lane center line
+   * @return 0:success, otherwise, failed (including no lane in range).
+   */
+  int GetNearestLane(const apollo::common::PointENU& point,
+                     double max_distance, LaneInfoConstPtr* nearest_lane,
+                     double* nearest_s, double* nearest_l) const;
+  /**
+   * @brief get all lanes in certain range as raw pointers, which stay valid
+   * until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param lanes store all lanes in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetLanes(const apollo::common::PointENU& point, double distance,
+               QueryContext* context,
+               std::vector<const LaneInfo*>* lanes) const;
+  /**
+   * @brief get all junctions in certain range as raw pointers, which stay valid
+   * until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param junctions store all junctions in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetJunctions(const apollo::common::PointENU& point, double distance,
+                   QueryContext* context,
+                   std::vector<const JunctionInfo*>* junctions) const;
+  /**
+   * @brief get all signals in certain range as raw pointers, which stay valid
+   * until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param signals store all signals in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetSignals(const apollo::common::PointENU& point, double distance,
+                 QueryContext* context,
+                 std::vector<const SignalInfo*>* signals) const;
+  /**
+   * @brief get all crosswalks in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param crosswalks store all crosswalks in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetCrosswalks(const apollo::common::PointENU& point, double distance,
+                    QueryContext* context,
+                    std::vector<const CrosswalkInfo*>* crosswalks) const;
+  /**
+   * @brief get all stop signs in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param stop_signs store all stop signs in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetStopSigns(const apollo::common::PointENU& point, double distance,
+                   QueryContext* context,
+                   std::vector<const StopSignInfo*>* stop_signs) const;
+  /**
+   * @brief get all yield signs in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param yield_signs store all yield signs in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetYieldSigns(const apollo::common::PointENU& point, double distance,
+                    QueryContext* context,
+                    std::vector<const YieldSignInfo*>* yield_signs) const;
+  /**
+   * @brief get all clear areas in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param clear_areas store all clear areas in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetClearAreas(const apollo::common::PointENU& point, double distance,
+                    QueryContext* context,
+                    std::vector<const ClearAreaInfo*>* clear_areas) const;
+  /**
+   * @brief get all speed bumps in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param speed_bumps store all speed bumps in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetSpeedBumps(const apollo::common::PointENU& point, double distance,
+                    QueryContext* context,
+                    std::vector<const SpeedBumpInfo*>* speed_bumps) const;
+  /**
+   * @brief get all parking spaces in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param parking_spaces store all parking spaces in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetParkingSpaces(
+      const apollo::common::PointENU& point, double distance,
+      QueryContext* context,
+      std::vector<const ParkingSpaceInfo*>* parking_spaces) const;
+  /**
+   * @brief get all pnc junctions in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param pnc_junctions store all pnc junctions in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetPNCJunctions(const apollo::common::PointENU& point, double distance,
+                      QueryContext* context,
+                      std::vector<const PNCJunctionInfo*>* pnc_junctions) const;
+  /**
+   * @brief get all roads in certain range as raw pointers, which stay valid
+   * until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param roads store all roads in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetRoads(const apollo::common::PointENU& point, double distance,
+               QueryContext* context,
+               std::vector<const RoadInfo*>* roads) const;
+  /**
+   * @brief get nearest lane from target point as a raw pointer, which stays
+   * valid until the next map load
+   * @param point the target point
+   * @param nearest_lane the nearest lane
+   * @param nearest_s the offset from lane start point along lane center line
+   * @param nearest_l the lateral offset from lane center line
+   * @return 0:success, otherwise, failed.
+   */
+  int GetNearestLane(const apollo::common::PointENU& point,
+                     const LaneInfo** nearest_lane, double* nearest_s,
+                     double* nearest_l) const;
+  /**
+   * @brief get nearest lane within a distance from target point as a raw
+   * pointer, which stays valid until the next map load
+   * @param point the target point
+   * @param max_distance lanes farther than this are ignored
+   * @param nearest_lane the nearest lane
+   * @param nearest_s the offset from lane start point along lane center line
+   * @param nearest_l the lateral offset from lane center line
+   * @return 0:success, otherwise, failed (including no lane in range).
+   */
+  int GetNearestLane(const apollo::common::PointENU& point,
+                     double max_distance, const LaneInfo** nearest_lane,
+                     double* nearest_s, double* nearest_l) const;
+  /**
+   * @brief get the k nearest distinct lanes to a target point
+   * @param point the target point
+   * @param k the maximum number of lanes to return
+   * @param max_distance lanes farther than this are ignored
+   * @param lanes the nearest lanes, nearest first
+   * @param nearest_s the offset of point along each lane's center line
+   * @param nearest_l the lateral offset of point from each lane's center line
+   * @return 0:success, otherwise, failed (including no lane in range).
+   */
+  int GetKNearestLanes(const apollo::common::PointENU& point, int k,
+                       double max_distance,
+                       std::vector<LaneInfoConstPtr>* lanes,
+                       std::vector<double>* nearest_s,
+                       std::vector<double>* nearest_l) const;
+  /**
+   * @brief get the nearest lane of every point in a batch, e.g. all points
+   * of a trajectory. Gives the same lanes as calling GetNearestLane per point.
+   * @param points the target points
+   * @param num_threads number of threads to split the batch across
+   * @param results one (lane handle, s, l) per point, in input order
+   * @return 0:success, otherwise, failed.
+   */
+  int GetNearestLaneBatch(
+      const std::vector<apollo::common::math::Vec2d>& points, int num_threads,
+      std::vector<LaneProjection>* results) const;
+  /**
+   * @brief get the nearest lane segment from target point, starting from a
+   * segment known to be close to it. Gives the same answer as
+   * GetNearestLane; see LaneTracker for a stateful wrapper.
+   * @param point the target point
+   * @param seed a segment of this map, or nullptr for no seed; a segment
+   * of a lane removed since counts as no seed
+   * @param nearest_segment the nearest segment
+   * @return 0:success, otherwise, failed.
+   */
+  int GetNearestLaneSegment(const apollo::common::math::Vec2d& point,
+                            const LaneSegmentBox* seed,
+                            const LaneSegmentBox** nearest_segment) const;
+  /**
+   * @brief get all lane segments in certain range
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param segments store all lane segments in target range, valid until
+   * the next map load
+   * @return 0:success, otherwise failed
+   */
+  int GetLaneSegments(const apollo::common::math::Vec2d& point,
+                      double distance,
+                      std::vector<const LaneSegmentBox*>* segments) const;
+  /**
+   * @brief get all lanes in certain range of every point in a batch
+   * @param points the central points of the ranges
+   * @param distance the search radius
+   * @param num_threads number of threads to split the batch across
+   * @param lane_handles handles of the lanes in range, one list per point
+   * @return 0:success, otherwise failed
+   */
+  int GetLanesBatch(
+      const std::vector<apollo::common::math::Vec2d>& points, double distance,
+      int num_threads,
+      std::vector<std::vector<ElementHandle>>* lane_handles) const;
   /**
    * @brief get the nearest lane within a certain range by pose
    * @param point the target position
@@ -287,6 +595,72 @@ class HDMap {
   int GetStopSignAssociatedLanes(const Id& id,
                                  std::vector<LaneInfoConstPtr>* lanes) const;
 
+  /**
+   * @brief get all map elements of the given types that overlap a polygon,
+   * in one traversal of the combined index
+   * @param polygon the search region, with at least 3 points
+   * @param type_mask the types to search, built from MapElementTypeBit
+   * @param objects the matching elements grouped by type
+   * @return 0:success, otherwise failed
+   */
+  int GetObjectsInPolygon(const apollo::common::math::Polygon2d& polygon,
+                          const MapElementTypeMask type_mask,
+                          MapObjects* objects) const;
+
+  /**
+   * @brief get all map elements of the given types that overlap a box
+   * @param box the search region
+   * @param type_mask the types to search, built from MapElementTypeBit
+   * @param objects the matching elements grouped by type
+   * @return 0:success, otherwise failed
+   */
+  int GetObjectsInBox(const apollo::common::math::Box2d& box,
+                      const MapElementTypeMask type_mask,
+                      MapObjects* objects) const;
+
+  /**
+   * @brief get all map elements of the given types within distance of a
+   * polyline, in one traversal of the combined index
+   * @param path the polyline; a single point searches a disc
+   * @param distance the search distance on either side of the path
+   * @param type_mask the types to search, built from MapElementTypeBit
+   * @param objects the matching elements grouped by type
+   * @return 0:success, otherwise failed
+   */
+  int GetObjectsAlongPath(const std::vector<apollo::common::math::Vec2d>& path,
+                          const double distance,
+                          const MapElementTypeMask type_mask,
+                          MapObjects* objects) const;
+
+  /**
+   * @brief get all lanes that overlap a polygon
+   * @param polygon the search region, with at least 3 points
+   * @param lanes all lanes that overlap the polygon
+   * @return 0:success, otherwise failed
+   */
+  int GetLanesInPolygon(const apollo::common::math::Polygon2d& polygon,
+                        std::vector<LaneInfoConstPtr>* lanes) const;
+
+  /**
+   * @brief get all lanes that overlap a box
+   * @param box the search region
+   * @param lanes all lanes that overlap the box
+   * @return 0:success, otherwise failed
+   */
+  int GetLanesInBox(const apollo::common::math::Box2d& box,
+                    std::vector<LaneInfoConstPtr>* lanes) const;
+
+  /**
+   * @brief get all lanes within distance of a polyline
+   * @param path the polyline; a single point searches a disc
+   * @param distance the search distance on either side of the path
+   * @param lanes all lanes within distance of the path
+   * @return 0:success, otherwise failed
+   */
+  int GetLanesAlongPath(const std::vector<apollo::common::math::Vec2d>& path,
+                        const double distance,
+                        std::vector<LaneInfoConstPtr>* lanes) const;
+
   /**
    * @brief get a local map which is identical to the origin map except that all
    * map elements without overlap with the given region are deleted.
@@ -18,6 +18,7 @@ limitations under the License.
 #include <algorithm>
 #include <limits>
 
+#include "config_gflags.h"
 #include "log.h"
 #include "math/linear_interpolation.h"
 #include "math/math_utils.h"
@@ -103,7 +104,14 @@ PointENU PointFromVec2d(const Vec2d &point) {
 
 }  // namespace
 
-LaneInfo::LaneInfo(const Lane &lane) : lane_(lane) { Init(); }
+LaneInfo::LaneInfo(const Lane &lane) : lane_(lane) {
+  Init();
+  CreateKDTree();
+}
+
+LaneInfo::LaneInfo(const Lane &lane, DeferSegmentIndex) : lane_(lane) {
+  Init();
+}
 
 void LaneInfo::Init() {
   PointsFromCurve(lane_.central_curve(), &points_);
@@ -177,8 +185,6 @@ void LaneInfo::Init() {
   for (const auto &sample : lane_.right_road_sample()) {
     sampled_right_road_width_.emplace_back(sample.s(), sample.width());
   }
-
-  CreateKDTree();
 }
 
 void LaneInfo::GetWidth(const double s, double *left_width,
@@ -359,9 +365,9 @@ PointENU LaneInfo::GetSmoothPoint(double s) const {
 }
 
 double LaneInfo::DistanceTo(const Vec2d &point) const {
-  const auto segment_box = lane_segment_kdtree_->GetNearestObject(point);
-  RETURN_VAL_IF_NULL(segment_box, 0.0);
-  return segment_box->DistanceTo(point);
+  const int index = GetNearestSegmentIndex(point);
+  RETURN_VAL_IF(index < 0, 0.0);
+  return segments_[index].DistanceTo(point);
 }
 
 double LaneInfo::DistanceTo(const Vec2d &point, Vec2d *map_point,
@@ -370,9 +376,8 @@ double LaneInfo::DistanceTo(const Vec2d &point, Vec2d *map_point,
   RETURN_VAL_IF_NULL(s_offset, 0.0);
   RETURN_VAL_IF_NULL(s_offset_index, 0.0);
 
-  const auto segment_box = lane_segment_kdtree_->GetNearestObject(point);
-  RETURN_VAL_IF_NULL(segment_box, 0.0);
-  int index = segment_box->id();
+  const int index = GetNearestSegmentIndex(point);
+  RETURN_VAL_IF(index < 0, 0.0);
   double distance = segments_[index].DistanceTo(point, map_point);
   *s_offset_index = index;
   *s_offset =
@@ -384,9 +389,8 @@ PointENU LaneInfo::GetNearestPoint(const Vec2d &point, double *distance) const {
   PointENU empty_point;
   RETURN_VAL_IF_NULL(distance, empty_point);
 
-  const auto segment_box = lane_segment_kdtree_->GetNearestObject(point);
-  RETURN_VAL_IF_NULL(segment_box, empty_point);
-  int index = segment_box->id();
+  const int index = GetNearestSegmentIndex(point);
+  RETURN_VAL_IF(index < 0, empty_point);
   Vec2d nearest_point;
   *distance = segments_[index].DistanceTo(point, &nearest_point);
 
@@ -398,20 +402,12 @@ bool LaneInfo::GetProjection(const Vec2d &point, double *accumulate_s,
   RETURN_VAL_IF_NULL(accumulate_s, false);
   RETURN_VAL_IF_NULL(lateral, false);
 
-  if (segments_.empty()) {
+  const int min_index = GetNearestSegmentIndex(point);
+  if (min_index < 0) {
     return false;
   }
-  double min_dist = std::numeric_limits<double>::infinity();
-  int seg_num = static_cast<int>(segments_.size());
-  int min_index = 0;
-  for (int i = 0; i < seg_num; ++i) {
-    const double distance = segments_[i].DistanceSquareTo(point);
-    if (distance < min_dist) {
-      min_index = i;
-      min_dist = distance;
-    }
-  }
-  min_dist = std::sqrt(min_dist);
+  const int seg_num = static_cast<int>(segments_.size());
+  const double min_dist = segments_[min_index].DistanceTo(point);
   const auto &nearest_seg = segments_[min_index];
   const auto prod = nearest_seg.ProductOntoUnit(point);
   const auto proj = nearest_seg.ProjectOntoUnit(point);
@@ -437,8 +433,39 @@ bool LaneInfo::GetProjection(const Vec2d &point, double *accumulate_s,
   return true;
 }
 
+void LaneInfo::GetSegmentProjection(const Vec2d &point, const int segment_index,
+                                    double *accumulate_s,
+                                    double *lateral) const {
+  const auto &segment = segments_[segment_index];
+  Vec2d nearest_pt;
+  segment.DistanceTo(point, &nearest_pt);
+  *accumulate_s =
+      accumulated_s_[segment_index] + nearest_pt.DistanceTo(segment.start());
+  *lateral = segment.unit_direction().CrossProd(point - segment.start());
+}
+
 void LaneInfo::PostProcess(const HDMapImpl &map_instance) {
   UpdateOverlaps(map_instance);
+  UpdateLaneHandles(map_instance);
+}
+
+void LaneInfo::UpdateLaneHandles(const HDMapImpl &map_instance) {
+  // Lanes that are not in the map, for instance because they have been
+  // removed, are left out.
+  predecessor_handles_.clear();
+  for (const auto &lane_id : lane_.predecessor_id()) {
+    const ElementHandle handle = map_instance.GetLaneHandle(lane_id);
+    if (handle != kInvalidElementHandle) {
+      predecessor_handles_.push_back(handle);
+    }
+  }
+  successor_handles_.clear();
+  for (const auto &lane_id : lane_.successor_id()) {
+    const ElementHandle handle = map_instance.GetLaneHandle(lane_id);
+    if (handle != kInvalidElementHandle) {
+      successor_handles_.push_back(handle);
+    }
+  }
 }
 
 void LaneInfo::UpdateOverlaps(const HDMapImpl &map_instance) {
@@ -454,7 +481,7 @@ void LaneInfo::UpdateOverlaps(const HDMapImpl &map_instance) {
       if (object_id == lane_.id().id()) {
         continue;
       }
-      const auto &object_map_id = MakeMapId(object_id);
+      const auto &object_map_id = object.id();
       if (map_instance.GetLaneById(object_map_id) != nullptr) {
         cross_lanes_.emplace_back(overlap_ptr);
       }
@@ -490,18 +517,86 @@ void LaneInfo::UpdateOverlaps(const HDMapImpl &map_instance) {
 }
 
 void LaneInfo::CreateKDTree() {
+  CreateSegmentBoxes();
+  if (!UseKDTree()) {
+    return;
+  }
   apollo::common::math::AABoxKDTreeParams params;
   params.max_leaf_dimension = 5.0;  // meters.
   params.max_leaf_size = 16;
+  params.compact = FLAGS_hdmap_compact_index;
+  lane_segment_kdtree_.reset(new LaneSegmentKDTree(segment_box_list_, params));
+}
+
+bool LaneInfo::LoadKDTree(std::string_view *data) {
+  // A byte for whether a tree follows, which must agree with the current
+  // FLAGS_hdmap_lane_kdtree_min_segments.
+  if (data->empty() || (data->front() != 0) != UseKDTree()) {
+    return false;
+  }
+  data->remove_prefix(1);
+  CreateSegmentBoxes();
+  if (!UseKDTree()) {
+    return true;
+  }
+  apollo::common::math::AABoxKDTreeParams params;
+  params.compact = FLAGS_hdmap_compact_index;
+  lane_segment_kdtree_ =
+      LaneSegmentKDTree::Deserialize(segment_box_list_, params, data);
+  return lane_segment_kdtree_ != nullptr;
+}
 
+bool LaneInfo::SaveKDTree(std::string *data) const {
+  data->push_back(lane_segment_kdtree_ != nullptr ? 1 : 0);
+  return lane_segment_kdtree_ == nullptr ||
+         lane_segment_kdtree_->Serialize(segment_box_list_, data);
+}
+
+bool LaneInfo::UseKDTree() const {
+  return static_cast<int>(segments_.size()) >=
+         std::max(1, FLAGS_hdmap_lane_kdtree_min_segments);
+}
+
+void LaneInfo::CreateSegmentBoxes() {
   segment_box_list_.clear();
+  segment_batch_ = apollo::common::math::LineSegment2dBatch();
+  lane_segment_kdtree_.reset();
+  if (!UseKDTree()) {
+    segment_batch_.Reserve(static_cast<int>(segments_.size()));
+    for (const auto &segment : segments_) {
+      segment_batch_.Append(segment);
+    }
+    return;
+  }
+  segment_box_list_.reserve(segments_.size());
   for (size_t id = 0; id < segments_.size(); ++id) {
     const auto &segment = segments_[id];
     segment_box_list_.emplace_back(
         apollo::common::math::AABox2d(segment.start(), segment.end()), this,
         &segment, id);
   }
-  lane_segment_kdtree_.reset(new LaneSegmentKDTree(segment_box_list_, params));
+}
+
+int LaneInfo::GetNearestSegmentIndex(const Vec2d &point) const {
+  if (lane_segment_kdtree_ != nullptr) {
+    const auto segment_box = lane_segment_kdtree_->GetNearestObject(point);
+    return segment_box == nullptr ? -1 : segment_box->id();
+  }
+  constexpr int kBatchSize = 16;
+  double distances_sqr[kBatchSize];
+  double min_distance_sqr = std::numeric_limits<double>::infinity();
+  int min_index = -1;
+  for (int begin = 0; begin < segment_batch_.size(); begin += kBatchSize) {
+    const int end = std::min(segment_batch_.size(), begin + kBatchSize);
+    segment_batch_.DistanceSquareTo(point, begin, end, distances_sqr);
+    for (int i = begin; i < end; ++i) {
+      if (distances_sqr[i - begin] < min_distance_sqr) {
+        min_distance_sqr = distances_sqr[i - begin];
+        min_index = i;
+      }
+    }
+  }
+  return min_index;
 }
 
 JunctionInfo::JunctionInfo(const Junction &junction) : junction_(junction) {
@@ -656,15 +751,15 @@ const ObjectOverlapInfo *OverlapInfo::GetObjectOverlapInfo(const Id &id) const {
   return nullptr;
 }
 
-RoadInfo::RoadInfo(const Road &road) : road_(road) {
+RoadInfo::RoadInfo(const Road &road) : road_(road) {}
+
+std::vector<RoadBoundary> RoadInfo::GetBoundaries() const {
+  std::vector<RoadBoundary> road_boundaries;
+  road_boundaries.reserve(road_.section_size());
   for (const auto &section : road_.section()) {
-    sections_.push_back(section);
-    road_boundaries_.push_back(section.boundary());
+    road_boundaries.push_back(section.boundary());
   }
-}
-
-const std::vector<RoadBoundary> &RoadInfo::GetBoundaries() const {
-  return road_boundaries_;
+  return road_boundaries;
 }
 
 ParkingSpaceInfo::ParkingSpaceInfo(const ParkingSpace &parking_space)
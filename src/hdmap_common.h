@@ -17,14 +17,17 @@ limitations under the License.
 
 #include <memory>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
 #include "math/aabox2d.h"
 #include "math/aaboxkdtree2d.h"
+#include "math/line_segment2d_batch.h"
 #include "math/math_utils.h"
 #include "math/polygon2d.h"
 #include "math/vec2d.h"
+#include "hdmap_element_table.h"
 #include "map_clear_area.pb.h"
 #include "map_crosswalk.pb.h"
 #include "map_id.pb.h"
@@ -52,8 +55,12 @@ class ObjectWithAABox {
  public:
   ObjectWithAABox(const apollo::common::math::AABox2d &aabox,
                   const Object *object, const GeoObject *geo_object,
-                  const int id)
-      : aabox_(aabox), object_(object), geo_object_(geo_object), id_(id) {}
+                  const int id, const int object_index = 0)
+      : aabox_(aabox),
+        object_(object),
+        geo_object_(geo_object),
+        id_(id),
+        object_index_(object_index) {}
   ~ObjectWithAABox() {}
   const apollo::common::math::AABox2d &aabox() const { return aabox_; }
   double DistanceTo(const apollo::common::math::Vec2d &point) const {
@@ -65,14 +72,76 @@ class ObjectWithAABox {
   const Object *object() const { return object_; }
   const GeoObject *geo_object() const { return geo_object_; }
   int id() const { return id_; }
+  // Handle of object() in its ElementTable, so queries can dedupe and resolve
+  // owners without a string-id lookup.
+  int object_index() const { return object_index_; }
 
  private:
   apollo::common::math::AABox2d aabox_;
   const Object *object_;
   const GeoObject *geo_object_;
   int id_;
+  int object_index_;
 };
 
+enum class MapElementType {
+  LANE = 0,
+  JUNCTION = 1,
+  CROSSWALK = 2,
+  SIGNAL = 3,
+  STOP_SIGN = 4,
+  YIELD_SIGN = 5,
+  CLEAR_AREA = 6,
+  SPEED_BUMP = 7,
+  PARKING_SPACE = 8,
+  PNC_JUNCTION = 9,
+};
+constexpr int kNumMapElementTypes = 10;
+
+using MapElementTypeMask = uint32_t;
+constexpr MapElementTypeMask MapElementTypeBit(const MapElementType type) {
+  return MapElementTypeMask(1) << static_cast<int>(type);
+}
+
+// One line segment or polygon of a map element of any type, tagged with the
+// type and the element's handle, for the combined spatial index.
+class MapElementBox {
+ public:
+  MapElementBox(const apollo::common::math::AABox2d &aabox,
+                const MapElementType type, const ElementHandle handle,
+                const apollo::common::math::LineSegment2d *segment)
+      : aabox_(aabox), segment_(segment), type_(type), handle_(handle) {}
+  MapElementBox(const apollo::common::math::AABox2d &aabox,
+                const MapElementType type, const ElementHandle handle,
+                const apollo::common::math::Polygon2d *polygon)
+      : aabox_(aabox), polygon_(polygon), type_(type), handle_(handle) {}
+  const apollo::common::math::AABox2d &aabox() const { return aabox_; }
+  double DistanceTo(const apollo::common::math::Vec2d &point) const {
+    return segment_ != nullptr ? segment_->DistanceTo(point)
+                               : polygon_->DistanceTo(point);
+  }
+  double DistanceSquareTo(const apollo::common::math::Vec2d &point) const {
+    return segment_ != nullptr ? segment_->DistanceSquareTo(point)
+                               : polygon_->DistanceSquareTo(point);
+  }
+  /// The segment of the element, or nullptr if it is a polygon.
+  const apollo::common::math::LineSegment2d *segment() const {
+    return segment_;
+  }
+  /// The polygon of the element, or nullptr if it is a segment.
+  const apollo::common::math::Polygon2d *polygon() const { return polygon_; }
+  MapElementType type() const { return type_; }
+  ElementHandle handle() const { return handle_; }
+
+ private:
+  apollo::common::math::AABox2d aabox_;
+  const apollo::common::math::LineSegment2d *segment_ = nullptr;
+  const apollo::common::math::Polygon2d *polygon_ = nullptr;
+  MapElementType type_;
+  ElementHandle handle_;
+};
+using MapElementKDTree = apollo::common::math::AABoxKDTree2d<MapElementBox>;
+
 class LaneInfo;
 class JunctionInfo;
 class CrosswalkInfo;
@@ -118,6 +187,13 @@ struct RoadRoi {
   std::vector<PolygonBoundary> holes_boundary;
 };
 
+// A point projected onto a lane, identified by its handle in the lane table.
+struct LaneProjection {
+  ElementHandle lane_handle = kInvalidElementHandle;
+  double s = 0.0;
+  double l = 0.0;
+};
+
 using LaneSegmentBox =
     ObjectWithAABox<LaneInfo, apollo::common::math::LineSegment2d>;
 using LaneSegmentKDTree = apollo::common::math::AABoxKDTree2d<LaneSegmentBox>;
@@ -138,9 +214,36 @@ using RoadRoiPtr = std::shared_ptr<RoadRoi>;
 using PNCJunctionInfoConstPtr = std::shared_ptr<const PNCJunctionInfo>;
 using RSUInfoConstPtr = std::shared_ptr<const RSUInfo>;
 
+/// Map elements found by a region query, grouped by type. Types left out of
+/// the query's type mask stay empty.
+struct MapObjects {
+  std::vector<LaneInfoConstPtr> lanes;
+  std::vector<JunctionInfoConstPtr> junctions;
+  std::vector<CrosswalkInfoConstPtr> crosswalks;
+  std::vector<SignalInfoConstPtr> signals;
+  std::vector<StopSignInfoConstPtr> stop_signs;
+  std::vector<YieldSignInfoConstPtr> yield_signs;
+  std::vector<ClearAreaInfoConstPtr> clear_areas;
+  std::vector<SpeedBumpInfoConstPtr> speed_bumps;
+  std::vector<ParkingSpaceInfoConstPtr> parking_spaces;
+  std::vector<PNCJunctionInfoConstPtr> pnc_junctions;
+};
+
+// The *Info classes below keep a reference to the proto they are built
+// from, and never copy it: the proto must outlive the Info. HDMap builds
+// them over the map it owns; code that builds one itself has to keep the
+// proto alive as long.
 class LaneInfo {
+ private:
+  // Passed by HDMapImpl, which builds the segment indices of all lanes
+  // together once they are loaded, through CreateKDTree() or LoadKDTree().
+  struct DeferSegmentIndex {};
+
  public:
   explicit LaneInfo(const Lane &lane);
+  // Leaves the lane without a segment index, for HDMapImpl only: the
+  // queries on the lane's segments need the index.
+  LaneInfo(const Lane &lane, DeferSegmentIndex);
 
   const Id &id() const { return lane_.id(); }
   const Id &road_id() const { return road_id_; }
@@ -159,6 +262,14 @@ class LaneInfo {
     return segments_;
   }
   const std::vector<double> &accumulate_s() const { return accumulated_s_; }
+  /// Handles of the predecessor/successor lanes, in proto order. Ids that are
+  /// not in the map resolve to kInvalidElementHandle.
+  const std::vector<ElementHandle> &predecessor_handles() const {
+    return predecessor_handles_;
+  }
+  const std::vector<ElementHandle> &successor_handles() const {
+    return successor_handles_;
+  }
   const std::vector<OverlapInfoConstPtr> &overlaps() const { return overlaps_; }
   const std::vector<OverlapInfoConstPtr> &cross_lanes() const {
     return cross_lanes_;
@@ -222,6 +333,11 @@ class LaneInfo {
       const apollo::common::math::Vec2d &point, double *distance) const;
   bool GetProjection(const apollo::common::math::Vec2d &point,
                      double *accumulate_s, double *lateral) const;
+  /// s and l of point against one segment of the center line, as reported by
+  /// the nearest-lane queries.
+  void GetSegmentProjection(const apollo::common::math::Vec2d &point,
+                            int segment_index, double *accumulate_s,
+                            double *lateral) const;
 
  private:
   friend class HDMapImpl;
@@ -229,9 +345,24 @@ class LaneInfo {
   void Init();
   void PostProcess(const HDMapImpl &map_instance);
   void UpdateOverlaps(const HDMapImpl &map_instance);
+  void UpdateLaneHandles(const HDMapImpl &map_instance);
   double GetWidthFromSample(const std::vector<LaneInfo::SampledWidth> &samples,
                             const double s) const;
+  // Builds the index of the segments, lane_segment_kdtree_ for a lane with
+  // at least FLAGS_hdmap_lane_kdtree_min_segments segments, or else
+  // segment_batch_; called by the public constructor, and by HDMapImpl once
+  // the map is loaded, for all lanes at once.
   void CreateKDTree();
+  // Restores the index of the segments from data, which holds it at its
+  // front, in place of CreateKDTree(). Returns false if data does not hold
+  // this lane's index.
+  bool LoadKDTree(std::string_view *data);
+  // Appends the index of the segments to data, for LoadKDTree().
+  bool SaveKDTree(std::string *data) const;
+  bool UseKDTree() const;
+  void CreateSegmentBoxes();
+  // The index of the segment nearest to point, or -1 if there is none.
+  int GetNearestSegmentIndex(const apollo::common::math::Vec2d &point) const;
   void set_road_id(const Id &road_id) { road_id_ = road_id; }
   void set_section_id(const Id &section_id) { section_id_ = section_id; }
 
@@ -243,6 +374,8 @@ class LaneInfo {
   std::vector<apollo::common::math::LineSegment2d> segments_;
   std::vector<double> accumulated_s_;
   std::vector<std::string> overlap_ids_;
+  std::vector<ElementHandle> predecessor_handles_;
+  std::vector<ElementHandle> successor_handles_;
   std::vector<OverlapInfoConstPtr> overlaps_;
   std::vector<OverlapInfoConstPtr> cross_lanes_;
   std::vector<OverlapInfoConstPtr> signals_;
@@ -261,8 +394,12 @@ class LaneInfo {
   std::vector<SampledWidth> sampled_left_road_width_;
   std::vector<SampledWidth> sampled_right_road_width_;
 
+  // Either the boxes and their tree or the batch is built. Most lanes have
+  // a few segments, which a batch scans faster than a tree searches them,
+  // and in less memory.
   std::vector<LaneSegmentBox> segment_box_list_;
   std::unique_ptr<LaneSegmentKDTree> lane_segment_kdtree_;
+  apollo::common::math::LineSegment2dBatch segment_batch_;
 
   Id road_id_;
   Id section_id_;
@@ -451,22 +588,26 @@ class OverlapInfo {
 
 class RoadInfo {
  public:
+  // Refers to road, which must outlive this RoadInfo, like the other Infos.
   explicit RoadInfo(const Road &road);
   const Id &id() const { return road_.id(); }
   const Road &road() const { return road_; }
-  const std::vector<RoadSection> &sections() const { return sections_; }
+  // The sections of the road proto, in place.
+  const google::protobuf::RepeatedPtrField<RoadSection> &sections() const {
+    return road_.section();
+  }
 
   const Id &junction_id() const { return road_.junction_id(); }
   bool has_junction_id() const { return road_.has_junction_id(); }
 
-  const std::vector<RoadBoundary> &GetBoundaries() const;
+  // A copy of the boundary of every section, in order. Allocates on every
+  // call; sections()[i].boundary() reads a boundary in place instead.
+  std::vector<RoadBoundary> GetBoundaries() const;
 
   apollo::hdmap::Road_Type type() const { return road_.type(); }
 
  private:
-  Road road_;
-  std::vector<RoadSection> sections_;
-  std::vector<RoadBoundary> road_boundaries_;
+  const Road &road_;
 };
 
 class ParkingSpaceInfo {
@@ -518,6 +659,7 @@ using JunctionBoundaryPtr = std::shared_ptr<JunctionBoundary>;
 
 class RSUInfo {
  public:
+  // Refers to rsu, which must outlive this RSUInfo.
   explicit RSUInfo(const RSU& rsu);
 
   const Id& id() const {
@@ -528,7 +670,7 @@ class RSUInfo {
   }
 
  private:
-  RSU _rsu;
+  const RSU &_rsu;
 };
 
 }  // namespace hdmap
@@ -0,0 +1,232 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "google/protobuf/repeated_field.h"
+
+#include "log.h"
+#include "thread_pool.h"
+
+/**
+ * @namespace apollo::hdmap
+ * @brief apollo::hdmap
+ */
+namespace apollo {
+namespace hdmap {
+
+/// Dense index of a map element within its ElementTable.
+using ElementHandle = uint32_t;
+constexpr ElementHandle kInvalidElementHandle =
+    std::numeric_limits<ElementHandle>::max();
+
+/**
+ * @class ElementTable
+ *
+ * @brief Interns the string ids of one kind of map element into dense
+ * handles, and stores the elements contiguously in handle order.
+ *
+ * Storage is allocated once per Build() and never grows afterwards, so element
+ * addresses stay stable for the lifetime of the table. The keys are views of
+ * the id strings in the source protos, which must outlive the table.
+ *
+ * Elements added after Build() are allocated one by one, together with a
+ * copy of their proto. A removed element keeps its handle, which resolves to
+ * nullptr from then on, so iterating the table can yield nullptr. The
+ * element itself lives on until clear(), so pointers to it stay valid.
+ */
+template <class Info>
+class ElementTable {
+ public:
+  using InfoPtr = std::shared_ptr<Info>;
+  using const_iterator = typename std::vector<InfoPtr>::const_iterator;
+
+  /**
+   * @brief rebuild the table with one element per distinct id in protos.
+   * If an id occurs more than once, the last occurrence wins.
+   * @param protos source protos, each with an id() field
+   * @param pool threads to construct the elements on, or nullptr to
+   * construct them on the calling thread; the table is the same either way
+   * @param args further arguments of the element constructor
+   */
+  template <class Proto, class... Args>
+  void Build(const google::protobuf::RepeatedPtrField<Proto>& protos,
+             ThreadPool* pool = nullptr, const Args&... args) {
+    clear();
+    index_.reserve(protos.size());
+    for (int i = 0; i < protos.size(); ++i) {
+      index_[protos.Get(i).id().id()] = static_cast<ElementHandle>(i);
+    }
+
+    std::vector<const Proto*> sources;
+    sources.reserve(index_.size());
+    for (int i = 0; i < protos.size(); ++i) {
+      auto iter = index_.find(protos.Get(i).id().id());
+      if (iter->second != static_cast<ElementHandle>(i)) {
+        continue;
+      }
+      iter->second = static_cast<ElementHandle>(sources.size());
+      sources.push_back(&protos.Get(i));
+    }
+
+    // Each element only reads its own proto, so they are constructed in
+    // any order, each at its handle.
+    storage_ = std::make_shared<Storage>(sources.size());
+    auto construct = [this, &sources, &args...](size_t begin, size_t end) {
+      for (size_t handle = begin; handle < end; ++handle) {
+        storage_->Construct(handle, *sources[handle], args...);
+      }
+    };
+    if (pool != nullptr) {
+      pool->ParallelFor(sources.size(), sources.size(), construct);
+    } else {
+      construct(0, sources.size());
+    }
+    storage_->set_size(sources.size());
+
+    elements_.reserve(sources.size());
+    for (size_t handle = 0; handle < sources.size(); ++handle) {
+      // Each element gets its own control block, so handing out pointers to
+      // different elements never contends on one reference count, while
+      // every pointer still keeps the shared storage alive.
+      auto storage = storage_;
+      elements_.emplace_back(storage_->Get(handle), [storage](Info*) {});
+    }
+  }
+
+  /**
+   * @brief add an element built from a copy of proto, replacing the element
+   * with the same id if there is one. The element gets a new handle.
+   * @param proto source proto, with an id() field
+   * @param args further arguments of the element constructor
+   * @return the handle of the new element
+   */
+  template <class Proto, class... Args>
+  ElementHandle Add(const Proto& proto, const Args&... args) {
+    auto proto_copy = std::make_shared<const Proto>(proto);
+    // The element refers to its proto, which thus lives as long as it does.
+    InfoPtr info(new Info(*proto_copy, args...),
+                 [proto_copy](Info* info) { delete info; });
+    Remove(proto_copy->id().id());
+    const auto handle = static_cast<ElementHandle>(elements_.size());
+    index_[proto_copy->id().id()] = handle;
+    elements_.push_back(std::move(info));
+    return handle;
+  }
+
+  /**
+   * @brief remove an element
+   * @param id element id
+   * @return the handle of the removed element, or kInvalidElementHandle if
+   * id is unknown
+   */
+  ElementHandle Remove(std::string_view id) {
+    auto iter = index_.find(id);
+    if (iter == index_.end()) {
+      return kInvalidElementHandle;
+    }
+    const ElementHandle handle = iter->second;
+    index_.erase(iter);
+    removed_elements_.push_back(std::move(elements_[handle]));
+    return handle;
+  }
+
+  /**
+   * @brief look up the handle of an element
+   * @param id element id
+   * @return the handle, or kInvalidElementHandle if id is unknown
+   */
+  ElementHandle Find(std::string_view id) const {
+    auto iter = index_.find(id);
+    return iter != index_.end() ? iter->second : kInvalidElementHandle;
+  }
+
+  /**
+   * @brief get an element by handle
+   * @param handle element handle, may be kInvalidElementHandle
+   * @return the element, or nullptr if handle is out of range
+   */
+  InfoPtr Get(ElementHandle handle) const {
+    return handle < elements_.size() ? elements_[handle] : nullptr;
+  }
+
+  /// Unchecked access for handles known to be valid.
+  const InfoPtr& operator[](ElementHandle handle) const {
+    return elements_[handle];
+  }
+
+  size_t size() const { return elements_.size(); }
+  bool empty() const { return elements_.empty(); }
+  const_iterator begin() const { return elements_.begin(); }
+  const_iterator end() const { return elements_.end(); }
+
+  void clear() {
+    index_.clear();
+    elements_.clear();
+    removed_elements_.clear();
+    storage_.reset();
+  }
+
+ private:
+  // Uninitialized room for the elements of one Build(), which constructs
+  // each of them in place.
+  class Storage {
+   public:
+    explicit Storage(size_t capacity) : slots_(new Slot[capacity]) {}
+    ~Storage() {
+      for (size_t i = 0; i < size_; ++i) {
+        Get(i)->~Info();
+      }
+    }
+    Storage(const Storage&) = delete;
+    Storage& operator=(const Storage&) = delete;
+
+    template <class Proto, class... Args>
+    void Construct(size_t i, const Proto& proto, const Args&... args) {
+      new (&slots_[i]) Info(proto, args...);
+    }
+    // Marks the first size elements as constructed, for the destructor.
+    void set_size(size_t size) { size_ = size; }
+    Info* Get(size_t i) {
+      return std::launder(reinterpret_cast<Info*>(&slots_[i]));
+    }
+
+   private:
+    struct alignas(Info) Slot {
+      unsigned char bytes[sizeof(Info)];
+    };
+    std::unique_ptr<Slot[]> slots_;
+    size_t size_ = 0;
+  };
+
+  std::unordered_map<std::string_view, ElementHandle> index_;
+  std::shared_ptr<Storage> storage_;
+  std::vector<InfoPtr> elements_;
+  // The elements removed since Build(), kept alive until clear().
+  std::vector<InfoPtr> removed_elements_;
+};
+
+}  // namespace hdmap
+}  // namespace apollo
@@ -15,13 +15,29 @@ limitations under the License.
 
 #include "hdmap_impl.h"
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <limits>
-#include <mutex>
 #include <set>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 #include <unordered_set>
+#include <utility>
 
+#include "config_gflags.h"
 #include "file.h"
+#include "thread_pool.h"
 #include "util.h"
 #include "adapter/opendrive_adapter.h"
 
@@ -30,19 +46,367 @@ namespace hdmap {
 namespace {
 
 using apollo::common::PointENU;
+using apollo::common::math::AABox2d;
 using apollo::common::math::AABoxKDTreeParams;
+using apollo::common::math::AABoxKDTreeQueryHistograms;
+using apollo::common::math::CrossProd;
+using apollo::common::math::LineSegment2d;
+using apollo::common::math::Polygon2d;
 using apollo::common::math::Vec2d;
 
-Id CreateHDMapId(const std::string& string_id) {
-  Id id;
-  id.set_id(string_id);
-  return id;
-}
-
 // default lanes search radius in GetForwardNearestSignalsOnLane
 constexpr double kLanesSearchRange = 10.0;
 // backward search distance in GetForwardNearestSignalsOnLane
 constexpr int kBackwardDistance = 4;
+// max number of neighbouring points sharing one tree query in GetLanesBatch
+constexpr size_t kMaxBatchGroupSize = 32;
+// slack added to the shared query radius in GetLanesBatch, in meters
+constexpr double kBatchSearchMargin = 1e-6;
+
+uint32_t SpreadBits(uint32_t x) {
+  x &= 0x0000FFFF;
+  x = (x | (x << 8)) & 0x00FF00FF;
+  x = (x | (x << 4)) & 0x0F0F0F0F;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+
+// Returns the indices of points ordered along a Morton (Z-order) curve, so
+// that consecutive queries walk mostly the same KD-tree nodes.
+std::vector<size_t> SpatialOrder(const std::vector<Vec2d>& points) {
+  double min_x = std::numeric_limits<double>::infinity();
+  double min_y = std::numeric_limits<double>::infinity();
+  double max_x = -std::numeric_limits<double>::infinity();
+  double max_y = -std::numeric_limits<double>::infinity();
+  for (const auto& point : points) {
+    min_x = std::fmin(min_x, point.x());
+    min_y = std::fmin(min_y, point.y());
+    max_x = std::fmax(max_x, point.x());
+    max_y = std::fmax(max_y, point.y());
+  }
+  const double cell_count = 65535.0;
+  const double scale_x = max_x > min_x ? cell_count / (max_x - min_x) : 0.0;
+  const double scale_y = max_y > min_y ? cell_count / (max_y - min_y) : 0.0;
+  std::vector<std::pair<uint32_t, size_t>> codes;
+  codes.reserve(points.size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    const auto cell_x =
+        static_cast<uint32_t>((points[i].x() - min_x) * scale_x);
+    const auto cell_y =
+        static_cast<uint32_t>((points[i].y() - min_y) * scale_y);
+    codes.emplace_back(SpreadBits(cell_x) | (SpreadBits(cell_y) << 1), i);
+  }
+  std::sort(codes.begin(), codes.end());
+  std::vector<size_t> order;
+  order.reserve(codes.size());
+  for (const auto& code : codes) {
+    order.push_back(code.second);
+  }
+  return order;
+}
+
+template <class Table, class InfoPtr>
+void ResolveHandles(const Table& table,
+                    const std::vector<ElementHandle>& handles,
+                    std::vector<InfoPtr>* infos) {
+  infos->reserve(infos->size() + handles.size());
+  for (const auto handle : handles) {
+    infos->push_back(table[handle]);
+  }
+}
+
+// Shared by all maps; the calling thread always takes part in a batch, so
+// the pool only needs one worker fewer than the hardware provides.
+ThreadPool* BatchThreadPool() {
+  static ThreadPool* pool = new ThreadPool(
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency())) - 1);
+  return pool;
+}
+
+// The lane segment and map element trees are rebuilt once more than this
+// fraction of their lane segments has been patched in or out in place, which
+// bounds how much the patches can slow queries down.
+constexpr double kMaxPatchedLaneSegmentFraction = 0.125;
+
+// The blocks of the arena that holds a loaded map grow from the first to the
+// last size. Large blocks keep the number of allocations for a map of
+// millions of messages in the hundreds, and are returned to the system as
+// soon as the map is freed.
+constexpr size_t kMapArenaStartBlockSize = 64 << 10;
+constexpr size_t kMapArenaMaxBlockSize = 4 << 20;
+
+// An index file is the magic, the version and the hash of the map file,
+// followed by the segment index of every lane in handle order and then by
+// the trees HDMapImpl::VisitKDTrees() lists. The version must change
+// whenever that layout or the parameters of any tree do.
+constexpr char kIndexFileSuffix[] = ".index";
+constexpr char kIndexFileMagic[8] = {'H', 'D', 'M', 'A', 'P', 'I', 'D', 'X'};
+constexpr uint32_t kIndexFileVersion = 2;
+
+// Takes a value of type T off the front of data.
+template <class T>
+bool ConsumeValue(std::string_view* data, T* value) {
+  if (data->size() < sizeof(T)) {
+    return false;
+  }
+  std::memcpy(value, data->data(), sizeof(T));
+  data->remove_prefix(sizeof(T));
+  return true;
+}
+
+template <class T>
+void AppendValue(const T& value, std::string* data) {
+  data->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Written under a unique temporary name first, so that a process loading
+// the file at the same time never reads a partial one, and two processes
+// saving it at the same time never write into the same file.
+bool WriteFileAtomically(const std::string& filename,
+                         const std::string& data) {
+  std::string temp_filename = filename + ".XXXXXX";
+  const int fd = mkstemp(&temp_filename[0]);
+  if (fd < 0) {
+    return false;
+  }
+  // mkstemp creates the file readable by its owner only.
+  bool success = fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0;
+  const char* next = data.data();
+  size_t remaining = data.size();
+  while (success && remaining > 0) {
+    const ssize_t written = write(fd, next, remaining);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    success = written > 0;
+    if (success) {
+      next += written;
+      remaining -= static_cast<size_t>(written);
+    }
+  }
+  // close() can still report a failed write.
+  success = close(fd) == 0 && success &&
+            std::rename(temp_filename.c_str(), filename.c_str()) == 0;
+  if (!success) {
+    std::remove(temp_filename.c_str());
+  }
+  return success;
+}
+
+// FNV-1a over 8-byte words, rotated so that every bit reaches every other.
+// Each step is a bijection of the hash, so changing any one word of the
+// input always changes the result.
+uint64_t HashBytes(std::string_view bytes) {
+  constexpr uint64_t kPrime = 0x100000001b3ULL;
+  uint64_t hash = 0xcbf29ce484222325ULL ^ bytes.size();
+  while (bytes.size() >= sizeof(uint64_t)) {
+    uint64_t word = 0;
+    std::memcpy(&word, bytes.data(), sizeof(word));
+    bytes.remove_prefix(sizeof(word));
+    hash = (hash ^ word) * kPrime;
+    hash = (hash << 29) | (hash >> 35);
+  }
+  for (const char byte : bytes) {
+    hash = (hash ^ static_cast<unsigned char>(byte)) * kPrime;
+  }
+  return hash;
+}
+
+// The number of threads that build the elements and spatial indices of a
+// loaded map.
+int LoadThreads() {
+  if (FLAGS_hdmap_load_threads > 0) {
+    return FLAGS_hdmap_load_threads;
+  }
+  return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+// The params of a spatial index, in the storage mode FLAGS_hdmap_compact_index
+// selects.
+AABoxKDTreeParams IndexParams(AABoxKDTreeParams params) {
+  params.compact = FLAGS_hdmap_compact_index;
+  return params;
+}
+
+// Lets a KD-tree build its large subtrees concurrently on the pool.
+void BuildOnPool(ThreadPool* pool, AABoxKDTreeParams* params) {
+  if (pool == nullptr || pool->num_workers() == 0) {
+    return;
+  }
+  params->parallel_for = [pool](int num_tasks,
+                                const std::function<void(int)>& task) {
+    pool->ParallelFor(num_tasks, num_tasks, [&task](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        task(static_cast<int>(i));
+      }
+    });
+  };
+}
+
+// Scratch state for the queries that do not take a caller's QueryContext.
+QueryContext& ThreadQueryContext() {
+  thread_local QueryContext context;
+  return context;
+}
+
+template <class Info>
+void AppendElement(const std::shared_ptr<Info>& element,
+                   std::vector<std::shared_ptr<const Info>>* results) {
+  results->push_back(element);
+}
+
+template <class Info>
+void AppendElement(const std::shared_ptr<Info>& element,
+                   std::vector<const Info*>* results) {
+  results->push_back(element.get());
+}
+
+// Per-type handle stamps that deduplicate the hits of one combined-index
+// query, since an element may own many boxes.
+using ElementContexts = std::array<QueryContext, kNumMapElementTypes>;
+
+ElementContexts& ThreadElementContexts() {
+  thread_local ElementContexts contexts;
+  return contexts;
+}
+
+QueryContext& ContextOf(ElementContexts* contexts,
+                        const MapElementBox& object) {
+  return (*contexts)[static_cast<int>(object.type())];
+}
+
+double PointToSegmentDistanceSquare(const Vec2d& point, const Vec2d& start,
+                                    const Vec2d& end) {
+  const Vec2d direction = end - start;
+  const Vec2d offset = point - start;
+  const double length_sqr = direction.LengthSquare();
+  const double proj = direction.InnerProd(offset);
+  if (proj <= 0.0) {
+    return offset.LengthSquare();
+  }
+  if (proj >= length_sqr) {
+    return point.DistanceSquareTo(end);
+  }
+  return offset.LengthSquare() - proj * proj / length_sqr;
+}
+
+// Whether a segment comes within distance of the segment from start to end:
+// either an endpoint of one is within distance of the other, or they properly
+// cross.
+bool SegmentWithinDistance(const LineSegment2d& segment, const Vec2d& start,
+                           const Vec2d& end, const double distance) {
+  const double distance_sqr = distance * distance;
+  if (segment.DistanceSquareTo(start) <= distance_sqr ||
+      segment.DistanceSquareTo(end) <= distance_sqr ||
+      PointToSegmentDistanceSquare(segment.start(), start, end) <=
+          distance_sqr ||
+      PointToSegmentDistanceSquare(segment.end(), start, end) <=
+          distance_sqr) {
+    return true;
+  }
+  return CrossProd(start, end, segment.start()) *
+                 CrossProd(start, end, segment.end()) <
+             0.0 &&
+         CrossProd(segment.start(), segment.end(), start) *
+                 CrossProd(segment.start(), segment.end(), end) <
+             0.0;
+}
+
+// Region of a polygon query over the combined index.
+class PolygonRegion {
+ public:
+  explicit PolygonRegion(const Polygon2d& polygon)
+      : polygon_(polygon), aabox_(polygon.AABoundingBox()) {}
+
+  bool MayOverlap(const AABox2d& box) const { return aabox_.HasOverlap(box); }
+
+  bool Overlaps(const MapElementBox* object) const {
+    return object->segment() != nullptr
+               ? polygon_.HasOverlap(*object->segment())
+               : polygon_.HasOverlap(*object->polygon());
+  }
+
+ private:
+  const Polygon2d& polygon_;
+  AABox2d aabox_;
+};
+
+// Region of a path query: every point within distance of a polyline. The
+// padded boxes of consecutive path segments are merged into groups, so that
+// long paths are rejected group by group rather than segment by segment.
+class PathRegion {
+ public:
+  PathRegion(const std::vector<Vec2d>& path, const double distance)
+      : distance_(distance), points_(path) {
+    if (points_.size() == 1) {
+      points_.push_back(points_.front());
+    }
+    boxes_.reserve(points_.size() - 1);
+    for (size_t i = 1; i < points_.size(); ++i) {
+      const Vec2d& start = points_[i - 1];
+      const Vec2d& end = points_[i];
+      const AABox2d box(
+          {std::min(start.x(), end.x()) - distance,
+           std::min(start.y(), end.y()) - distance},
+          {std::max(start.x(), end.x()) + distance,
+           std::max(start.y(), end.y()) + distance});
+      if (boxes_.size() % kGroupSize == 0) {
+        group_boxes_.push_back(box);
+      } else {
+        group_boxes_.back().MergeFrom(box);
+      }
+      boxes_.push_back(box);
+    }
+  }
+
+  bool MayOverlap(const AABox2d& box) const {
+    for (size_t group = 0; group < group_boxes_.size(); ++group) {
+      if (!group_boxes_[group].HasOverlap(box)) {
+        continue;
+      }
+      const size_t end = std::min(boxes_.size(), (group + 1) * kGroupSize);
+      for (size_t i = group * kGroupSize; i < end; ++i) {
+        if (boxes_[i].HasOverlap(box)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  bool Overlaps(const MapElementBox* object) const {
+    const AABox2d& box = object->aabox();
+    for (size_t group = 0; group < group_boxes_.size(); ++group) {
+      if (!group_boxes_[group].HasOverlap(box)) {
+        continue;
+      }
+      const size_t end = std::min(boxes_.size(), (group + 1) * kGroupSize);
+      for (size_t i = group * kGroupSize; i < end; ++i) {
+        if (!boxes_[i].HasOverlap(box)) {
+          continue;
+        }
+        if (object->segment() != nullptr
+                ? SegmentWithinDistance(*object->segment(), points_[i],
+                                        points_[i + 1], distance_)
+                : object->polygon()->DistanceTo(LineSegment2d(
+                      points_[i], points_[i + 1])) <= distance_) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+ private:
+  static constexpr size_t kGroupSize = 16;
+
+  double distance_ = 0.0;
+  // Segment i runs from points_[i] to points_[i + 1].
+  std::vector<Vec2d> points_;
+  std::vector<AABox2d> boxes_;
+  std::vector<AABox2d> group_boxes_;
+};
 
 }  // namespace
 
@@ -56,173 +420,433 @@ bool EndsWith(std::string const &fullString, std::string const &ending) {
 
 int HDMapImpl::LoadMapFromFile(const std::string& map_filename) {
   Clear();
+  CreateArenaMap();
   // TODO(All) seems map_ can be changed to a local variable of this
   // function, but test will fail if I do so. if so.
   if (EndsWith(map_filename, ".xml")) {
-    if (!adapter::OpendriveAdapter::LoadData(map_filename, &map_)) {
+    if (!adapter::OpendriveAdapter::LoadData(map_filename, map_)) {
       return -1;
     }
-  } else if (!cyber::common::GetProtoFromFile(map_filename, &map_)) {
-    return -1;
+    return LoadMapFromProto(*map_);
   }
+  if (!FLAGS_hdmap_use_index_file) {
+    if (!cyber::common::GetProtoFromFile(map_filename, map_)) {
+      return -1;
+    }
+    return LoadMapFromProto(*map_);
+  }
+  return LoadProtoMapWithIndexFile(map_filename);
+}
 
-  return LoadMapFromProto(map_);
+int HDMapImpl::LoadSnapshot(const std::string& map_filename) {
+  Clear();
+  CreateArenaMap();
+  if (EndsWith(map_filename, ".xml")) {
+    AERROR << "OpenDRIVE map " << map_filename << " has no snapshot.";
+    return -1;
+  }
+  return LoadProtoMapWithIndexFile(map_filename);
 }
 
-int HDMapImpl::LoadMapFromProto(const Map& map_proto) {
-  if (&map_proto != &map_) {  // avoid an unnecessary copy
-    Clear();
-    map_ = map_proto;
+int HDMapImpl::LoadProtoMapWithIndexFile(const std::string& map_filename) {
+  // The index is keyed by the content hashed from the read that parses it.
+  uint64_t map_hash = 0;
+  if (!cyber::common::GetProtoFromFile(
+          map_filename, map_, [&map_hash](std::string_view content) {
+            map_hash = HashBytes(content);
+          })) {
+    return -1;
   }
-  for (const auto& lane : map_.lane()) {
-    lane_table_[lane.id().id()].reset(new LaneInfo(lane));
+  const std::string index_filename = map_filename + kIndexFileSuffix;
+  BuildTables();
+  if (LoadKDTrees(index_filename, map_hash)) {
+    return 0;
   }
-  for (const auto& junction : map_.junction()) {
-    junction_table_[junction.id().id()].reset(new JunctionInfo(junction));
+  BuildKDTrees();
+  if (!SaveKDTrees(index_filename, map_hash)) {
+    AWARN << "Failed to save the spatial index of the map to "
+          << index_filename;
   }
-  for (const auto& signal : map_.signal()) {
-    signal_table_[signal.id().id()].reset(new SignalInfo(signal));
+  return 0;
+}
+
+int HDMapImpl::LoadMapFromProto(const Map& map_proto) {
+  if (&map_proto != map_) {  // avoid an unnecessary copy
+    Clear();
+    CreateArenaMap();
+    *map_ = map_proto;
   }
-  for (const auto& crosswalk : map_.crosswalk()) {
-    crosswalk_table_[crosswalk.id().id()].reset(new CrosswalkInfo(crosswalk));
+  BuildTables();
+  BuildKDTrees();
+  return 0;
+}
+
+int HDMapImpl::LoadMapFromProto(Map&& map_proto) {
+  if (&map_proto != map_) {
+    Clear();
+    if (map_proto.GetArena() == nullptr) {
+      owned_map_.reset(new Map());
+      owned_map_->Swap(&map_proto);
+      map_ = owned_map_.get();
+    } else {
+      // A map on the caller's arena can only be copied out.
+      CreateArenaMap();
+      map_->Swap(&map_proto);
+    }
   }
-  for (const auto& stop_sign : map_.stop_sign()) {
-    stop_sign_table_[stop_sign.id().id()].reset(new StopSignInfo(stop_sign));
+  BuildTables();
+  BuildKDTrees();
+  return 0;
+}
+
+void HDMapImpl::BuildTables() {
+  // The tables are independent, so they are built side by side, each with
+  // its elements constructed across the threads as well; the callers that
+  // wait on their elements run the elements of the other tables meanwhile.
+  // Every table comes out the same as with a single thread.
+  ThreadPool pool(LoadThreads() - 1);
+  const std::array<std::function<void()>, 13> table_builders = {
+      [this, &pool]() {
+        lane_table_.Build(map_->lane(), &pool,
+                          LaneInfo::DeferSegmentIndex());
+      },
+      [this, &pool]() { junction_table_.Build(map_->junction(), &pool); },
+      [this, &pool]() { signal_table_.Build(map_->signal(), &pool); },
+      [this, &pool]() { crosswalk_table_.Build(map_->crosswalk(), &pool); },
+      [this, &pool]() { stop_sign_table_.Build(map_->stop_sign(), &pool); },
+      [this, &pool]() { yield_sign_table_.Build(map_->yield(), &pool); },
+      [this, &pool]() { clear_area_table_.Build(map_->clear_area(), &pool); },
+      [this, &pool]() { speed_bump_table_.Build(map_->speed_bump(), &pool); },
+      [this, &pool]() {
+        parking_space_table_.Build(map_->parking_space(), &pool);
+      },
+      [this, &pool]() {
+        pnc_junction_table_.Build(map_->pnc_junction(), &pool);
+      },
+      [this, &pool]() { rsu_table_.Build(map_->rsu(), &pool); },
+      [this, &pool]() { overlap_table_.Build(map_->overlap(), &pool); },
+      [this, &pool]() { road_table_.Build(map_->road(), &pool); }};
+  pool.ParallelFor(table_builders.size(), table_builders.size(),
+                   [&table_builders](size_t begin, size_t end) {
+                     for (size_t i = begin; i < end; ++i) {
+                       table_builders[i]();
+                     }
+                   });
+
+  for (const auto& road_ptr : road_table_) {
+    const auto& road_id = road_ptr->id();
+    for (const auto& road_section : road_ptr->sections()) {
+      const auto& section_id = road_section.id();
+      for (const auto& lane_id : road_section.lane_id()) {
+        const auto lane_ptr = lane_table_.Get(lane_table_.Find(lane_id.id()));
+        if (lane_ptr != nullptr) {
+          lane_ptr->set_road_id(road_id);
+          lane_ptr->set_section_id(section_id);
+        } else {
+          AFATAL << "Unknown lane id: " << lane_id.id();
+        }
+      }
+    }
   }
-  for (const auto& yield_sign : map_.yield()) {
-    yield_sign_table_[yield_sign.id().id()].reset(
-        new YieldSignInfo(yield_sign));
+  // PostProcess only changes the element it is called on.
+  auto post_process = [this, &pool](const auto& table) {
+    pool.ParallelFor(table.size(), table.size(),
+                     [this, &table](size_t begin, size_t end) {
+                       for (size_t handle = begin; handle < end; ++handle) {
+                         table[handle]->PostProcess(*this);
+                       }
+                     });
+  };
+  post_process(lane_table_);
+  post_process(junction_table_);
+  post_process(stop_sign_table_);
+}
+
+void HDMapImpl::BuildKDTrees() {
+  // The spatial indices only read the tables, so they are built concurrently:
+  // first the segment tree of every lane, then the small layer trees side by
+  // side, and last the two large trees with their subtrees spread over the
+  // threads. Every tree comes out the same as with a single thread.
+  ThreadPool pool(LoadThreads() - 1);
+  pool.ParallelFor(lane_table_.size(), lane_table_.size(),
+                   [this](size_t begin, size_t end) {
+                     for (size_t handle = begin; handle < end; ++handle) {
+                       lane_table_[handle]->CreateKDTree();
+                     }
+                   });
+  const std::array<void (HDMapImpl::*)(), 9> layer_builders = {
+      &HDMapImpl::BuildJunctionPolygonKDTree,
+      &HDMapImpl::BuildSignalSegmentKDTree,
+      &HDMapImpl::BuildCrosswalkPolygonKDTree,
+      &HDMapImpl::BuildStopSignSegmentKDTree,
+      &HDMapImpl::BuildYieldSignSegmentKDTree,
+      &HDMapImpl::BuildClearAreaPolygonKDTree,
+      &HDMapImpl::BuildSpeedBumpSegmentKDTree,
+      &HDMapImpl::BuildParkingSpacePolygonKDTree,
+      &HDMapImpl::BuildPNCJunctionPolygonKDTree};
+  pool.ParallelFor(layer_builders.size(), layer_builders.size(),
+                   [this, &layer_builders](size_t begin, size_t end) {
+                     for (size_t i = begin; i < end; ++i) {
+                       (this->*layer_builders[i])();
+                     }
+                   });
+  BuildLaneSegmentKDTree(&pool);
+  BuildMapElementKDTree(&pool);
+}
+
+bool HDMapImpl::LoadKDTrees(const std::string& index_filename,
+                            const uint64_t map_hash) {
+  std::ifstream fin(index_filename, std::ios::binary | std::ios::ate);
+  if (!fin) {
+    return false;
   }
-  for (const auto& clear_area : map_.clear_area()) {
-    clear_area_table_[clear_area.id().id()].reset(
-        new ClearAreaInfo(clear_area));
+  std::string content(static_cast<size_t>(fin.tellg()), '\0');
+  fin.seekg(0);
+  if (!fin.read(&content[0], static_cast<std::streamsize>(content.size()))) {
+    return false;
   }
-  for (const auto& speed_bump : map_.speed_bump()) {
-    speed_bump_table_[speed_bump.id().id()].reset(
-        new SpeedBumpInfo(speed_bump));
+  std::string_view data = content;
+  char magic[sizeof(kIndexFileMagic)];
+  uint32_t version = 0;
+  uint64_t hash = 0;
+  if (!ConsumeValue(&data, &magic) || !ConsumeValue(&data, &version) ||
+      !ConsumeValue(&data, &hash)) {
+    return false;
   }
-  for (const auto& parking_space : map_.parking_space()) {
-    parking_space_table_[parking_space.id().id()].reset(
-        new ParkingSpaceInfo(parking_space));
+  if (std::memcmp(magic, kIndexFileMagic, sizeof(magic)) != 0 ||
+      version != kIndexFileVersion || hash != map_hash) {
+    AINFO << "The spatial index " << index_filename
+          << " was saved for another map, rebuilding it.";
+    return false;
   }
-  for (const auto& pnc_junction : map_.pnc_junction()) {
-    pnc_junction_table_[pnc_junction.id().id()].reset(
-        new PNCJunctionInfo(pnc_junction));
+  if (ReadKDTrees(&data)) {
+    return true;
+  }
+  AERROR << "The spatial index " << index_filename
+         << " is malformed, rebuilding it.";
+  return false;
+}
+
+bool HDMapImpl::ReadKDTrees(std::string_view* data) {
+  bool loaded = true;
+  for (const auto& lane_ptr : lane_table_) {
+    loaded = loaded && lane_ptr->LoadKDTree(data);
+  }
+  CreateSegmentBoxes(lane_table_, &lane_segment_boxes_);
+  CreatePolygonBoxes(junction_table_, &junction_polygon_boxes_);
+  CreatePolygonBoxes(crosswalk_table_, &crosswalk_polygon_boxes_);
+  CreateSegmentBoxes(signal_table_, &signal_segment_boxes_);
+  CreateSegmentBoxes(stop_sign_table_, &stop_sign_segment_boxes_);
+  CreateSegmentBoxes(yield_sign_table_, &yield_sign_segment_boxes_);
+  CreatePolygonBoxes(clear_area_table_, &clear_area_polygon_boxes_);
+  CreateSegmentBoxes(speed_bump_table_, &speed_bump_segment_boxes_);
+  CreatePolygonBoxes(parking_space_table_, &parking_space_polygon_boxes_);
+  CreatePolygonBoxes(pnc_junction_table_, &pnc_junction_polygon_boxes_);
+  CreateMapElementBoxes();
+  VisitKDTrees([data, &loaded](const auto& boxes, auto& kdtree) {
+    using KDTree = typename std::decay_t<decltype(kdtree)>::element_type;
+    kdtree = loaded ? KDTree::Deserialize(
+                          boxes, IndexParams(AABoxKDTreeParams()), data)
+                    : nullptr;
+    loaded = kdtree != nullptr;
+  });
+  return loaded && data->empty();
+}
+
+bool HDMapImpl::SaveKDTrees(const std::string& index_filename,
+                            const uint64_t map_hash) {
+  std::string data(kIndexFileMagic, sizeof(kIndexFileMagic));
+  AppendValue(kIndexFileVersion, &data);
+  AppendValue(map_hash, &data);
+  return WriteKDTrees(&data) && WriteFileAtomically(index_filename, data);
+}
+
+bool HDMapImpl::WriteKDTrees(std::string* data) {
+  bool saved = true;
+  for (const auto& lane_ptr : lane_table_) {
+    saved = saved && lane_ptr->SaveKDTree(data);
+  }
+  VisitKDTrees([data, &saved](const auto& boxes, const auto& kdtree) {
+    saved = saved && kdtree->Serialize(boxes, data);
+  });
+  return saved;
+}
+
+template <class Visitor>
+void HDMapImpl::VisitKDTrees(const Visitor& visit) {
+  visit(lane_segment_boxes_, lane_segment_kdtree_);
+  visit(junction_polygon_boxes_, junction_polygon_kdtree_);
+  visit(crosswalk_polygon_boxes_, crosswalk_polygon_kdtree_);
+  visit(signal_segment_boxes_, signal_segment_kdtree_);
+  visit(stop_sign_segment_boxes_, stop_sign_segment_kdtree_);
+  visit(yield_sign_segment_boxes_, yield_sign_segment_kdtree_);
+  visit(clear_area_polygon_boxes_, clear_area_polygon_kdtree_);
+  visit(speed_bump_segment_boxes_, speed_bump_segment_kdtree_);
+  visit(parking_space_polygon_boxes_, parking_space_polygon_kdtree_);
+  visit(pnc_junction_polygon_boxes_, pnc_junction_polygon_kdtree_);
+  visit(map_element_boxes_, map_element_kdtree_);
+}
+
+template <class Visitor>
+void HDMapImpl::VisitNamedKDTrees(const Visitor& visit) const {
+  visit("lane", lane_segment_kdtree_);
+  visit("junction", junction_polygon_kdtree_);
+  visit("crosswalk", crosswalk_polygon_kdtree_);
+  visit("signal", signal_segment_kdtree_);
+  visit("stop_sign", stop_sign_segment_kdtree_);
+  visit("yield_sign", yield_sign_segment_kdtree_);
+  visit("clear_area", clear_area_polygon_kdtree_);
+  visit("speed_bump", speed_bump_segment_kdtree_);
+  visit("parking_space", parking_space_polygon_kdtree_);
+  visit("pnc_junction", pnc_junction_polygon_kdtree_);
+  visit("map_element", map_element_kdtree_);
+}
+
+int HDMapImpl::GetKDTreeQueryHistograms(
+    std::map<std::string, AABoxKDTreeQueryHistograms>* histograms) const {
+  CHECK_NOTNULL(histograms);
+  histograms->clear();
+#ifdef APOLLO_HDMAP_KDTREE_STATS
+  VisitNamedKDTrees([histograms](const char* name, const auto& kdtree) {
+    if (kdtree != nullptr) {
+      (*histograms)[name] = kdtree->GetQueryHistograms();
+    }
+  });
+  return 0;
+#else
+  AWARN << "KD-tree query statistics are not built in; "
+           "build with APOLLO_HDMAP_KDTREE_STATS.";
+  return -1;
+#endif
+}
+
+void HDMapImpl::ClearKDTreeQueryHistograms() {
+  VisitNamedKDTrees([](const char*, const auto& kdtree) {
+    if (kdtree != nullptr) {
+      kdtree->ClearQueryHistograms();
+    }
+  });
+}
+
+int HDMapImpl::AddLane(const Lane& lane) {
+  if (lane_segment_kdtree_ == nullptr || map_element_kdtree_ == nullptr) {
+    AERROR << "No map is loaded.";
+    return -1;
   }
-  for (const auto& rsu : map_.rsu()) {
-    rsu_table_[rsu.id().id()].reset(new RSUInfo(rsu));
+  int num_points = 0;
+  for (const auto& segment : lane.central_curve().segment()) {
+    num_points += segment.line_segment().point_size();
   }
-  for (const auto& overlap : map_.overlap()) {
-    overlap_table_[overlap.id().id()].reset(new OverlapInfo(overlap));
+  if (lane.id().id().empty() || num_points < 2) {
+    AERROR << "Lane [" << lane.id().id()
+           << "] has no id or fewer than two central curve points.";
+    return -1;
   }
 
-  for (const auto& road : map_.road()) {
-    road_table_[road.id().id()].reset(new RoadInfo(road));
-  }
-  for (const auto& rsu : map_.rsu()) {
-    rsu_table_[rsu.id().id()].reset(new RSUInfo(rsu));
-  }
-  for (const auto& road_ptr_pair : road_table_) {
-    const auto& road_id = road_ptr_pair.second->id();
-    for (const auto& road_section : road_ptr_pair.second->sections()) {
-      const auto& section_id = road_section.id();
+  const ElementHandle removed_handle = lane_table_.Find(lane.id().id());
+  const ElementHandle handle =
+      lane_table_.Add(lane, LaneInfo::DeferSegmentIndex());
+  const auto& lane_ptr = lane_table_[handle];
+  lane_ptr->CreateKDTree();
+  for (const auto& road_ptr : road_table_) {
+    for (const auto& road_section : road_ptr->sections()) {
       for (const auto& lane_id : road_section.lane_id()) {
-        auto iter = lane_table_.find(lane_id.id());
-        if (iter != lane_table_.end()) {
-          iter->second->set_road_id(road_id);
-          iter->second->set_section_id(section_id);
-        } else {
-          AFATAL << "Unknown lane id: " << lane_id.id();
+        if (lane_id.id() == lane.id().id()) {
+          lane_ptr->set_road_id(road_ptr->id());
+          lane_ptr->set_section_id(road_section.id());
         }
       }
     }
   }
-  for (const auto& lane_ptr_pair : lane_table_) {
-    lane_ptr_pair.second->PostProcess(*this);
-  }
-  for (const auto& junction_ptr_pair : junction_table_) {
-    junction_ptr_pair.second->PostProcess(*this);
-  }
-  for (const auto& stop_sign_ptr_pair : stop_sign_table_) {
-    stop_sign_ptr_pair.second->PostProcess(*this);
-  }
-  BuildLaneSegmentKDTree();
-  BuildJunctionPolygonKDTree();
-  BuildSignalSegmentKDTree();
-  BuildCrosswalkPolygonKDTree();
-  BuildStopSignSegmentKDTree();
-  BuildYieldSignSegmentKDTree();
-  BuildClearAreaPolygonKDTree();
-  BuildSpeedBumpSegmentKDTree();
-  BuildParkingSpacePolygonKDTree();
-  BuildPNCJunctionPolygonKDTree();
+  lane_ptr->UpdateOverlaps(*this);
+  PatchLaneKDTrees(removed_handle, handle);
+  RefreshLaneHandles();
   return 0;
 }
 
+int HDMapImpl::RemoveLane(const Id& id) {
+  if (lane_segment_kdtree_ == nullptr || map_element_kdtree_ == nullptr) {
+    AERROR << "No map is loaded.";
+    return -1;
+  }
+  const ElementHandle handle = lane_table_.Remove(id.id());
+  if (handle == kInvalidElementHandle) {
+    AERROR << "Unknown lane id: " << id.id();
+    return -1;
+  }
+  PatchLaneKDTrees(handle, kInvalidElementHandle);
+  RefreshLaneHandles();
+  return 0;
+}
+
+void HDMapImpl::RefreshLaneHandles() {
+  for (const auto& lane_ptr : lane_table_) {
+    if (lane_ptr != nullptr) {
+      lane_ptr->UpdateLaneHandles(*this);
+    }
+  }
+}
+
 LaneInfoConstPtr HDMapImpl::GetLaneById(const Id& id) const {
-  LaneTable::const_iterator it = lane_table_.find(id.id());
-  return it != lane_table_.end() ? it->second : nullptr;
+  return lane_table_.Get(lane_table_.Find(id.id()));
 }
 
 JunctionInfoConstPtr HDMapImpl::GetJunctionById(const Id& id) const {
-  JunctionTable::const_iterator it = junction_table_.find(id.id());
-  return it != junction_table_.end() ? it->second : nullptr;
+  return junction_table_.Get(junction_table_.Find(id.id()));
 }
 
 SignalInfoConstPtr HDMapImpl::GetSignalById(const Id& id) const {
-  SignalTable::const_iterator it = signal_table_.find(id.id());
-  return it != signal_table_.end() ? it->second : nullptr;
+  return signal_table_.Get(signal_table_.Find(id.id()));
 }
 
 CrosswalkInfoConstPtr HDMapImpl::GetCrosswalkById(const Id& id) const {
-  CrosswalkTable::const_iterator it = crosswalk_table_.find(id.id());
-  return it != crosswalk_table_.end() ? it->second : nullptr;
+  return crosswalk_table_.Get(crosswalk_table_.Find(id.id()));
 }
 
 StopSignInfoConstPtr HDMapImpl::GetStopSignById(const Id& id) const {
-  StopSignTable::const_iterator it = stop_sign_table_.find(id.id());
-  return it != stop_sign_table_.end() ? it->second : nullptr;
+  return stop_sign_table_.Get(stop_sign_table_.Find(id.id()));
 }
 
 YieldSignInfoConstPtr HDMapImpl::GetYieldSignById(const Id& id) const {
-  YieldSignTable::const_iterator it = yield_sign_table_.find(id.id());
-  return it != yield_sign_table_.end() ? it->second : nullptr;
+  return yield_sign_table_.Get(yield_sign_table_.Find(id.id()));
 }
 
 ClearAreaInfoConstPtr HDMapImpl::GetClearAreaById(const Id& id) const {
-  ClearAreaTable::const_iterator it = clear_area_table_.find(id.id());
-  return it != clear_area_table_.end() ? it->second : nullptr;
+  return clear_area_table_.Get(clear_area_table_.Find(id.id()));
 }
 
 SpeedBumpInfoConstPtr HDMapImpl::GetSpeedBumpById(const Id& id) const {
-  SpeedBumpTable::const_iterator it = speed_bump_table_.find(id.id());
-  return it != speed_bump_table_.end() ? it->second : nullptr;
+  return speed_bump_table_.Get(speed_bump_table_.Find(id.id()));
 }
 
 OverlapInfoConstPtr HDMapImpl::GetOverlapById(const Id& id) const {
-  OverlapTable::const_iterator it = overlap_table_.find(id.id());
-  return it != overlap_table_.end() ? it->second : nullptr;
+  return overlap_table_.Get(overlap_table_.Find(id.id()));
 }
 
 RoadInfoConstPtr HDMapImpl::GetRoadById(const Id& id) const {
-  RoadTable::const_iterator it = road_table_.find(id.id());
-  return it != road_table_.end() ? it->second : nullptr;
+  return road_table_.Get(road_table_.Find(id.id()));
 }
 
 ParkingSpaceInfoConstPtr HDMapImpl::GetParkingSpaceById(const Id& id) const {
-  ParkingSpaceTable::const_iterator it = parking_space_table_.find(id.id());
-  return it != parking_space_table_.end() ? it->second : nullptr;
+  return parking_space_table_.Get(parking_space_table_.Find(id.id()));
 }
 
 PNCJunctionInfoConstPtr HDMapImpl::GetPNCJunctionById(const Id& id) const {
-  PNCJunctionTable::const_iterator it = pnc_junction_table_.find(id.id());
-  return it != pnc_junction_table_.end() ? it->second : nullptr;
+  return pnc_junction_table_.Get(pnc_junction_table_.Find(id.id()));
 }
 
 RSUInfoConstPtr HDMapImpl::GetRSUById(const Id& id) const {
-  RSUTable::const_iterator it = rsu_table_.find(id.id());
-  return it != rsu_table_.end() ? it->second : nullptr;
+  return rsu_table_.Get(rsu_table_.Find(id.id()));
+}
+
+ElementHandle HDMapImpl::GetLaneHandle(const Id& id) const {
+  return lane_table_.Find(id.id());
 }
+
+LaneInfoConstPtr HDMapImpl::GetLaneByHandle(ElementHandle handle) const {
+  return lane_table_.Get(handle);
+}
+
 int HDMapImpl::GetLanes(const PointENU& point, double distance,
                         std::vector<LaneInfoConstPtr>* lanes) const {
   return GetLanes({point.x(), point.y()}, distance, lanes);
@@ -234,16 +858,8 @@ int HDMapImpl::GetLanes(const Vec2d& point, double distance,
     return -1;
   }
   lanes->clear();
-  std::vector<std::string> ids;
-  const int status =
-      SearchObjects(point, distance, *lane_segment_kdtree_, &ids);
-  if (status < 0) {
-    return status;
-  }
-  for (const auto& id : ids) {
-    lanes->emplace_back(GetLaneById(CreateHDMapId(id)));
-  }
-  return 0;
+  return SearchObjects(point, distance, *lane_segment_kdtree_, lane_table_,
+                       &ThreadQueryContext(), lanes);
 }
 
 int HDMapImpl::GetRoads(const PointENU& point, double distance,
@@ -253,24 +869,24 @@ int HDMapImpl::GetRoads(const PointENU& point, double distance,
 
 int HDMapImpl::GetRoads(const Vec2d& point, double distance,
                         std::vector<RoadInfoConstPtr>* roads) const {
-  std::vector<LaneInfoConstPtr> lanes;
-  if (GetLanes(point, distance, &lanes) != 0) {
+  if (roads == nullptr) {
     return -1;
   }
+  return SearchRoads(point, distance, &ThreadQueryContext(), roads);
+}
+
+void HDMapImpl::CollectRoads(const std::vector<LaneInfoConstPtr>& lanes,
+                             std::vector<RoadInfoConstPtr>* roads) const {
   std::unordered_set<std::string> road_ids;
   for (auto& lane : lanes) {
-    if (!lane->road_id().id().empty()) {
-      road_ids.insert(lane->road_id().id());
+    const auto& road_id = lane->road_id();
+    if (road_id.id().empty() || !road_ids.insert(road_id.id()).second) {
+      continue;
     }
-  }
-
-  for (auto& road_id : road_ids) {
-    RoadInfoConstPtr road = GetRoadById(CreateHDMapId(road_id));
+    RoadInfoConstPtr road = GetRoadById(road_id);
     CHECK_NOTNULL(road);
     roads->push_back(road);
   }
-
-  return 0;
 }
 
 int HDMapImpl::GetJunctions(
@@ -286,16 +902,8 @@ int HDMapImpl::GetJunctions(
     return -1;
   }
   junctions->clear();
-  std::vector<std::string> ids;
-  const int status =
-      SearchObjects(point, distance, *junction_polygon_kdtree_, &ids);
-  if (status < 0) {
-    return status;
-  }
-  for (const auto& id : ids) {
-    junctions->emplace_back(GetJunctionById(CreateHDMapId(id)));
-  }
-  return 0;
+  return SearchObjects(point, distance, *junction_polygon_kdtree_,
+                       junction_table_, &ThreadQueryContext(), junctions);
 }
 
 int HDMapImpl::GetSignals(const PointENU& point, double distance,
@@ -309,16 +917,8 @@ int HDMapImpl::GetSignals(const Vec2d& point, double distance,
     return -1;
   }
   signals->clear();
-  std::vector<std::string> ids;
-  const int status =
-      SearchObjects(point, distance, *signal_segment_kdtree_, &ids);
-  if (status < 0) {
-    return status;
-  }
-  for (const auto& id : ids) {
-    signals->emplace_back(GetSignalById(CreateHDMapId(id)));
-  }
-  return 0;
+  return SearchObjects(point, distance, *signal_segment_kdtree_, signal_table_,
+                       &ThreadQueryContext(), signals);
 }
 
 int HDMapImpl::GetCrosswalks(
@@ -334,16 +934,8 @@ int HDMapImpl::GetCrosswalks(
     return -1;
   }
   crosswalks->clear();
-  std::vector<std::string> ids;
-  const int status =
-      SearchObjects(point, distance, *crosswalk_polygon_kdtree_, &ids);
-  if (status < 0) {
-    return status;
-  }
-  for (const auto& id : ids) {
-    crosswalks->emplace_back(GetCrosswalkById(CreateHDMapId(id)));
-  }
-  return 0;
+  return SearchObjects(point, distance, *crosswalk_polygon_kdtree_,
+                       crosswalk_table_, &ThreadQueryContext(), crosswalks);
 }
 
 int HDMapImpl::GetStopSigns(
@@ -359,16 +951,8 @@ int HDMapImpl::GetStopSigns(
     return -1;
   }
   stop_signs->clear();
-  std::vector<std::string> ids;
-  const int status =
-      SearchObjects(point, distance, *stop_sign_segment_kdtree_, &ids);
-  if (status < 0) {
-    return status;
-  }
-  for (const auto& id : ids) {
-    stop_signs->emplace_back(GetStopSignById(CreateHDMapId(id)));
-  }
-  return 0;
+  return SearchObjects(point, distance, *stop_sign_segment_kdtree_,
+                       stop_sign_table_, &ThreadQueryContext(), stop_signs);
 }
 
 int HDMapImpl::GetYieldSigns(
@@ -384,17 +968,8 @@ int HDMapImpl::GetYieldSigns(
     return -1;
   }
   yield_signs->clear();
-  std::vector<std::string> ids;
-  const int status =
-      SearchObjects(point, distance, *yield_sign_segment_kdtree_, &ids);
-  if (status < 0) {
-    return status;
-  }
-  for (const auto& id : ids) {
-    yield_signs->emplace_back(GetYieldSignById(CreateHDMapId(id)));
-  }
-
-  return 0;
+  return SearchObjects(point, distance, *yield_sign_segment_kdtree_,
+                       yield_sign_table_, &ThreadQueryContext(), yield_signs);
 }
 
 int HDMapImpl::GetClearAreas(
@@ -410,17 +985,8 @@ int HDMapImpl::GetClearAreas(
     return -1;
   }
   clear_areas->clear();
-  std::vector<std::string> ids;
-  const int status =
-      SearchObjects(point, distance, *clear_area_polygon_kdtree_, &ids);
-  if (status < 0) {
-    return status;
-  }
-  for (const auto& id : ids) {
-    clear_areas->emplace_back(GetClearAreaById(CreateHDMapId(id)));
-  }
-
-  return 0;
+  return SearchObjects(point, distance, *clear_area_polygon_kdtree_,
+                       clear_area_table_, &ThreadQueryContext(), clear_areas);
 }
 
 int HDMapImpl::GetSpeedBumps(
@@ -436,17 +1002,8 @@ int HDMapImpl::GetSpeedBumps(
     return -1;
   }
   speed_bumps->clear();
-  std::vector<std::string> ids;
-  const int status =
-      SearchObjects(point, distance, *speed_bump_segment_kdtree_, &ids);
-  if (status < 0) {
-    return status;
-  }
-  for (const auto& id : ids) {
-    speed_bumps->emplace_back(GetSpeedBumpById(CreateHDMapId(id)));
-  }
-
-  return 0;
+  return SearchObjects(point, distance, *speed_bump_segment_kdtree_,
+                       speed_bump_table_, &ThreadQueryContext(), speed_bumps);
 }
 
 int HDMapImpl::GetParkingSpaces(
@@ -462,17 +1019,9 @@ int HDMapImpl::GetParkingSpaces(
     return -1;
   }
   parking_spaces->clear();
-  std::vector<std::string> ids;
-  const int status =
-      SearchObjects(point, distance, *parking_space_polygon_kdtree_, &ids);
-  if (status < 0) {
-    return status;
-  }
-  for (const auto& id : ids) {
-    parking_spaces->emplace_back(GetParkingSpaceById(CreateHDMapId(id)));
-  }
-
-  return 0;
+  return SearchObjects(point, distance, *parking_space_polygon_kdtree_,
+                       parking_space_table_, &ThreadQueryContext(),
+                       parking_spaces);
 }
 
 int HDMapImpl::GetPNCJunctions(
@@ -488,49 +1037,380 @@ int HDMapImpl::GetPNCJunctions(
     return -1;
   }
   pnc_junctions->clear();
+  return SearchObjects(point, distance, *pnc_junction_polygon_kdtree_,
+                       pnc_junction_table_, &ThreadQueryContext(),
+                       pnc_junctions);
+}
 
-  std::vector<std::string> ids;
-  const int status =
-      SearchObjects(point, distance, *pnc_junction_polygon_kdtree_, &ids);
-  if (status < 0) {
-    return status;
-  }
+int HDMapImpl::GetNearestLane(const PointENU& point,
+                              LaneInfoConstPtr* nearest_lane, double* nearest_s,
+                              double* nearest_l) const {
+  return GetNearestLane({point.x(), point.y()},
+                        std::numeric_limits<double>::infinity(), nearest_lane,
+                        nearest_s, nearest_l);
+}
 
-  for (const auto& id : ids) {
-    pnc_junctions->emplace_back(GetPNCJunctionById(CreateHDMapId(id)));
+int HDMapImpl::GetNearestLane(const PointENU& point, const double max_distance,
+                              LaneInfoConstPtr* nearest_lane, double* nearest_s,
+                              double* nearest_l) const {
+  return GetNearestLane({point.x(), point.y()}, max_distance, nearest_lane,
+                        nearest_s, nearest_l);
+}
+
+int HDMapImpl::GetNearestLane(const Vec2d& point, const double max_distance,
+                              LaneInfoConstPtr* nearest_lane, double* nearest_s,
+                              double* nearest_l) const {
+  CHECK_NOTNULL(nearest_lane);
+  CHECK_NOTNULL(nearest_s);
+  CHECK_NOTNULL(nearest_l);
+  if (lane_segment_kdtree_ == nullptr) {
+    return -1;
   }
+  const auto* segment_object =
+      lane_segment_kdtree_->GetNearestObject(point, max_distance);
+  if (segment_object == nullptr) {
+    return -1;
+  }
+  *nearest_lane = lane_table_[segment_object->object_index()];
+  (*nearest_lane)->GetSegmentProjection(point, segment_object->id(), nearest_s,
+                                        nearest_l);
 
   return 0;
 }
 
+int HDMapImpl::GetLanes(const PointENU& point, double distance,
+                        QueryContext* context,
+                        std::vector<const LaneInfo*>* lanes) const {
+  if (context == nullptr || lanes == nullptr ||
+      lane_segment_kdtree_ == nullptr) {
+    return -1;
+  }
+  lanes->clear();
+  return SearchObjects({point.x(), point.y()}, distance, *lane_segment_kdtree_,
+                       lane_table_, context, lanes);
+}
+
+int HDMapImpl::GetJunctions(const PointENU& point, double distance,
+                            QueryContext* context,
+                            std::vector<const JunctionInfo*>* junctions) const {
+  if (context == nullptr || junctions == nullptr ||
+      junction_polygon_kdtree_ == nullptr) {
+    return -1;
+  }
+  junctions->clear();
+  return SearchObjects({point.x(), point.y()}, distance,
+                       *junction_polygon_kdtree_, junction_table_, context,
+                       junctions);
+}
+
+int HDMapImpl::GetSignals(const PointENU& point, double distance,
+                          QueryContext* context,
+                          std::vector<const SignalInfo*>* signals) const {
+  if (context == nullptr || signals == nullptr ||
+      signal_segment_kdtree_ == nullptr) {
+    return -1;
+  }
+  signals->clear();
+  return SearchObjects({point.x(), point.y()}, distance,
+                       *signal_segment_kdtree_, signal_table_, context,
+                       signals);
+}
+
+int HDMapImpl::GetCrosswalks(
+    const PointENU& point, double distance, QueryContext* context,
+    std::vector<const CrosswalkInfo*>* crosswalks) const {
+  if (context == nullptr || crosswalks == nullptr ||
+      crosswalk_polygon_kdtree_ == nullptr) {
+    return -1;
+  }
+  crosswalks->clear();
+  return SearchObjects({point.x(), point.y()}, distance,
+                       *crosswalk_polygon_kdtree_, crosswalk_table_, context,
+                       crosswalks);
+}
+
+int HDMapImpl::GetStopSigns(
+    const PointENU& point, double distance, QueryContext* context,
+    std::vector<const StopSignInfo*>* stop_signs) const {
+  if (context == nullptr || stop_signs == nullptr ||
+      stop_sign_segment_kdtree_ == nullptr) {
+    return -1;
+  }
+  stop_signs->clear();
+  return SearchObjects({point.x(), point.y()}, distance,
+                       *stop_sign_segment_kdtree_, stop_sign_table_, context,
+                       stop_signs);
+}
+
+int HDMapImpl::GetYieldSigns(
+    const PointENU& point, double distance, QueryContext* context,
+    std::vector<const YieldSignInfo*>* yield_signs) const {
+  if (context == nullptr || yield_signs == nullptr ||
+      yield_sign_segment_kdtree_ == nullptr) {
+    return -1;
+  }
+  yield_signs->clear();
+  return SearchObjects({point.x(), point.y()}, distance,
+                       *yield_sign_segment_kdtree_, yield_sign_table_, context,
+                       yield_signs);
+}
+
+int HDMapImpl::GetClearAreas(
+    const PointENU& point, double distance, QueryContext* context,
+    std::vector<const ClearAreaInfo*>* clear_areas) const {
+  if (context == nullptr || clear_areas == nullptr ||
+      clear_area_polygon_kdtree_ == nullptr) {
+    return -1;
+  }
+  clear_areas->clear();
+  return SearchObjects({point.x(), point.y()}, distance,
+                       *clear_area_polygon_kdtree_, clear_area_table_, context,
+                       clear_areas);
+}
+
+int HDMapImpl::GetSpeedBumps(
+    const PointENU& point, double distance, QueryContext* context,
+    std::vector<const SpeedBumpInfo*>* speed_bumps) const {
+  if (context == nullptr || speed_bumps == nullptr ||
+      speed_bump_segment_kdtree_ == nullptr) {
+    return -1;
+  }
+  speed_bumps->clear();
+  return SearchObjects({point.x(), point.y()}, distance,
+                       *speed_bump_segment_kdtree_, speed_bump_table_, context,
+                       speed_bumps);
+}
+
+int HDMapImpl::GetParkingSpaces(
+    const PointENU& point, double distance, QueryContext* context,
+    std::vector<const ParkingSpaceInfo*>* parking_spaces) const {
+  if (context == nullptr || parking_spaces == nullptr ||
+      parking_space_polygon_kdtree_ == nullptr) {
+    return -1;
+  }
+  parking_spaces->clear();
+  return SearchObjects({point.x(), point.y()}, distance,
+                       *parking_space_polygon_kdtree_, parking_space_table_,
+                       context, parking_spaces);
+}
+
+int HDMapImpl::GetPNCJunctions(
+    const PointENU& point, double distance, QueryContext* context,
+    std::vector<const PNCJunctionInfo*>* pnc_junctions) const {
+  if (context == nullptr || pnc_junctions == nullptr ||
+      pnc_junction_polygon_kdtree_ == nullptr) {
+    return -1;
+  }
+  pnc_junctions->clear();
+  return SearchObjects({point.x(), point.y()}, distance,
+                       *pnc_junction_polygon_kdtree_, pnc_junction_table_,
+                       context, pnc_junctions);
+}
+
+int HDMapImpl::GetRoads(const PointENU& point, double distance,
+                        QueryContext* context,
+                        std::vector<const RoadInfo*>* roads) const {
+  if (context == nullptr || roads == nullptr) {
+    return -1;
+  }
+  roads->clear();
+  return SearchRoads({point.x(), point.y()}, distance, context, roads);
+}
+
 int HDMapImpl::GetNearestLane(const PointENU& point,
-                              LaneInfoConstPtr* nearest_lane, double* nearest_s,
+                              const LaneInfo** nearest_lane, double* nearest_s,
                               double* nearest_l) const {
-  return GetNearestLane({point.x(), point.y()}, nearest_lane, nearest_s,
-                        nearest_l);
+  return GetNearestLane(point, std::numeric_limits<double>::infinity(),
+                        nearest_lane, nearest_s, nearest_l);
 }
 
-int HDMapImpl::GetNearestLane(const Vec2d& point,
-                              LaneInfoConstPtr* nearest_lane, double* nearest_s,
+int HDMapImpl::GetNearestLane(const PointENU& point, const double max_distance,
+                              const LaneInfo** nearest_lane, double* nearest_s,
                               double* nearest_l) const {
   CHECK_NOTNULL(nearest_lane);
   CHECK_NOTNULL(nearest_s);
   CHECK_NOTNULL(nearest_l);
-  const auto* segment_object = lane_segment_kdtree_->GetNearestObject(point);
+  if (lane_segment_kdtree_ == nullptr) {
+    return -1;
+  }
+  const Vec2d xy(point.x(), point.y());
+  const auto* segment_object =
+      lane_segment_kdtree_->GetNearestObject(xy, max_distance);
   if (segment_object == nullptr) {
     return -1;
   }
-  const Id& lane_id = segment_object->object()->id();
-  *nearest_lane = GetLaneById(lane_id);
-  ACHECK(*nearest_lane);
-  const int id = segment_object->id();
-  const auto& segment = (*nearest_lane)->segments()[id];
-  Vec2d nearest_pt;
-  segment.DistanceTo(point, &nearest_pt);
-  *nearest_s = (*nearest_lane)->accumulate_s()[id] +
-               nearest_pt.DistanceTo(segment.start());
-  *nearest_l = segment.unit_direction().CrossProd(point - segment.start());
+  *nearest_lane = segment_object->object();
+  segment_object->object()->GetSegmentProjection(xy, segment_object->id(),
+                                                 nearest_s, nearest_l);
+  return 0;
+}
 
+int HDMapImpl::GetKNearestLanes(const PointENU& point, const int k,
+                                const double max_distance,
+                                std::vector<LaneInfoConstPtr>* lanes,
+                                std::vector<double>* nearest_s,
+                                std::vector<double>* nearest_l) const {
+  return GetKNearestLanes({point.x(), point.y()}, k, max_distance, lanes,
+                          nearest_s, nearest_l);
+}
+
+int HDMapImpl::GetKNearestLanes(const Vec2d& point, const int k,
+                                const double max_distance,
+                                std::vector<LaneInfoConstPtr>* lanes,
+                                std::vector<double>* nearest_s,
+                                std::vector<double>* nearest_l) const {
+  CHECK_NOTNULL(lanes);
+  CHECK_NOTNULL(nearest_s);
+  CHECK_NOTNULL(nearest_l);
+  lanes->clear();
+  nearest_s->clear();
+  nearest_l->clear();
+  if (lane_segment_kdtree_ == nullptr) {
+    return -1;
+  }
+  const auto segment_objects =
+      lane_segment_kdtree_->GetKNearestObjects(
+          point, k, max_distance, static_cast<int>(lane_table_.size()));
+  if (segment_objects.empty()) {
+    return -1;
+  }
+  for (const auto* segment_object : segment_objects) {
+    double s = 0.0;
+    double l = 0.0;
+    segment_object->object()->GetSegmentProjection(
+        point, segment_object->id(), &s, &l);
+    lanes->push_back(lane_table_[segment_object->object_index()]);
+    nearest_s->push_back(s);
+    nearest_l->push_back(l);
+  }
+  return 0;
+}
+
+int HDMapImpl::GetNearestLaneBatch(const std::vector<Vec2d>& points,
+                                   const int num_threads,
+                                   std::vector<LaneProjection>* results) const {
+  CHECK_NOTNULL(results);
+  if (lane_segment_kdtree_ == nullptr) {
+    return -1;
+  }
+  results->assign(points.size(), LaneProjection());
+  const std::vector<size_t> order = SpatialOrder(points);
+  BatchThreadPool()->ParallelFor(
+      order.size(), std::max(1, num_threads), [&](size_t begin, size_t end) {
+        const LaneSegmentBox* segment_object = nullptr;
+        for (size_t i = begin; i < end; ++i) {
+          const Vec2d& point = points[order[i]];
+          segment_object =
+              lane_segment_kdtree_->GetNearestObject(point, segment_object);
+          if (segment_object == nullptr) {
+            continue;
+          }
+          auto& result = (*results)[order[i]];
+          result.lane_handle = segment_object->object_index();
+          segment_object->object()->GetSegmentProjection(
+              point, segment_object->id(), &result.s, &result.l);
+        }
+      });
+  return 0;
+}
+
+int HDMapImpl::GetNearestLaneSegment(
+    const Vec2d& point, const LaneSegmentBox* seed,
+    const LaneSegmentBox** nearest_segment) const {
+  CHECK_NOTNULL(nearest_segment);
+  if (lane_segment_kdtree_ == nullptr) {
+    return -1;
+  }
+  // A segment of a lane removed since is no longer in the tree, and must not
+  // come back as the answer.
+  if (seed != nullptr) {
+    const auto handle = static_cast<ElementHandle>(seed->object_index());
+    if (handle >= lane_table_.size() ||
+        lane_table_[handle].get() != seed->object()) {
+      seed = nullptr;
+    }
+  }
+  *nearest_segment = lane_segment_kdtree_->GetNearestObject(point, seed);
+  return *nearest_segment == nullptr ? -1 : 0;
+}
+
+int HDMapImpl::GetLaneSegments(
+    const Vec2d& point, const double distance,
+    std::vector<const LaneSegmentBox*>* segments) const {
+  if (segments == nullptr || lane_segment_kdtree_ == nullptr) {
+    return -1;
+  }
+  segments->clear();
+  lane_segment_kdtree_->GetObjects(point, distance, segments);
+  return 0;
+}
+
+int HDMapImpl::GetLanesBatch(
+    const std::vector<Vec2d>& points, const double distance,
+    const int num_threads,
+    std::vector<std::vector<ElementHandle>>* lane_handles) const {
+  if (lane_handles == nullptr || lane_segment_kdtree_ == nullptr) {
+    return -1;
+  }
+  lane_handles->resize(points.size());
+  const std::vector<size_t> order = SpatialOrder(points);
+  const double distance_sqr = distance * distance;
+  BatchThreadPool()->ParallelFor(
+      order.size(), std::max(1, num_threads), [&](size_t begin, size_t end) {
+        thread_local std::vector<const LaneSegmentBox*> objects;
+        QueryContext& context = ThreadQueryContext();
+        size_t group_begin = begin;
+        while (group_begin < end) {
+          // Group consecutive points that fit in a box no wider than the
+          // search radius, and run one query covering all of them.
+          const Vec2d& first = points[order[group_begin]];
+          double min_x = first.x();
+          double min_y = first.y();
+          double max_x = first.x();
+          double max_y = first.y();
+          size_t group_end = group_begin + 1;
+          while (group_end < end &&
+                 group_end - group_begin < kMaxBatchGroupSize) {
+            const Vec2d& point = points[order[group_end]];
+            const double new_min_x = std::fmin(min_x, point.x());
+            const double new_min_y = std::fmin(min_y, point.y());
+            const double new_max_x = std::fmax(max_x, point.x());
+            const double new_max_y = std::fmax(max_y, point.y());
+            if (std::fmax(new_max_x - new_min_x, new_max_y - new_min_y) >
+                distance) {
+              break;
+            }
+            min_x = new_min_x;
+            min_y = new_min_y;
+            max_x = new_max_x;
+            max_y = new_max_y;
+            ++group_end;
+          }
+          const Vec2d center((min_x + max_x) / 2.0, (min_y + max_y) / 2.0);
+          const double half_diagonal = std::hypot(max_x - min_x,
+                                                  max_y - min_y) / 2.0;
+          objects.clear();
+          lane_segment_kdtree_->GetObjects(
+              center, distance + half_diagonal + kBatchSearchMargin,
+              &objects);
+
+          for (size_t i = group_begin; i < group_end; ++i) {
+            const Vec2d& point = points[order[i]];
+            auto& handles = (*lane_handles)[order[i]];
+            handles.clear();
+            context.StartPass(lane_table_.size());
+            for (const auto* object_ptr : objects) {
+              const ElementHandle index = object_ptr->object_index();
+              if (!context.IsMarked(index) &&
+                  object_ptr->DistanceSquareTo(point) <= distance_sqr) {
+                context.Mark(index);
+                handles.push_back(index);
+              }
+            }
+          }
+          group_begin = group_end;
+        }
+      });
   return 0;
 }
 
@@ -551,39 +1431,27 @@ int HDMapImpl::GetNearestLaneWithHeading(
   CHECK_NOTNULL(nearest_s);
   CHECK_NOTNULL(nearest_l);
 
-  std::vector<LaneInfoConstPtr> lanes;
-  if (GetLanesWithHeading(point, distance, central_heading,
-                          max_heading_difference, &lanes) != 0) {
+  if (lane_segment_kdtree_ == nullptr) {
     return -1;
   }
-
-  double s = 0;
-  size_t s_index = 0;
-  Vec2d map_point;
-  double min_distance = distance;
-  for (const auto& lane : lanes) {
-    double s_offset = 0.0;
-    int s_offset_index = 0;
-    double distance =
-        lane->DistanceTo(point, &map_point, &s_offset, &s_offset_index);
-    if (distance < min_distance) {
-      min_distance = distance;
-      *nearest_lane = lane;
-      s = s_offset;
-      s_index = s_offset_index;
-    }
-  }
-
-  if (*nearest_lane == nullptr) {
+  // Lanes are judged on their nearest segment, as in GetLanesWithHeading, but
+  // in one best-first walk that stops at the first compatible lane.
+  const auto* segment_object = lane_segment_kdtree_->GetNearestAcceptedObject(
+      point, distance, static_cast<int>(lane_table_.size()),
+      [&](const LaneSegmentBox* object) {
+        const double heading_diff =
+            fabs(object->object()->headings()[object->id()] - central_heading);
+        return fabs(apollo::common::math::NormalizeAngle(heading_diff)) <=
+               max_heading_difference;
+      });
+  if (segment_object == nullptr ||
+      segment_object->DistanceTo(point) >= distance) {
     return -1;
   }
 
-  *nearest_s = s;
-  int segment_index = static_cast<int>(
-      std::min(s_index, (*nearest_lane)->segments().size() - 1));
-  const auto& segment_2d = (*nearest_lane)->segments()[segment_index];
-  *nearest_l =
-      segment_2d.unit_direction().CrossProd(point - segment_2d.start());
+  *nearest_lane = lane_table_[segment_object->object_index()];
+  (*nearest_lane)->GetSegmentProjection(point, segment_object->id(), nearest_s,
+                                        nearest_l);
 
   return 0;
 }
@@ -712,11 +1580,10 @@ int HDMapImpl::GetRoadBoundaries(
       }
     } else {
       RoadRoiPtr road_boundary_ptr(new RoadRoi());
-      const std::vector<apollo::hdmap::RoadBoundary>& temp_road_boundaries =
-          road_ptr->GetBoundaries();
       road_boundary_ptr->id = road_ptr->id();
-      for (const auto& temp_road_boundary : temp_road_boundaries) {
-        apollo::hdmap::BoundaryPolygon boundary_polygon =
+      for (const auto& section : road_ptr->sections()) {
+        const auto& temp_road_boundary = section.boundary();
+        const apollo::hdmap::BoundaryPolygon& boundary_polygon =
             temp_road_boundary.outer_polygon();
         for (const auto& edge : boundary_polygon.edge()) {
           if (edge.type() == apollo::hdmap::BoundaryEdge::LEFT_BOUNDARY) {
@@ -768,14 +1635,12 @@ int HDMapImpl::GetRoi(const apollo::common::PointENU& point, double radius,
   std::set<std::string> polygon_id_set;
   std::vector<RoadInfoConstPtr> roads;
   std::vector<LaneInfoConstPtr> lanes;
-  if (GetRoads(point, radius, &roads) != 0) {
-    AERROR << "can not get roads in the range.";
-    return -1;
-  }
+  // Roads are derived from the lanes in range, so one search serves both.
   if (GetLanes(point, radius, &lanes) != 0) {
     AERROR << "can not get lanes in the range.";
     return -1;
   }
+  CollectRoads(lanes, &roads);
   for (const auto& road_ptr : roads) {
     // get junction polygon
     if (road_ptr->has_junction_id()) {
@@ -793,12 +1658,11 @@ int HDMapImpl::GetRoi(const apollo::common::PointENU& point, double radius,
     } else {
       // get road boundary
       RoadRoiPtr road_boundary_ptr(new RoadRoi());
-      std::vector<apollo::hdmap::RoadBoundary> temp_roads_roi;
-      temp_roads_roi = road_ptr->GetBoundaries();
-      if (!temp_roads_roi.empty()) {
+      if (!road_ptr->sections().empty()) {
         road_boundary_ptr->id = road_ptr->id();
-        for (const auto& temp_road_boundary : temp_roads_roi) {
-          apollo::hdmap::BoundaryPolygon boundary_polygon =
+        for (const auto& section : road_ptr->sections()) {
+          const auto& temp_road_boundary = section.boundary();
+          const apollo::hdmap::BoundaryPolygon& boundary_polygon =
               temp_road_boundary.outer_polygon();
           for (const auto& edge : boundary_polygon.edge()) {
             if (edge.type() == apollo::hdmap::BoundaryEdge::LEFT_BOUNDARY) {
@@ -915,8 +1779,8 @@ int HDMapImpl::GetForwardNearestSignalsOnLane(
   double back_distance = kBackwardDistance;
   double s = nearest_s;
   while (s < back_distance) {
-    for (const auto& predecessor_lane_id : lane_ptr->lane().predecessor_id()) {
-      lane_ptr = GetLaneById(predecessor_lane_id);
+    for (const auto predecessor_handle : lane_ptr->predecessor_handles()) {
+      lane_ptr = GetLaneByHandle(predecessor_handle);
       if (lane_ptr->lane().turn() == apollo::hdmap::Lane::NO_TURN) {
         break;
       }
@@ -928,8 +1792,7 @@ int HDMapImpl::GetForwardNearestSignalsOnLane(
   while (lane_ptr != nullptr) {
     double signal_min_dist = std::numeric_limits<double>::infinity();
     std::vector<SignalInfoConstPtr> min_dist_signal_ptr;
-    for (const auto& overlap_id : lane_ptr->lane().overlap_id()) {
-      OverlapInfoConstPtr overlap_ptr = GetOverlapById(overlap_id);
+    for (const auto& overlap_ptr : lane_ptr->overlaps()) {
       double lane_overlap_offset_s = 0.0;
       SignalInfoConstPtr signal_ptr = nullptr;
       for (int i = 0; i < overlap_ptr->overlap().object_size(); ++i) {
@@ -962,8 +1825,8 @@ int HDMapImpl::GetForwardNearestSignalsOnLane(
       break;
     }
     LaneInfoConstPtr tmp_lane_ptr = nullptr;
-    for (const auto& successor_lane_id : lane_ptr->lane().successor_id()) {
-      tmp_lane_ptr = GetLaneById(successor_lane_id);
+    for (const auto successor_handle : lane_ptr->successor_handles()) {
+      tmp_lane_ptr = GetLaneByHandle(successor_handle);
       if (tmp_lane_ptr->lane().turn() == apollo::hdmap::Lane::NO_TURN) {
         break;
       }
@@ -1058,6 +1921,122 @@ int HDMapImpl::GetStopSignAssociatedLanes(
   return 0;
 }
 
+template <class Region>
+int HDMapImpl::SearchElementsInRegion(const Region& region,
+                                      const MapElementTypeMask type_mask,
+                                      MapObjects* const objects) const {
+  if (objects == nullptr || map_element_kdtree_ == nullptr) {
+    return -1;
+  }
+  *objects = MapObjects();
+  std::array<std::vector<ElementHandle>, kNumMapElementTypes> handles;
+  auto& contexts = ThreadElementContexts();
+  StartElementPasses(&contexts);
+  map_element_kdtree_->ForEachObjectInRegion(
+      region,
+      // Boxes of elements already found skip the exact test.
+      [type_mask, &contexts](const MapElementBox* object) {
+        return (type_mask & MapElementTypeBit(object->type())) != 0 &&
+               !ContextOf(&contexts, *object).IsMarked(object->handle());
+      },
+      [&contexts, &handles](const MapElementBox* object) {
+        if (ContextOf(&contexts, *object).Mark(object->handle())) {
+          handles[static_cast<int>(object->type())].push_back(
+              object->handle());
+        }
+      });
+  auto handles_of = [&handles](const MapElementType type) -> const auto& {
+    return handles[static_cast<int>(type)];
+  };
+  ResolveHandles(lane_table_, handles_of(MapElementType::LANE),
+                 &objects->lanes);
+  ResolveHandles(junction_table_, handles_of(MapElementType::JUNCTION),
+                 &objects->junctions);
+  ResolveHandles(crosswalk_table_, handles_of(MapElementType::CROSSWALK),
+                 &objects->crosswalks);
+  ResolveHandles(signal_table_, handles_of(MapElementType::SIGNAL),
+                 &objects->signals);
+  ResolveHandles(stop_sign_table_, handles_of(MapElementType::STOP_SIGN),
+                 &objects->stop_signs);
+  ResolveHandles(yield_sign_table_, handles_of(MapElementType::YIELD_SIGN),
+                 &objects->yield_signs);
+  ResolveHandles(clear_area_table_, handles_of(MapElementType::CLEAR_AREA),
+                 &objects->clear_areas);
+  ResolveHandles(speed_bump_table_, handles_of(MapElementType::SPEED_BUMP),
+                 &objects->speed_bumps);
+  ResolveHandles(parking_space_table_,
+                 handles_of(MapElementType::PARKING_SPACE),
+                 &objects->parking_spaces);
+  ResolveHandles(pnc_junction_table_,
+                 handles_of(MapElementType::PNC_JUNCTION),
+                 &objects->pnc_junctions);
+  return 0;
+}
+
+int HDMapImpl::GetObjectsInPolygon(const Polygon2d& polygon,
+                                   const MapElementTypeMask type_mask,
+                                   MapObjects* objects) const {
+  if (polygon.num_points() < 3) {
+    AERROR << "A polygon needs at least 3 points.";
+    return -1;
+  }
+  return SearchElementsInRegion(PolygonRegion(polygon), type_mask, objects);
+}
+
+int HDMapImpl::GetObjectsInBox(const apollo::common::math::Box2d& box,
+                               const MapElementTypeMask type_mask,
+                               MapObjects* objects) const {
+  return GetObjectsInPolygon(Polygon2d(box), type_mask, objects);
+}
+
+int HDMapImpl::GetObjectsAlongPath(const std::vector<Vec2d>& path,
+                                   const double distance,
+                                   const MapElementTypeMask type_mask,
+                                   MapObjects* objects) const {
+  if (path.empty() || distance < 0.0) {
+    AERROR << "Invalid path query: " << path.size() << " points, distance "
+           << distance << ".";
+    return -1;
+  }
+  return SearchElementsInRegion(PathRegion(path, distance), type_mask,
+                                objects);
+}
+
+int HDMapImpl::GetLanesInPolygon(const Polygon2d& polygon,
+                                 std::vector<LaneInfoConstPtr>* lanes) const {
+  if (lanes == nullptr) {
+    return -1;
+  }
+  MapObjects objects;
+  if (GetObjectsInPolygon(polygon, MapElementTypeBit(MapElementType::LANE),
+                          &objects) != 0) {
+    return -1;
+  }
+  *lanes = std::move(objects.lanes);
+  return 0;
+}
+
+int HDMapImpl::GetLanesInBox(const apollo::common::math::Box2d& box,
+                             std::vector<LaneInfoConstPtr>* lanes) const {
+  return GetLanesInPolygon(Polygon2d(box), lanes);
+}
+
+int HDMapImpl::GetLanesAlongPath(const std::vector<Vec2d>& path,
+                                 const double distance,
+                                 std::vector<LaneInfoConstPtr>* lanes) const {
+  if (lanes == nullptr) {
+    return -1;
+  }
+  MapObjects objects;
+  if (GetObjectsAlongPath(path, distance,
+                          MapElementTypeBit(MapElementType::LANE),
+                          &objects) != 0) {
+    return -1;
+  }
+  *lanes = std::move(objects.lanes);
+  return 0;
+}
+
 int HDMapImpl::GetLocalMap(const apollo::common::PointENU& point,
                            const std::pair<double, double>& range,
                            Map* local_map) const {
@@ -1066,35 +2045,59 @@ int HDMapImpl::GetLocalMap(const apollo::common::PointENU& point,
   double distance = std::max(range.first, range.second);
   CHECK_GT(distance, 0.0);
 
+  // All layers come from one traversal of the combined index.
+  std::array<std::vector<ElementHandle>, kNumMapElementTypes> handles;
+  const MapElementTypeMask type_mask =
+      MapElementTypeBit(MapElementType::LANE) |
+      MapElementTypeBit(MapElementType::JUNCTION) |
+      MapElementTypeBit(MapElementType::CROSSWALK) |
+      MapElementTypeBit(MapElementType::SIGNAL) |
+      MapElementTypeBit(MapElementType::STOP_SIGN) |
+      MapElementTypeBit(MapElementType::YIELD_SIGN) |
+      MapElementTypeBit(MapElementType::CLEAR_AREA) |
+      MapElementTypeBit(MapElementType::SPEED_BUMP) |
+      MapElementTypeBit(MapElementType::PARKING_SPACE);
+  SearchElements({point.x(), point.y()}, distance, type_mask, &handles);
+  auto handles_of = [&handles](const MapElementType type) -> const auto& {
+    return handles[static_cast<int>(type)];
+  };
+
   std::vector<LaneInfoConstPtr> lanes;
-  GetLanes(point, distance, &lanes);
+  ResolveHandles(lane_table_, handles_of(MapElementType::LANE), &lanes);
 
   std::vector<JunctionInfoConstPtr> junctions;
-  GetJunctions(point, distance, &junctions);
+  ResolveHandles(junction_table_, handles_of(MapElementType::JUNCTION),
+                 &junctions);
 
   std::vector<CrosswalkInfoConstPtr> crosswalks;
-  GetCrosswalks(point, distance, &crosswalks);
+  ResolveHandles(crosswalk_table_, handles_of(MapElementType::CROSSWALK),
+                 &crosswalks);
 
   std::vector<SignalInfoConstPtr> signals;
-  GetSignals(point, distance, &signals);
+  ResolveHandles(signal_table_, handles_of(MapElementType::SIGNAL), &signals);
 
   std::vector<StopSignInfoConstPtr> stop_signs;
-  GetStopSigns(point, distance, &stop_signs);
+  ResolveHandles(stop_sign_table_, handles_of(MapElementType::STOP_SIGN),
+                 &stop_signs);
 
   std::vector<YieldSignInfoConstPtr> yield_signs;
-  GetYieldSigns(point, distance, &yield_signs);
+  ResolveHandles(yield_sign_table_, handles_of(MapElementType::YIELD_SIGN),
+                 &yield_signs);
 
   std::vector<ClearAreaInfoConstPtr> clear_areas;
-  GetClearAreas(point, distance, &clear_areas);
+  ResolveHandles(clear_area_table_, handles_of(MapElementType::CLEAR_AREA),
+                 &clear_areas);
 
   std::vector<SpeedBumpInfoConstPtr> speed_bumps;
-  GetSpeedBumps(point, distance, &speed_bumps);
+  ResolveHandles(speed_bump_table_, handles_of(MapElementType::SPEED_BUMP),
+                 &speed_bumps);
 
   std::vector<RoadInfoConstPtr> roads;
-  GetRoads(point, distance, &roads);
+  CollectRoads(lanes, &roads);
 
   std::vector<ParkingSpaceInfoConstPtr> parking_spaces;
-  GetParkingSpaces(point, distance, &parking_spaces);
+  ResolveHandles(parking_space_table_,
+                 handles_of(MapElementType::PARKING_SPACE), &parking_spaces);
 
   std::unordered_set<std::string> map_element_ids;
   std::vector<Id> overlap_ids;
@@ -1291,9 +2294,9 @@ int HDMapImpl::GetForwardNearestRSUs(const apollo::common::PointENU& point,
         break;
     }
 
-    for (const auto suc_lane_id : lane_ptr->lane().successor_id()) {
-      LaneInfoConstPtr suc_lane_ptr = GetLaneById(suc_lane_id);
-      if (lane_ptr->lane().successor_id_size() > 1) {
+    for (const auto suc_lane_handle : lane_ptr->successor_handles()) {
+      LaneInfoConstPtr suc_lane_ptr = GetLaneByHandle(suc_lane_handle);
+      if (lane_ptr->successor_handles().size() > 1) {
         if (suc_lane_ptr->lane().turn() == apollo::hdmap::Lane::NO_TURN) {
           lane_ptr = suc_lane_ptr;
           break;
@@ -1312,22 +2315,54 @@ int HDMapImpl::GetForwardNearestRSUs(const apollo::common::PointENU& point,
   return 0;
 }
 
-template <class Table, class BoxTable, class KDTree>
-void HDMapImpl::BuildSegmentKDTree(const Table& table,
-                                   const AABoxKDTreeParams& params,
-                                   BoxTable* const box_table,
-                                   std::unique_ptr<KDTree>* const kdtree) {
+template <class Table, class BoxTable>
+void HDMapImpl::CreateSegmentBoxes(const Table& table,
+                                   BoxTable* const box_table) {
   box_table->clear();
-  for (const auto& info_with_id : table) {
-    const auto* info = info_with_id.second.get();
+  size_t num_segments = 0;
+  for (const auto& info : table) {
+    num_segments += info != nullptr ? info->segments().size() : 0;
+  }
+  box_table->reserve(num_segments);
+  for (size_t handle = 0; handle < table.size(); ++handle) {
+    const auto* info = table[handle].get();
+    if (info == nullptr) {
+      continue;
+    }
+    const int object_index = static_cast<int>(handle);
     for (size_t id = 0; id < info->segments().size(); ++id) {
       const auto& segment = info->segments()[id];
       box_table->emplace_back(
           apollo::common::math::AABox2d(segment.start(), segment.end()), info,
-          &segment, id);
+          &segment, id, object_index);
     }
   }
-  kdtree->reset(new KDTree(*box_table, params));
+}
+
+template <class Table, class BoxTable>
+void HDMapImpl::CreatePolygonBoxes(const Table& table,
+                                   BoxTable* const box_table) {
+  box_table->clear();
+  box_table->reserve(table.size());
+  for (size_t handle = 0; handle < table.size(); ++handle) {
+    const auto* info = table[handle].get();
+    if (info == nullptr) {
+      continue;
+    }
+    const int object_index = static_cast<int>(handle);
+    const auto& polygon = info->polygon();
+    box_table->emplace_back(polygon.AABoundingBox(), info, &polygon, 0,
+                            object_index);
+  }
+}
+
+template <class Table, class BoxTable, class KDTree>
+void HDMapImpl::BuildSegmentKDTree(const Table& table,
+                                   const AABoxKDTreeParams& params,
+                                   BoxTable* const box_table,
+                                   std::unique_ptr<KDTree>* const kdtree) {
+  CreateSegmentBoxes(table, box_table);
+  kdtree->reset(new KDTree(*box_table, IndexParams(params)));
 }
 
 template <class Table, class BoxTable, class KDTree>
@@ -1335,21 +2370,19 @@ void HDMapImpl::BuildPolygonKDTree(const Table& table,
                                    const AABoxKDTreeParams& params,
                                    BoxTable* const box_table,
                                    std::unique_ptr<KDTree>* const kdtree) {
-  box_table->clear();
-  for (const auto& info_with_id : table) {
-    const auto* info = info_with_id.second.get();
-    const auto& polygon = info->polygon();
-    box_table->emplace_back(polygon.AABoundingBox(), info, &polygon, 0);
-  }
-  kdtree->reset(new KDTree(*box_table, params));
+  CreatePolygonBoxes(table, box_table);
+  kdtree->reset(new KDTree(*box_table, IndexParams(params)));
 }
 
-void HDMapImpl::BuildLaneSegmentKDTree() {
+void HDMapImpl::BuildLaneSegmentKDTree(ThreadPool* pool) {
   AABoxKDTreeParams params;
   params.max_leaf_dimension = 5.0;  // meters.
   params.max_leaf_size = 16;
+  BuildOnPool(pool, &params);
   BuildSegmentKDTree(lane_table_, params, &lane_segment_boxes_,
                      &lane_segment_kdtree_);
+  added_lane_segment_boxes_.clear();
+  num_patched_lane_segments_ = 0;
 }
 
 void HDMapImpl::BuildJunctionPolygonKDTree() {
@@ -1425,36 +2458,238 @@ void HDMapImpl::BuildPNCJunctionPolygonKDTree() {
                      &pnc_junction_polygon_kdtree_);
 }
 
-template <class KDTree>
+void HDMapImpl::BuildMapElementKDTree(ThreadPool* pool) {
+  CreateMapElementBoxes();
+
+  AABoxKDTreeParams params;
+  params.max_leaf_dimension = 5.0;  // meters.
+  params.max_leaf_size = 16;
+  BuildOnPool(pool, &params);
+  map_element_kdtree_.reset(
+      new MapElementKDTree(map_element_boxes_, IndexParams(params)));
+  added_map_element_boxes_.clear();
+}
+
+void HDMapImpl::CreateMapElementBoxes() {
+  map_element_boxes_.clear();
+  size_t num_boxes = junction_table_.size() + crosswalk_table_.size() +
+                     clear_area_table_.size() + parking_space_table_.size() +
+                     pnc_junction_table_.size();
+  auto count_segments = [&num_boxes](const auto& table) {
+    for (const auto& info : table) {
+      num_boxes += info != nullptr ? info->segments().size() : 0;
+    }
+  };
+  count_segments(lane_table_);
+  count_segments(signal_table_);
+  count_segments(stop_sign_table_);
+  count_segments(yield_sign_table_);
+  count_segments(speed_bump_table_);
+  map_element_boxes_.reserve(num_boxes);
+  auto add_segments = [this](const MapElementType type, const auto& table) {
+    for (size_t handle = 0; handle < table.size(); ++handle) {
+      if (table[handle] == nullptr) {
+        continue;
+      }
+      for (const auto& segment : table[handle]->segments()) {
+        map_element_boxes_.emplace_back(
+            apollo::common::math::AABox2d(segment.start(), segment.end()),
+            type, static_cast<ElementHandle>(handle), &segment);
+      }
+    }
+  };
+  auto add_polygons = [this](const MapElementType type, const auto& table) {
+    for (size_t handle = 0; handle < table.size(); ++handle) {
+      if (table[handle] == nullptr) {
+        continue;
+      }
+      const auto& polygon = table[handle]->polygon();
+      map_element_boxes_.emplace_back(polygon.AABoundingBox(), type,
+                                      static_cast<ElementHandle>(handle),
+                                      &polygon);
+    }
+  };
+  add_segments(MapElementType::LANE, lane_table_);
+  add_polygons(MapElementType::JUNCTION, junction_table_);
+  add_polygons(MapElementType::CROSSWALK, crosswalk_table_);
+  add_segments(MapElementType::SIGNAL, signal_table_);
+  add_segments(MapElementType::STOP_SIGN, stop_sign_table_);
+  add_segments(MapElementType::YIELD_SIGN, yield_sign_table_);
+  add_polygons(MapElementType::CLEAR_AREA, clear_area_table_);
+  add_segments(MapElementType::SPEED_BUMP, speed_bump_table_);
+  add_polygons(MapElementType::PARKING_SPACE, parking_space_table_);
+  add_polygons(MapElementType::PNC_JUNCTION, pnc_junction_table_);
+}
+
+void HDMapImpl::PatchLaneKDTrees(const ElementHandle removed_handle,
+                                 const ElementHandle added_handle) {
+  std::vector<const LaneSegmentBox*> added_segment_boxes;
+  std::vector<const MapElementBox*> added_element_boxes;
+  if (added_handle != kInvalidElementHandle) {
+    const LaneInfo* lane = lane_table_[added_handle].get();
+    for (size_t id = 0; id < lane->segments().size(); ++id) {
+      const auto& segment = lane->segments()[id];
+      const AABox2d box(segment.start(), segment.end());
+      added_lane_segment_boxes_.emplace_back(box, lane, &segment, id,
+                                             static_cast<int>(added_handle));
+      added_segment_boxes.push_back(&added_lane_segment_boxes_.back());
+      added_map_element_boxes_.emplace_back(box, MapElementType::LANE,
+                                            added_handle, &segment);
+      added_element_boxes.push_back(&added_map_element_boxes_.back());
+    }
+  }
+
+  size_t num_removed_segments = 0;
+  lane_segment_kdtree_->Update(
+      [removed_handle, &num_removed_segments](const LaneSegmentBox* box) {
+        if (static_cast<ElementHandle>(box->object_index()) !=
+            removed_handle) {
+          return false;
+        }
+        ++num_removed_segments;
+        return true;
+      },
+      added_segment_boxes);
+  num_patched_lane_segments_ +=
+      num_removed_segments + added_segment_boxes.size();
+  if (num_patched_lane_segments_ >
+      kMaxPatchedLaneSegmentFraction * lane_segment_boxes_.size()) {
+    // Moving the containers keeps the old boxes where they are.
+    retired_lane_segment_boxes_.push_back(std::move(lane_segment_boxes_));
+    retired_added_lane_segment_boxes_.push_back(
+        std::move(added_lane_segment_boxes_));
+    BuildLaneSegmentKDTree(nullptr);
+    BuildMapElementKDTree(nullptr);
+    return;
+  }
+  map_element_kdtree_->Update(
+      [removed_handle](const MapElementBox* box) {
+        return box->type() == MapElementType::LANE &&
+               box->handle() == removed_handle;
+      },
+      added_element_boxes);
+}
+
+int HDMapImpl::SearchElements(
+    const Vec2d& center, const double radius,
+    const MapElementTypeMask type_mask,
+    std::array<std::vector<ElementHandle>, kNumMapElementTypes>* handles)
+    const {
+  if (handles == nullptr || map_element_kdtree_ == nullptr) {
+    return -1;
+  }
+  for (auto& type_handles : *handles) {
+    type_handles.clear();
+  }
+  thread_local std::vector<const MapElementBox*> objects;
+  objects.clear();
+  map_element_kdtree_->GetObjects(
+      center, radius,
+      [type_mask](const MapElementBox* object) {
+        return (type_mask & MapElementTypeBit(object->type())) != 0;
+      },
+      &objects);
+  auto& contexts = ThreadElementContexts();
+  StartElementPasses(&contexts);
+  for (const auto* object : objects) {
+    if (ContextOf(&contexts, *object).Mark(object->handle())) {
+      (*handles)[static_cast<int>(object->type())].push_back(object->handle());
+    }
+  }
+  return 0;
+}
+
+void HDMapImpl::StartElementPasses(
+    std::array<QueryContext, kNumMapElementTypes>* const contexts) const {
+  auto start_pass = [contexts](const MapElementType type,
+                               const size_t num_handles) {
+    (*contexts)[static_cast<int>(type)].StartPass(num_handles);
+  };
+  start_pass(MapElementType::LANE, lane_table_.size());
+  start_pass(MapElementType::JUNCTION, junction_table_.size());
+  start_pass(MapElementType::CROSSWALK, crosswalk_table_.size());
+  start_pass(MapElementType::SIGNAL, signal_table_.size());
+  start_pass(MapElementType::STOP_SIGN, stop_sign_table_.size());
+  start_pass(MapElementType::YIELD_SIGN, yield_sign_table_.size());
+  start_pass(MapElementType::CLEAR_AREA, clear_area_table_.size());
+  start_pass(MapElementType::SPEED_BUMP, speed_bump_table_.size());
+  start_pass(MapElementType::PARKING_SPACE, parking_space_table_.size());
+  start_pass(MapElementType::PNC_JUNCTION, pnc_junction_table_.size());
+}
+
+template <class KDTree, class Table, class Result>
 int HDMapImpl::SearchObjects(const Vec2d& center, const double radius,
-                             const KDTree& kdtree,
-                             std::vector<std::string>* const results) {
-  static std::mutex mutex_search_object;
-  UNIQUE_LOCK_MULTITHREAD(mutex_search_object);
+                             const KDTree& kdtree, const Table& table,
+                             QueryContext* const context,
+                             std::vector<Result>* const results) {
   if (results == nullptr) {
     return -1;
   }
-  auto objects = kdtree.GetObjects(center, radius);
-  std::unordered_set<std::string> result_ids;
-  result_ids.reserve(objects.size());
-  for (const auto* object_ptr : objects) {
-    result_ids.insert(object_ptr->object()->id().id());
-  }
+  // The KD-trees are immutable once the map is loaded, so concurrent queries
+  // need no lock; each thread only keeps its own scratch context.
+  context->StartPass(table.size());
+  kdtree.ForEachObject(center, radius, [&](const auto* object_ptr) {
+    const ElementHandle handle = object_ptr->object_index();
+    if (context->Mark(handle)) {
+      AppendElement(table[handle], results);
+    }
+  });
+  return 0;
+}
 
-  results->reserve(result_ids.size());
-  results->assign(result_ids.begin(), result_ids.end());
+template <class Result>
+int HDMapImpl::SearchRoads(const Vec2d& center, const double radius,
+                           QueryContext* const context,
+                           std::vector<Result>* const roads) const {
+  if (lane_segment_kdtree_ == nullptr) {
+    return -1;
+  }
+  // Lanes and roads share one pass: lane handles are marked as they are,
+  // road handles after all lane handles.
+  const size_t road_offset = lane_table_.size();
+  context->StartPass(road_offset + road_table_.size());
+  lane_segment_kdtree_->ForEachObject(
+      center, radius, [&](const LaneSegmentBox* object_ptr) {
+        if (!context->Mark(object_ptr->object_index())) {
+          return;
+        }
+        const auto& road_id = object_ptr->object()->road_id().id();
+        if (road_id.empty()) {
+          return;
+        }
+        const ElementHandle road_handle = road_table_.Find(road_id);
+        CHECK_NE(road_handle, kInvalidElementHandle);
+        const auto road_mark =
+            static_cast<ElementHandle>(road_offset + road_handle);
+        if (context->Mark(road_mark)) {
+          AppendElement(road_table_[road_handle], roads);
+        }
+      });
   return 0;
 }
 
+void HDMapImpl::CreateArenaMap() {
+  google::protobuf::ArenaOptions options;
+  options.start_block_size = kMapArenaStartBlockSize;
+  options.max_block_size = kMapArenaMaxBlockSize;
+  owned_map_.reset();
+  arena_.reset(new google::protobuf::Arena(options));
+  map_ = google::protobuf::Arena::CreateMessage<Map>(arena_.get());
+}
+
 void HDMapImpl::Clear() {
-  map_.Clear();
   lane_table_.clear();
   junction_table_.clear();
   signal_table_.clear();
   crosswalk_table_.clear();
   stop_sign_table_.clear();
   yield_sign_table_.clear();
+  clear_area_table_.clear();
+  speed_bump_table_.clear();
   overlap_table_.clear();
+  road_table_.clear();
+  parking_space_table_.clear();
+  pnc_junction_table_.clear();
   rsu_table_.clear();
   lane_segment_boxes_.clear();
   lane_segment_kdtree_.reset(nullptr);
@@ -1476,6 +2711,17 @@ void HDMapImpl::Clear() {
   parking_space_polygon_kdtree_.reset(nullptr);
   pnc_junction_polygon_boxes_.clear();
   pnc_junction_polygon_kdtree_.reset(nullptr);
+  map_element_boxes_.clear();
+  map_element_kdtree_.reset(nullptr);
+  added_lane_segment_boxes_.clear();
+  added_map_element_boxes_.clear();
+  num_patched_lane_segments_ = 0;
+  retired_lane_segment_boxes_.clear();
+  retired_added_lane_segment_boxes_.clear();
+  // Last, since the elements refer into the map.
+  map_ = nullptr;
+  owned_map_.reset();
+  arena_.reset();
 }
 
 }  // namespace hdmap
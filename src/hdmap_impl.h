@@ -15,18 +15,26 @@ limitations under the License.
 
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <map>
 #include <memory>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <utility>
 #include <vector>
 
+#include "google/protobuf/arena.h"
+
 #include "math/aabox2d.h"
 #include "math/aaboxkdtree2d.h"
+#include "math/box2d.h"
 #include "math/line_segment2d.h"
 #include "math/polygon2d.h"
 #include "math/vec2d.h"
 #include "hdmap_common.h"
+#include "hdmap_element_table.h"
 #include "map.pb.h"
 #include "map_clear_area.pb.h"
 #include "map_crosswalk.pb.h"
@@ -40,6 +48,7 @@ limitations under the License.
 #include "map_speed_bump.pb.h"
 #include "map_stop_sign.pb.h"
 #include "map_yield_sign.pb.h"
+#include "query_context.h"
 
 /**
  * @namespace apollo::hdmap
@@ -48,46 +57,52 @@ limitations under the License.
 namespace apollo {
 namespace hdmap {
 
+class ThreadPool;
+
 /**
  * @class HDMapImpl
  *
  * @brief High-precision map loader implement.
+ *
+ * Once a map is loaded the const query methods may be called concurrently
+ * from multiple threads, as long as no lanes are being added or removed.
  */
 class HDMapImpl {
  public:
-  using LaneTable = std::unordered_map<std::string, std::shared_ptr<LaneInfo>>;
-  using JunctionTable =
-      std::unordered_map<std::string, std::shared_ptr<JunctionInfo>>;
-  using SignalTable =
-      std::unordered_map<std::string, std::shared_ptr<SignalInfo>>;
-  using CrosswalkTable =
-      std::unordered_map<std::string, std::shared_ptr<CrosswalkInfo>>;
-  using StopSignTable =
-      std::unordered_map<std::string, std::shared_ptr<StopSignInfo>>;
-  using YieldSignTable =
-      std::unordered_map<std::string, std::shared_ptr<YieldSignInfo>>;
-  using ClearAreaTable =
-      std::unordered_map<std::string, std::shared_ptr<ClearAreaInfo>>;
-  using SpeedBumpTable =
-      std::unordered_map<std::string, std::shared_ptr<SpeedBumpInfo>>;
-  using OverlapTable =
-      std::unordered_map<std::string, std::shared_ptr<OverlapInfo>>;
-  using RoadTable = std::unordered_map<std::string, std::shared_ptr<RoadInfo>>;
-  using ParkingSpaceTable =
-      std::unordered_map<std::string, std::shared_ptr<ParkingSpaceInfo>>;
-  using PNCJunctionTable =
-      std::unordered_map<std::string, std::shared_ptr<PNCJunctionInfo>>;
-  using RSUTable =
-      std::unordered_map<std::string, std::shared_ptr<RSUInfo>>;
+  using LaneTable = ElementTable<LaneInfo>;
+  using JunctionTable = ElementTable<JunctionInfo>;
+  using SignalTable = ElementTable<SignalInfo>;
+  using CrosswalkTable = ElementTable<CrosswalkInfo>;
+  using StopSignTable = ElementTable<StopSignInfo>;
+  using YieldSignTable = ElementTable<YieldSignInfo>;
+  using ClearAreaTable = ElementTable<ClearAreaInfo>;
+  using SpeedBumpTable = ElementTable<SpeedBumpInfo>;
+  using OverlapTable = ElementTable<OverlapInfo>;
+  using RoadTable = ElementTable<RoadInfo>;
+  using ParkingSpaceTable = ElementTable<ParkingSpaceInfo>;
+  using PNCJunctionTable = ElementTable<PNCJunctionInfo>;
+  using RSUTable = ElementTable<RSUInfo>;
 
  public:
   /**
-   * @brief load map from local file
+   * @brief load map from local file. With FLAGS_hdmap_use_index_file, the
+   * spatial indices of a proto map file are loaded from
+   * <map_filename>.index if that file was saved for the same map file
+   * content, and are otherwise built and saved there.
    * @param map_filename path of map data file
    * @return 0:success, otherwise failed
    */
   int LoadMapFromFile(const std::string& map_filename);
 
+  /**
+   * @brief load a proto map file, with its spatial indices loaded from
+   * <map_filename>.index, or built and saved there, as LoadMapFromFile does
+   * with FLAGS_hdmap_use_index_file
+   * @param map_filename path of a proto map file
+   * @return 0:success, otherwise failed
+   */
+  int LoadSnapshot(const std::string& map_filename);
+
   /**
    * @brief load map from a protobuf message
    * @param map_proto map data in protobuf format
@@ -95,6 +110,54 @@ class HDMapImpl {
    */
   int LoadMapFromProto(const Map& map_proto);
 
+  /**
+   * @brief load map from a protobuf message without copying it
+   * @param map_proto map data in protobuf format, which the map takes over
+   * and leaves empty
+   * @return 0:success, otherwise failed
+   */
+  int LoadMapFromProto(Map&& map_proto);
+
+  /**
+   * @brief add a lane to the loaded map, or replace the lane with the same
+   * id, updating the spatial indices in place instead of reloading the map.
+   * The lane takes part in queries right away, with the overlaps and roads
+   * that refer to it; the loaded map proto is left as it was. Must not run
+   * concurrently with queries, and LaneTrackers must be reset afterwards.
+   * Elements and lane segments that queries returned before stay valid
+   * until the next map load, including those of a replaced lane, which no
+   * longer take part in queries; the handle of a replaced lane resolves to
+   * nullptr from then on.
+   * @param lane the lane
+   * @return 0:success, otherwise failed
+   */
+  int AddLane(const Lane& lane);
+
+  /**
+   * @brief remove a lane from the loaded map, updating the spatial indices
+   * in place. The same restrictions and guarantees as for AddLane apply.
+   * @param id lane id
+   * @return 0:success, otherwise failed
+   */
+  int RemoveLane(const Id& id);
+
+  /**
+   * @brief get histograms of the work the spatial index queries of each
+   * layer did since the map was loaded, with their costliest query points,
+   * to tell which map regions slow queries come from. They are only kept
+   * when built with APOLLO_HDMAP_KDTREE_STATS.
+   * @param histograms the histograms by layer name, e.g. "lane"
+   * @return 0:success, otherwise failed (including when they are not kept)
+   */
+  int GetKDTreeQueryHistograms(
+      std::map<std::string, apollo::common::math::AABoxKDTreeQueryHistograms>*
+          histograms) const;
+
+  /**
+   * @brief clear the histograms GetKDTreeQueryHistograms returns
+   */
+  void ClearKDTreeQueryHistograms();
+
   LaneInfoConstPtr GetLaneById(const Id& id) const;
   JunctionInfoConstPtr GetJunctionById(const Id& id) const;
   SignalInfoConstPtr GetSignalById(const Id& id) const;
@@ -109,6 +172,20 @@ class HDMapImpl {
   PNCJunctionInfoConstPtr GetPNCJunctionById(const Id& id) const;
   RSUInfoConstPtr GetRSUById(const Id& id) const;
 
+  /**
+   * @brief get the dense handle of a lane, valid until the next map load
+   * @param id lane id
+   * @return the handle, or kInvalidElementHandle if the lane is unknown
+   */
+  ElementHandle GetLaneHandle(const Id& id) const;
+  /**
+   * @brief get a lane by its dense handle in O(1)
+   * @param handle lane handle, may be kInvalidElementHandle
+   * @return the lane, or nullptr if the handle is invalid or its lane was
+   * removed or replaced since
+   */
+  LaneInfoConstPtr GetLaneByHandle(ElementHandle handle) const;
+
   /**
    * @brief get all lanes in certain range
    * @param point the central point of the range
@@ -224,6 +301,246 @@ class HDMapImpl {
   int GetNearestLane(const apollo::common::PointENU& point,
                      LaneInfoConstPtr* nearest_lane, double* nearest_s,
                      double* nearest_l) const;
+  /**
+   * @brief get nearest lane from target point within a distance, which
+   * bounds the search from the start and so is faster off the map or in
+   * sparse areas than filtering the result of the unbounded search
+   * @param point the target point
+   * @param max_distance lanes farther than this are ignored
+   * @param nearest_lane the nearest lane
+   * @param nearest_s the offset from lane start point along lane center line
+   * @param nearest_l the lateral offset from lane center line
+   * @return 0:success, otherwise, failed (including no lane in range).
+   */
+  int GetNearestLane(const apollo::common::PointENU& point,
+                     double max_distance, LaneInfoConstPtr* nearest_lane,
+                     double* nearest_s, double* nearest_l) const;
+  /**
+   * @brief get all lanes in certain range as raw pointers, which stay valid
+   * until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param lanes store all lanes in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetLanes(const apollo::common::PointENU& point, double distance,
+               QueryContext* context,
+               std::vector<const LaneInfo*>* lanes) const;
+  /**
+   * @brief get all junctions in certain range as raw pointers, which stay valid
+   * until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param junctions store all junctions in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetJunctions(const apollo::common::PointENU& point, double distance,
+                   QueryContext* context,
+                   std::vector<const JunctionInfo*>* junctions) const;
+  /**
+   * @brief get all signals in certain range as raw pointers, which stay valid
+   * until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param signals store all signals in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetSignals(const apollo::common::PointENU& point, double distance,
+                 QueryContext* context,
+                 std::vector<const SignalInfo*>* signals) const;
+  /**
+   * @brief get all crosswalks in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param crosswalks store all crosswalks in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetCrosswalks(const apollo::common::PointENU& point, double distance,
+                    QueryContext* context,
+                    std::vector<const CrosswalkInfo*>* crosswalks) const;
+  /**
+   * @brief get all stop signs in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param stop_signs store all stop signs in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetStopSigns(const apollo::common::PointENU& point, double distance,
+                   QueryContext* context,
+                   std::vector<const StopSignInfo*>* stop_signs) const;
+  /**
+   * @brief get all yield signs in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param yield_signs store all yield signs in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetYieldSigns(const apollo::common::PointENU& point, double distance,
+                    QueryContext* context,
+                    std::vector<const YieldSignInfo*>* yield_signs) const;
+  /**
+   * @brief get all clear areas in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param clear_areas store all clear areas in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetClearAreas(const apollo::common::PointENU& point, double distance,
+                    QueryContext* context,
+                    std::vector<const ClearAreaInfo*>* clear_areas) const;
+  /**
+   * @brief get all speed bumps in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param speed_bumps store all speed bumps in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetSpeedBumps(const apollo::common::PointENU& point, double distance,
+                    QueryContext* context,
+                    std::vector<const SpeedBumpInfo*>* speed_bumps) const;
+  /**
+   * @brief get all parking spaces in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param parking_spaces store all parking spaces in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetParkingSpaces(
+      const apollo::common::PointENU& point, double distance,
+      QueryContext* context,
+      std::vector<const ParkingSpaceInfo*>* parking_spaces) const;
+  /**
+   * @brief get all pnc junctions in certain range as raw pointers, which stay
+   * valid until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param pnc_junctions store all pnc junctions in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetPNCJunctions(const apollo::common::PointENU& point, double distance,
+                      QueryContext* context,
+                      std::vector<const PNCJunctionInfo*>* pnc_junctions) const;
+  /**
+   * @brief get all roads in certain range as raw pointers, which stay valid
+   * until the next map load
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param context scratch state reused across queries
+   * @param roads store all roads in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetRoads(const apollo::common::PointENU& point, double distance,
+               QueryContext* context,
+               std::vector<const RoadInfo*>* roads) const;
+  /**
+   * @brief get nearest lane from target point as a raw pointer, which stays
+   * valid until the next map load
+   * @param point the target point
+   * @param nearest_lane the nearest lane
+   * @param nearest_s the offset from lane start point along lane center line
+   * @param nearest_l the lateral offset from lane center line
+   * @return 0:success, otherwise, failed.
+   */
+  int GetNearestLane(const apollo::common::PointENU& point,
+                     const LaneInfo** nearest_lane, double* nearest_s,
+                     double* nearest_l) const;
+  /**
+   * @brief get nearest lane within a distance from target point as a raw
+   * pointer, which stays valid until the next map load
+   * @param point the target point
+   * @param max_distance lanes farther than this are ignored
+   * @param nearest_lane the nearest lane
+   * @param nearest_s the offset from lane start point along lane center line
+   * @param nearest_l the lateral offset from lane center line
+   * @return 0:success, otherwise, failed (including no lane in range).
+   */
+  int GetNearestLane(const apollo::common::PointENU& point,
+                     double max_distance, const LaneInfo** nearest_lane,
+                     double* nearest_s, double* nearest_l) const;
+  /**
+   * @brief get the k nearest distinct lanes to a target point
+   * @param point the target point
+   * @param k the maximum number of lanes to return
+   * @param max_distance lanes farther than this are ignored
+   * @param lanes the nearest lanes, nearest first
+   * @param nearest_s the offset of point along each lane's center line
+   * @param nearest_l the lateral offset of point from each lane's center line
+   * @return 0:success, otherwise, failed (including no lane in range).
+   */
+  int GetKNearestLanes(const apollo::common::PointENU& point, int k,
+                       double max_distance,
+                       std::vector<LaneInfoConstPtr>* lanes,
+                       std::vector<double>* nearest_s,
+                       std::vector<double>* nearest_l) const;
+  /**
+   * @brief get the nearest lane of every point in a batch. Queries are run
+   * in spatial order, each seeded with its neighbour's answer, so results
+   * are the same as calling GetNearestLane point by point.
+   * @param points the target points
+   * @param num_threads number of threads to split the batch across
+   * @param results one projection per point, in input order; lane_handle is
+   * kInvalidElementHandle if no lane was found
+   * @return 0:success, otherwise failed
+   */
+  int GetNearestLaneBatch(
+      const std::vector<apollo::common::math::Vec2d>& points, int num_threads,
+      std::vector<LaneProjection>* results) const;
+  /**
+   * @brief get the nearest lane segment from target point, starting from a
+   * segment known to be close to it, e.g. the answer for a previous nearby
+   * point. Only subtrees that may hold a closer segment are visited, so the
+   * result is the same as GetNearestLane.
+   * @param point the target point
+   * @param seed a segment of this map, or nullptr for no seed; a segment
+   * of a lane removed since counts as no seed
+   * @param nearest_segment the nearest segment
+   * @return 0:success, otherwise failed
+   */
+  int GetNearestLaneSegment(const apollo::common::math::Vec2d& point,
+                            const LaneSegmentBox* seed,
+                            const LaneSegmentBox** nearest_segment) const;
+  /**
+   * @brief get all lane segments in certain range. Segments stay valid
+   * until the next map load.
+   * @param point the central point of the range
+   * @param distance the search radius
+   * @param segments store all lane segments in target range
+   * @return 0:success, otherwise failed
+   */
+  int GetLaneSegments(const apollo::common::math::Vec2d& point,
+                      double distance,
+                      std::vector<const LaneSegmentBox*>* segments) const;
+  /**
+   * @brief get all lanes in certain range of every point in a batch.
+   * Neighbouring points share one wider tree query whose hits are then
+   * filtered per point, so results hold the same lanes as GetLanes.
+   * @param points the central points of the ranges
+   * @param distance the search radius
+   * @param num_threads number of threads to split the batch across
+   * @param lane_handles handles of the lanes in range of each point, in
+   * input order
+   * @return 0:success, otherwise failed
+   */
+  int GetLanesBatch(
+      const std::vector<apollo::common::math::Vec2d>& points, double distance,
+      int num_threads,
+      std::vector<std::vector<ElementHandle>>* lane_handles) const;
   /**
    * @brief get the nearest lane within a certain range by pose
    * @param point the target position
@@ -319,6 +636,72 @@ class HDMapImpl {
   int GetStopSignAssociatedLanes(const Id& id,
                                  std::vector<LaneInfoConstPtr>* lanes) const;
 
+  /**
+   * @brief get all map elements of the given types that overlap a polygon,
+   * in one traversal of the combined index
+   * @param polygon the search region, with at least 3 points
+   * @param type_mask the types to search, built from MapElementTypeBit
+   * @param objects the matching elements grouped by type
+   * @return 0:success, otherwise failed
+   */
+  int GetObjectsInPolygon(const apollo::common::math::Polygon2d& polygon,
+                          const MapElementTypeMask type_mask,
+                          MapObjects* objects) const;
+
+  /**
+   * @brief get all map elements of the given types that overlap a box
+   * @param box the search region
+   * @param type_mask the types to search, built from MapElementTypeBit
+   * @param objects the matching elements grouped by type
+   * @return 0:success, otherwise failed
+   */
+  int GetObjectsInBox(const apollo::common::math::Box2d& box,
+                      const MapElementTypeMask type_mask,
+                      MapObjects* objects) const;
+
+  /**
+   * @brief get all map elements of the given types within distance of a
+   * polyline, in one traversal of the combined index
+   * @param path the polyline; a single point searches a disc
+   * @param distance the search distance on either side of the path
+   * @param type_mask the types to search, built from MapElementTypeBit
+   * @param objects the matching elements grouped by type
+   * @return 0:success, otherwise failed
+   */
+  int GetObjectsAlongPath(const std::vector<apollo::common::math::Vec2d>& path,
+                          const double distance,
+                          const MapElementTypeMask type_mask,
+                          MapObjects* objects) const;
+
+  /**
+   * @brief get all lanes that overlap a polygon
+   * @param polygon the search region, with at least 3 points
+   * @param lanes all lanes that overlap the polygon
+   * @return 0:success, otherwise failed
+   */
+  int GetLanesInPolygon(const apollo::common::math::Polygon2d& polygon,
+                        std::vector<LaneInfoConstPtr>* lanes) const;
+
+  /**
+   * @brief get all lanes that overlap a box
+   * @param box the search region
+   * @param lanes all lanes that overlap the box
+   * @return 0:success, otherwise failed
+   */
+  int GetLanesInBox(const apollo::common::math::Box2d& box,
+                    std::vector<LaneInfoConstPtr>* lanes) const;
+
+  /**
+   * @brief get all lanes within distance of a polyline
+   * @param path the polyline; a single point searches a disc
+   * @param distance the search distance on either side of the path
+   * @param lanes all lanes within distance of the path
+   * @return 0:success, otherwise failed
+   */
+  int GetLanesAlongPath(const std::vector<apollo::common::math::Vec2d>& path,
+                        const double distance,
+                        std::vector<LaneInfoConstPtr>* lanes) const;
+
   /**
    * @brief get a local map which is identical to the origin map except that all
    * map elements without overlap with the given region are deleted.
@@ -368,8 +751,13 @@ class HDMapImpl {
       const apollo::common::math::Vec2d& point, double distance,
       std::vector<PNCJunctionInfoConstPtr>* pnc_junctions) const;
   int GetNearestLane(const apollo::common::math::Vec2d& point,
-                     LaneInfoConstPtr* nearest_lane, double* nearest_s,
-                     double* nearest_l) const;
+                     double max_distance, LaneInfoConstPtr* nearest_lane,
+                     double* nearest_s, double* nearest_l) const;
+  int GetKNearestLanes(const apollo::common::math::Vec2d& point, int k,
+                       double max_distance,
+                       std::vector<LaneInfoConstPtr>* lanes,
+                       std::vector<double>* nearest_s,
+                       std::vector<double>* nearest_l) const;
   int GetNearestLaneWithHeading(const apollo::common::math::Vec2d& point,
                                 const double distance,
                                 const double central_heading,
@@ -383,6 +771,37 @@ class HDMapImpl {
   int GetRoads(const apollo::common::math::Vec2d& point, double distance,
                std::vector<RoadInfoConstPtr>* roads) const;
 
+  // Builds the element tables from map_, and resolves the references between
+  // the elements.
+  void BuildTables();
+  // Builds all spatial indices from the tables.
+  void BuildKDTrees();
+  // Parses the proto map file into map_, and loads the spatial indices from
+  // the index file beside it, or builds and saves them there.
+  int LoadProtoMapWithIndexFile(const std::string& map_filename);
+  // Restores all spatial indices from an index file saved for a map whose
+  // file hashes to map_hash. Returns false if the file is missing, malformed
+  // or was saved for another map; the indices must then be built.
+  bool LoadKDTrees(const std::string& index_filename, uint64_t map_hash);
+  bool SaveKDTrees(const std::string& index_filename, uint64_t map_hash);
+  // Restores all spatial indices from the front of data, which must hold
+  // them and nothing else, in the layout WriteKDTrees() appends them in.
+  bool ReadKDTrees(std::string_view* data);
+  bool WriteKDTrees(std::string* data);
+  // Calls visit(boxes, kdtree) for each map-wide spatial index, in the order
+  // of the index file.
+  template <class Visitor>
+  void VisitKDTrees(const Visitor& visit);
+  // Calls visit(layer name, kdtree) for each map-wide spatial index.
+  template <class Visitor>
+  void VisitNamedKDTrees(const Visitor& visit) const;
+
+  template <class Table, class BoxTable>
+  static void CreateSegmentBoxes(const Table& table, BoxTable* const box_table);
+  template <class Table, class BoxTable>
+  static void CreatePolygonBoxes(const Table& table, BoxTable* const box_table);
+  void CreateMapElementBoxes();
+
   template <class Table, class BoxTable, class KDTree>
   static void BuildSegmentKDTree(
       const Table& table, const apollo::common::math::AABoxKDTreeParams& params,
@@ -393,7 +812,7 @@ class HDMapImpl {
       const Table& table, const apollo::common::math::AABoxKDTreeParams& params,
       BoxTable* const box_table, std::unique_ptr<KDTree>* const kdtree);
 
-  void BuildLaneSegmentKDTree();
+  void BuildLaneSegmentKDTree(ThreadPool* pool);
   void BuildJunctionPolygonKDTree();
   void BuildCrosswalkPolygonKDTree();
   void BuildSignalSegmentKDTree();
@@ -403,16 +822,68 @@ class HDMapImpl {
   void BuildSpeedBumpSegmentKDTree();
   void BuildParkingSpacePolygonKDTree();
   void BuildPNCJunctionPolygonKDTree();
+  void BuildMapElementKDTree(ThreadPool* pool);
 
-  template <class KDTree>
+  void PatchLaneKDTrees(ElementHandle removed_handle,
+                        ElementHandle added_handle);
+  void RefreshLaneHandles();
+
+  template <class KDTree, class Table, class Result>
   static int SearchObjects(const apollo::common::math::Vec2d& center,
                            const double radius, const KDTree& kdtree,
-                           std::vector<std::string>* const results);
+                           const Table& table, QueryContext* const context,
+                           std::vector<Result>* const results);
+
+  /**
+   * @brief collect, in one traversal of the combined index, the handles of
+   * all elements of the given types within radius of center
+   * @param handles one deduplicated handle list per MapElementType
+   * @return 0:success, otherwise failed
+   */
+  int SearchElements(
+      const apollo::common::math::Vec2d& center, const double radius,
+      const MapElementTypeMask type_mask,
+      std::array<std::vector<ElementHandle>, kNumMapElementTypes>* handles)
+      const;
+
+  // Starts a pass of each context, one per MapElementType, over the handles
+  // of the element table of that type.
+  void StartElementPasses(
+      std::array<QueryContext, kNumMapElementTypes>* const contexts) const;
+
+  /**
+   * @brief collect, in one traversal of the combined index, all elements of
+   * the given types that overlap a region
+   * @param region provides MayOverlap(const AABox2d&) and
+   * Overlaps(const MapElementBox*)
+   * @param objects the matching elements grouped by type
+   * @return 0:success, otherwise failed
+   */
+  template <class Region>
+  int SearchElementsInRegion(const Region& region,
+                             const MapElementTypeMask type_mask,
+                             MapObjects* const objects) const;
+
+  void CollectRoads(const std::vector<LaneInfoConstPtr>& lanes,
+                    std::vector<RoadInfoConstPtr>* roads) const;
+  template <class Result>
+  int SearchRoads(const apollo::common::math::Vec2d& center,
+                  const double radius, QueryContext* const context,
+                  std::vector<Result>* const roads) const;
+
+  // Points map_ at a new, empty map on a new arena_.
+  void CreateArenaMap();
 
   void Clear();
 
  private:
-  Map map_;
+  // The loaded map, which the elements refer into. It lives on arena_, so
+  // that its millions of small messages are allocated and freed in a few
+  // large blocks, except for a map moved in by LoadMapFromProto(Map&&),
+  // which owned_map_ keeps as it came.
+  std::unique_ptr<google::protobuf::Arena> arena_;
+  std::unique_ptr<Map> owned_map_;
+  Map* map_ = nullptr;
   LaneTable lane_table_;
   JunctionTable junction_table_;
   CrosswalkTable crosswalk_table_;
@@ -456,6 +927,21 @@ class HDMapImpl {
 
   std::vector<PNCJunctionPolygonBox> pnc_junction_polygon_boxes_;
   std::unique_ptr<PNCJunctionPolygonKDTree> pnc_junction_polygon_kdtree_;
+
+  // Boxes of all the layers above in one index, tagged by element type.
+  std::vector<MapElementBox> map_element_boxes_;
+  std::unique_ptr<MapElementKDTree> map_element_kdtree_;
+
+  // Boxes of the lanes added since the lane segment and map element trees
+  // were built. Deques keep them at fixed addresses as they grow.
+  std::deque<LaneSegmentBox> added_lane_segment_boxes_;
+  std::deque<MapElementBox> added_map_element_boxes_;
+  // Lane segments added to or removed from those trees since they were built.
+  size_t num_patched_lane_segments_ = 0;
+  // The lane segment boxes of lane segment trees since rebuilt, kept until
+  // Clear() since queries handed out pointers to them.
+  std::vector<std::vector<LaneSegmentBox>> retired_lane_segment_boxes_;
+  std::vector<std::deque<LaneSegmentBox>> retired_added_lane_segment_boxes_;
 };
 
 }  // namespace hdmap
@@ -0,0 +1,117 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+#include "lane_tracker.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "math/math_utils.h"
+
+namespace apollo {
+namespace hdmap {
+
+using apollo::common::PointENU;
+using apollo::common::math::kMathEpsilon;
+using apollo::common::math::Square;
+using apollo::common::math::Vec2d;
+
+namespace {
+
+// Segments up to this much farther than the nearest one are cached, in
+// meters. Larger values mean fewer tree searches but longer cache scans.
+constexpr double kCacheMargin = 2.0;
+// Slack for rounding errors in the cache radius, in meters.
+constexpr double kCacheRadiusSlack = 1e-6;
+
+}  // namespace
+
+LaneTracker::LaneTracker(const HDMap* hdmap) : hdmap_(CHECK_NOTNULL(hdmap)) {}
+
+int LaneTracker::GetNearestLane(const PointENU& point,
+                                LaneInfoConstPtr* nearest_lane,
+                                double* nearest_s, double* nearest_l) {
+  CHECK_NOTNULL(nearest_lane);
+  CHECK_NOTNULL(nearest_s);
+  CHECK_NOTNULL(nearest_l);
+  const Vec2d xy(point.x(), point.y());
+
+  const LaneSegmentBox* segment = nullptr;
+  if (GetNearestCachedSegment(xy, &segment)) {
+    ++num_warm_hits_;
+  } else {
+    if (hdmap_->GetNearestLaneSegment(xy, last_segment_, &segment) != 0) {
+      Reset();
+      return -1;
+    }
+    anchor_ = xy;
+    radius_ = segment->DistanceTo(xy) + kCacheMargin;
+    if (hdmap_->GetLaneSegments(anchor_, radius_, &cached_segments_) != 0) {
+      cached_segments_.clear();
+    }
+  }
+  ++num_queries_;
+  last_segment_ = segment;
+
+  *nearest_lane = hdmap_->GetLaneByHandle(segment->object_index());
+  segment->object()->GetSegmentProjection(xy, segment->id(), nearest_s,
+                                          nearest_l);
+  return 0;
+}
+
+void LaneTracker::Reset() {
+  last_segment_ = nullptr;
+  radius_ = 0.0;
+  cached_segments_.clear();
+}
+
+bool LaneTracker::GetNearestCachedSegment(
+    const Vec2d& point, const LaneSegmentBox** nearest_segment) const {
+  if (cached_segments_.empty()) {
+    return false;
+  }
+  // Segments left out of the cache are at least this far from point.
+  const double uncached_distance =
+      radius_ - point.DistanceTo(anchor_) - kCacheRadiusSlack;
+  if (uncached_distance <= 0.0) {
+    return false;
+  }
+
+  const LaneSegmentBox* nearest = nullptr;
+  double min_distance_sqr = std::numeric_limits<double>::infinity();
+  double second_distance_sqr = std::numeric_limits<double>::infinity();
+  for (const auto* segment : cached_segments_) {
+    const double distance_sqr = segment->DistanceSquareTo(point);
+    if (distance_sqr < min_distance_sqr) {
+      second_distance_sqr = min_distance_sqr;
+      min_distance_sqr = distance_sqr;
+      nearest = segment;
+    } else if (distance_sqr < second_distance_sqr) {
+      second_distance_sqr = distance_sqr;
+    }
+  }
+  // The tree search prunes with a tolerance of kMathEpsilon, so it only
+  // certainly returns the nearest segment if that one is nearest by a wider
+  // margin than that; leave closer races to the tree.
+  const double runner_up_sqr =
+      std::min(second_distance_sqr, Square(uncached_distance));
+  if (min_distance_sqr + 2.0 * kMathEpsilon >= runner_up_sqr) {
+    return false;
+  }
+  *nearest_segment = nearest;
+  return true;
+}
+
+}  // namespace hdmap
+}  // namespace apollo
@@ -0,0 +1,92 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "hdmap.h"
+
+/**
+ * @namespace apollo::hdmap
+ * @brief apollo::hdmap
+ */
+namespace apollo {
+namespace hdmap {
+
+/**
+ * @class LaneTracker
+ *
+ * @brief Nearest-lane lookups for a stream of nearby points, such as the
+ * poses of one vehicle.
+ *
+ * After each tree search the tracker caches every lane segment, of any
+ * lane, within a radius of the query point: the distance to the nearest
+ * segment plus a margin of a couple of meters. A following point is
+ * answered by scanning that cache while the cache provably holds its
+ * nearest segment, i.e. while the point is far enough inside the cached
+ * disc and no other segment ties with the nearest one. Otherwise it takes a
+ * tree search seeded with the last answer, which refills the cache. Results
+ * are therefore always the same as HDMap::GetNearestLane.
+ *
+ * A tracker is not thread-safe; use one per stream of points, and Reset() it
+ * after the map is reloaded.
+ */
+class LaneTracker {
+ public:
+  /**
+   * @brief create a tracker on a loaded map, which must outlive it.
+   * @param hdmap the map to query
+   */
+  explicit LaneTracker(const HDMap* hdmap);
+
+  /**
+   * @brief get nearest lane from target point.
+   * @param point the target point
+   * @param nearest_lane the nearest lane
+   * @param nearest_s the offset from lane start point along lane center line
+   * @param nearest_l the lateral offset from lane center line
+   * @return 0:success, otherwise, failed.
+   */
+  int GetNearestLane(const apollo::common::PointENU& point,
+                     LaneInfoConstPtr* nearest_lane, double* nearest_s,
+                     double* nearest_l);
+
+  /// Forget the tracked segments.
+  void Reset();
+
+  /// Number of successful queries so far.
+  uint64_t num_queries() const { return num_queries_; }
+  /// Number of queries answered from the cached segments, without a tree
+  /// search.
+  uint64_t num_warm_hits() const { return num_warm_hits_; }
+
+ private:
+  bool GetNearestCachedSegment(const apollo::common::math::Vec2d& point,
+                               const LaneSegmentBox** nearest_segment) const;
+
+  const HDMap* hdmap_ = nullptr;
+  const LaneSegmentBox* last_segment_ = nullptr;
+  // All lane segments within radius_ of anchor_.
+  apollo::common::math::Vec2d anchor_;
+  double radius_ = 0.0;
+  std::vector<const LaneSegmentBox*> cached_segments_;
+  uint64_t num_queries_ = 0;
+  uint64_t num_warm_hits_ = 0;
+};
+
+}  // namespace hdmap
+}  // namespace apollo
@@ -16,17 +16,30 @@
 
 /**
  * @file
- * @brief Defines the templated AABoxKDTree2dNode class.
+ * @brief Defines the templated AABoxKDTree2d class.
  */
 
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "math/aabox2d.h"
+#include "math/line_segment2d.h"
+#include "math/line_segment2d_batch.h"
 #include "math/math_utils.h"
 #include "log.h"
 
@@ -38,6 +51,22 @@ namespace apollo {
 namespace common {
 namespace math {
 
+/**
+ * @brief How AABoxKDTree2d chooses the partition of a node. Objects that
+ *        straddle the partition stay at the node, where every query reaching
+ *        the node tests them.
+ */
+enum class AABoxKDTreeSplit {
+  /// The middle of the node's longer axis.
+  MIDPOINT,
+  /// The median of the objects' centers along the node's longer axis.
+  OBJECT_MEDIAN,
+  /// The position, along either axis, that minimizes the expected number of
+  /// objects a query tests: all straddling objects, plus those of each child
+  /// weighted by the child's half perimeter relative to the node's.
+  SURFACE_AREA,
+};
+
 /**
  * @class AABoxKDTreeParams
  * @brief Contains parameters of axis-aligned bounding box.
@@ -49,57 +78,206 @@ struct AABoxKDTreeParams {
   int max_leaf_size = -1;
   /// The maximum dimension size of leaf node.
   double max_leaf_dimension = -1.0;
+  /// How nodes are partitioned.
+  AABoxKDTreeSplit split = AABoxKDTreeSplit::MIDPOINT;
+  /// Whether the sort keys and segment copies are stored as floats relative
+  /// to the middle of their node, for about half their memory. Queries then
+  /// rule objects in or out on float distances and compute the exact
+  /// distance of the rest, so they return the same as without it.
+  bool compact = false;
+  /// If set, runs task(0), ..., task(num_tasks - 1), possibly concurrently,
+  /// and returns once all of them are done. Large subtrees are then built as
+  /// separate tasks; the tree is the same as without it.
+  std::function<void(int num_tasks, const std::function<void(int)> &task)>
+      parallel_for;
+};
+
+/**
+ * @class AABoxKDTreeStats
+ * @brief The shape of an AABoxKDTree2d.
+ */
+struct AABoxKDTreeStats {
+  int num_nodes = 0;
+  int num_leaves = 0;
+  /// The depth of the deepest leaf; the root is at depth 0.
+  int depth = 0;
+  int num_objects = 0;
+  /// Objects kept at nodes with children because they straddle the
+  /// partition.
+  int num_straddling_objects = 0;
+  /// The most objects at one leaf.
+  int max_leaf_size = 0;
+  /// The memory of the nodes, object arrays, sort keys and segment copies,
+  /// not counting the objects themselves.
+  size_t num_bytes = 0;
+};
+
+/**
+ * @class AABoxKDTreeQueryCost
+ * @brief The work one query does on an AABoxKDTree2d.
+ */
+struct AABoxKDTreeQueryCost {
+  /// Nodes whose bounds were tested.
+  int nodes_visited = 0;
+  /// Objects considered for the result, whether or not they are in it.
+  int objects_tested = 0;
+  /// Distances computed from the query point to objects, float ones in
+  /// compact mode included.
+  int distances_computed = 0;
+  /// Subtrees wholly in range, whose objects were taken without tests.
+  int subtrees_copied = 0;
+};
+
+/**
+ * @class AABoxKDTreeQueryHistograms
+ * @brief Histograms of the work the queries on an AABoxKDTree2d did, kept
+ *        only when built with APOLLO_HDMAP_KDTREE_STATS.
+ */
+struct AABoxKDTreeQueryHistograms {
+  /// Bucket 0 counts the queries with a count of 0, and bucket i > 0 those
+  /// with a count in [2^(i-1), 2^i). The last bucket also takes the rest.
+  static constexpr int kNumBuckets = 24;
+  using Histogram = std::array<int64_t, kNumBuckets>;
+
+  /// The number of costliest queries kept.
+  static constexpr size_t kNumCostliestQueries = 16;
+
+  struct Query {
+    Vec2d point;
+    AABoxKDTreeQueryCost cost;
+  };
+
+  /// Queries around a point; region queries are not counted.
+  int64_t num_queries = 0;
+  Histogram nodes_visited = {};
+  Histogram objects_tested = {};
+  Histogram distances_computed = {};
+  Histogram subtrees_copied = {};
+  /// The queries that visited the most nodes and tested the most objects,
+  /// costliest first, to find the map regions behind slow queries.
+  std::vector<Query> costliest_queries;
+
+  static int Bucket(const int count) {
+    int bucket = 0;
+    while (bucket + 1 < kNumBuckets && count >= (1 << bucket)) {
+      ++bucket;
+    }
+    return bucket;
+  }
+
+  void Add(const Vec2d &point, const AABoxKDTreeQueryCost &cost) {
+    ++num_queries;
+    ++nodes_visited[Bucket(cost.nodes_visited)];
+    ++objects_tested[Bucket(cost.objects_tested)];
+    ++distances_computed[Bucket(cost.distances_computed)];
+    ++subtrees_copied[Bucket(cost.subtrees_copied)];
+    auto costlier = [](const Query &query1, const Query &query2) {
+      return query1.cost.nodes_visited + query1.cost.objects_tested >
+             query2.cost.nodes_visited + query2.cost.objects_tested;
+    };
+    const Query query = {point, cost};
+    if (costliest_queries.size() == kNumCostliestQueries) {
+      if (!costlier(query, costliest_queries.back())) {
+        return;
+      }
+      costliest_queries.pop_back();
+    }
+    costliest_queries.insert(
+        std::upper_bound(costliest_queries.begin(), costliest_queries.end(),
+                         query, costlier),
+        query);
+  }
 };
 
+#ifdef APOLLO_HDMAP_KDTREE_STATS
+#define APOLLO_HDMAP_KDTREE_COUNT(counter, count) \
+  (ThreadQueryCost().counter += (count))
+#else
+#define APOLLO_HDMAP_KDTREE_COUNT(counter, count) static_cast<void>(0)
+#endif
+
+/**
+ * @brief Whether ObjectType is a line segment exposed through geo_object(),
+ *        in which case AABoxKDTree2d computes distances to it in batches.
+ */
+template <class ObjectType, class = void>
+struct IsLineSegmentObject : std::false_type {};
+
+template <class ObjectType>
+struct IsLineSegmentObject<
+    ObjectType,
+    std::enable_if_t<std::is_same<
+        decltype(std::declval<const ObjectType &>().geo_object()),
+        const LineSegment2d *>::value>> : std::true_type {};
+
 /**
- * @class AABoxKDTree2dNode
- * @brief The class of KD-tree node of axis-aligned bounding box.
+ * @class AABoxKDTree2d
+ * @brief The class of KD-tree of Aligned Axis Bounding Box(AABox).
+ *
+ * The nodes are stored in one array in preorder and refer to their children
+ * by index. Each node owns a contiguous range of two shared object arrays, one
+ * sorted by the lower and one by the upper bound along the node's partition
+ * axis, with the bounds stored alongside. Since a node's range is followed by
+ * the ranges of its subtree, every subtree owns one contiguous range as well.
+ * Queries walk the array with an explicit stack. Line segment objects are
+ * also copied into a LineSegment2dBatch, so that scans compute the distances
+ * to several of them at once.
+ *
+ * Given AABoxKDTreeParams::parallel_for, the top of the tree is partitioned
+ * first, the subtrees below it are built concurrently into trees of their
+ * own, and those are then spliced in at the positions a serial build would
+ * have given them.
+ *
+ * Update() removes and adds objects in place, keeping the partitions; see
+ * there for how that affects queries.
+ *
+ * Serialize() saves a built tree, referring to its objects by their indices
+ * in the vector it was built from, and Deserialize() restores it from the
+ * same vector without partitioning or sorting anything.
+ *
+ * In compact mode (AABoxKDTreeParams::compact) the sort keys are floats
+ * relative to the middle of their node, rounded outwards, and the segment
+ * copies are a CompactLineSegment2dBatch relative to the same point. The
+ * keys thus stop scans no earlier than the exact ones, and scans decide on
+ * float distances widened by their error, computing the exact distance only
+ * of the objects too close to call.
  */
 template <class ObjectType>
-class AABoxKDTree2dNode {
+class AABoxKDTree2d {
  public:
   using ObjectPtr = const ObjectType *;
+
   /**
-   * @brief Constructor which takes a vector of objects,
-   *        parameters and depth of the node.
-   * @param objects Objects to build the KD-tree node.
+   * @brief Constructor which takes a vector of objects and parameters.
    * @param params Parameters to build the KD-tree.
-   * @param depth Depth of the KD-tree node.
    */
-  AABoxKDTree2dNode(const std::vector<ObjectPtr> &objects,
-                    const AABoxKDTreeParams &params, int depth)
-      : depth_(depth) {
-    ACHECK(!objects.empty());
-
-    ComputeBoundary(objects);
-    ComputePartition();
-
-    if (SplitToSubNodes(objects, params)) {
-      std::vector<ObjectPtr> left_subnode_objects;
-      std::vector<ObjectPtr> right_subnode_objects;
-      PartitionObjects(objects, &left_subnode_objects, &right_subnode_objects);
-
-      // Split to sub-nodes.
-      if (!left_subnode_objects.empty()) {
-        left_subnode_.reset(new AABoxKDTree2dNode<ObjectType>(
-            left_subnode_objects, params, depth + 1));
+  AABoxKDTree2d(const std::vector<ObjectType> &objects,
+                const AABoxKDTreeParams &params) {
+    if (!objects.empty()) {
+      std::vector<ObjectPtr> object_ptrs;
+      object_ptrs.reserve(objects.size());
+      for (const auto &object : objects) {
+        object_ptrs.push_back(&object);
       }
-      if (!right_subnode_objects.empty()) {
-        right_subnode_.reset(new AABoxKDTree2dNode<ObjectType>(
-            right_subnode_objects, params, depth + 1));
+      ReserveObjects(object_ptrs.size());
+      if (params.parallel_for && object_ptrs.size() > kMinSubtreeTaskSize) {
+        BuildInParallel(object_ptrs, params);
+      } else {
+        BuildNode(object_ptrs, params, 0);
+      }
+      if (params.compact) {
+        Compact();
       }
-    } else {
-      InitObjects(objects);
     }
   }
 
   /**
-   * @brief Get the nearest object to a target point by the KD-tree
-   *        rooted at this node.
+   * @brief Get the nearest object to a target point.
    * @param point The target point. Search it's nearest object.
    * @return The nearest object to the target point.
    */
   ObjectPtr GetNearestObject(const Vec2d &point) const {
+    const QueryScope query_scope(*this, point);
     ObjectPtr nearest_object = nullptr;
     double min_distance_sqr = std::numeric_limits<double>::infinity();
     GetNearestObjectInternal(point, &min_distance_sqr, &nearest_object);
@@ -107,8 +285,107 @@ class AABoxKDTree2dNode {
   }
 
   /**
-   * @brief Get objects within a distance to a point by the KD-tree
-   *        rooted at this node.
+   * @brief Get the nearest object to a target point within a distance. The
+   *        distance bounds the search from the start, so a point far from
+   *        every object, such as one off the map, visits few subtrees.
+   * @param point The target point. Search it's nearest object.
+   * @param max_distance Objects farther than this are ignored.
+   * @return The nearest object to the target point, or nullptr if there is
+   *         none within max_distance.
+   */
+  ObjectPtr GetNearestObject(const Vec2d &point,
+                             const double max_distance) const {
+    // The slack keeps an object at max_distance above the pruning threshold
+    // used by GetNearestObjectInternal, as for a seed.
+    const QueryScope query_scope(*this, point);
+    const double max_distance_sqr = Square(max_distance);
+    ObjectPtr nearest_object = nullptr;
+    double min_distance_sqr = max_distance_sqr + 2.0 * kMathEpsilon;
+    GetNearestObjectInternal(point, &min_distance_sqr, &nearest_object);
+    return min_distance_sqr <= max_distance_sqr ? nearest_object : nullptr;
+  }
+
+  /**
+   * @brief Get the nearest object to a target point, starting from a seed
+   *        object such as the answer for a neighbouring point. The seed's
+   *        distance bounds the search, so only subtrees that may hold a
+   *        closer object are visited.
+   * @param point The target point. Search it's nearest object.
+   * @param seed A known object of this tree, or nullptr for no seed.
+   * @return The nearest object to the target point.
+   */
+  ObjectPtr GetNearestObject(const Vec2d &point, ObjectPtr seed) const {
+    if (seed == nullptr) {
+      return GetNearestObject(point);
+    }
+    const QueryScope query_scope(*this, point);
+    // The slack keeps the seed's own leaf above the pruning threshold used by
+    // GetNearestObjectInternal, so the answer matches an unseeded search.
+    APOLLO_HDMAP_KDTREE_COUNT(distances_computed, 1);
+    ObjectPtr nearest_object = nullptr;
+    double min_distance_sqr =
+        seed->DistanceSquareTo(point) + 2.0 * kMathEpsilon;
+    GetNearestObjectInternal(point, &min_distance_sqr, &nearest_object);
+    return nearest_object == nullptr ? seed : nearest_object;
+  }
+
+  /**
+   * @brief Get the k nearest objects with distinct owners (object_index()),
+   *        using a best-first traversal.
+   * @param point The target point.
+   * @param k The maximum number of objects to return.
+   * @param max_distance Objects farther than this are ignored.
+   * @param num_owners One past the largest object_index() of the objects.
+   * @return Up to k objects, nearest first; each is the nearest object of
+   *         its owner.
+   */
+  std::vector<ObjectPtr> GetKNearestObjects(const Vec2d &point, const int k,
+                                            const double max_distance,
+                                            const int num_owners) const {
+    std::vector<ObjectPtr> result_objects;
+    if (k <= 0) {
+      return result_objects;
+    }
+    const QueryScope query_scope(*this, point);
+    VisitNearestOwners(point, max_distance, num_owners, k,
+                       [&](ObjectPtr object) {
+                         result_objects.push_back(object);
+                         return false;
+                       });
+    return result_objects;
+  }
+
+  /**
+   * @brief Get the nearest object whose owner (object_index()) passes a
+   *        filter, using a best-first traversal. Each owner is judged once,
+   *        on its nearest object.
+   * @param point The target point.
+   * @param max_distance Objects farther than this are ignored.
+   * @param num_owners One past the largest object_index() of the objects.
+   * @param filter Callable taking an owner's nearest ObjectPtr and returning
+   *        true to accept the owner.
+   * @return The nearest object of the nearest accepted owner, or nullptr.
+   */
+  template <class Filter>
+  ObjectPtr GetNearestAcceptedObject(const Vec2d &point,
+                                     const double max_distance,
+                                     const int num_owners,
+                                     const Filter &filter) const {
+    const QueryScope query_scope(*this, point);
+    ObjectPtr nearest_object = nullptr;
+    VisitNearestOwners(point, max_distance, num_owners, num_owners,
+                       [&](ObjectPtr object) {
+                         if (!filter(object)) {
+                           return false;
+                         }
+                         nearest_object = object;
+                         return true;
+                       });
+    return nearest_object;
+  }
+
+  /**
+   * @brief Get objects within a distance to a point.
    * @param point The center point of the range to search objects.
    * @param distance The radius of the range to search objects.
    * @return All objects within the specified distance to the specified point.
@@ -116,354 +393,1587 @@ class AABoxKDTree2dNode {
   std::vector<ObjectPtr> GetObjects(const Vec2d &point,
                                     const double distance) const {
     std::vector<ObjectPtr> result_objects;
-    GetObjectsInternal(point, distance, Square(distance), &result_objects);
+    GetObjects(point, distance, &result_objects);
     return result_objects;
   }
 
+  /**
+   * @brief Get objects within a distance to a point, appending them to a
+   *        caller-owned buffer so that repeated queries can reuse it.
+   * @param point The center point of the range to search objects.
+   * @param distance The radius of the range to search objects.
+   * @param result_objects The buffer to append the found objects to.
+   */
+  void GetObjects(const Vec2d &point, const double distance,
+                  std::vector<ObjectPtr> *const result_objects) const {
+    GetObjects(point, distance, AcceptAll(), result_objects);
+  }
+
+  /**
+   * @brief Get objects accepted by a filter within a distance to a point,
+   *        appending them to a caller-owned buffer. The filter runs before
+   *        the distance test, so apart from line segments, whose distances
+   *        are computed in batches, rejected objects cost no distance
+   *        computation.
+   * @param point The center point of the range to search objects.
+   * @param distance The radius of the range to search objects.
+   * @param filter Callable taking an ObjectPtr and returning true to keep it.
+   * @param result_objects The buffer to append the found objects to.
+   */
+  template <class Filter>
+  void GetObjects(const Vec2d &point, const double distance,
+                  const Filter &filter,
+                  std::vector<ObjectPtr> *const result_objects) const {
+    const QueryScope query_scope(*this, point);
+    GetObjectsInternal(point, distance, filter,
+                       [result_objects](ObjectPtr object) {
+                         result_objects->push_back(object);
+                       });
+  }
+
+  /**
+   * @brief Call a visitor on each object within a distance to a point, in
+   *        the order GetObjects would return them, without buffering them.
+   * @param point The center point of the range to search objects.
+   * @param distance The radius of the range to search objects.
+   * @param visitor Callable taking an ObjectPtr.
+   */
+  template <class Visitor>
+  void ForEachObject(const Vec2d &point, const double distance,
+                     const Visitor &visitor) const {
+    const QueryScope query_scope(*this, point);
+    GetObjectsInternal(point, distance, AcceptAll(), visitor);
+  }
+
+  /**
+   * @brief Call a visitor on each object accepted by a filter that overlaps a
+   *        region, traversing the tree once.
+   * @param region The region. It provides MayOverlap(const AABox2d &), a
+   *        conservative test used to skip subtrees and objects, and
+   *        Overlaps(ObjectPtr), the exact test for an object.
+   * @param filter Callable taking an ObjectPtr and returning true to keep it.
+   *        It runs before the exact test.
+   * @param visitor Callable taking an ObjectPtr.
+   */
+  template <class Region, class Filter, class Visitor>
+  void ForEachObjectInRegion(const Region &region, const Filter &filter,
+                             const Visitor &visitor) const {
+    if (nodes_.empty()) {
+      return;
+    }
+    TraversalStack stack;
+    stack.push(0);
+    while (!stack.empty()) {
+      const Node &node = nodes_[stack.pop()];
+      if (!region.MayOverlap(GetBoundingBox(node))) {
+        continue;
+      }
+      for (int i = node.objects_begin; i < node.objects_end; ++i) {
+        ObjectPtr object = objects_sorted_by_min_[i];
+        if (filter(object) && region.MayOverlap(object->aabox()) &&
+            region.Overlaps(object)) {
+          visitor(object);
+        }
+      }
+      PushChildren(node, &stack);
+    }
+  }
+
   /**
    * @brief Get the axis-aligned bounding box of the objects.
    * @return The axis-aligned bounding box of the objects.
    */
   AABox2d GetBoundingBox() const {
-    return AABox2d({min_x_, min_y_}, {max_x_, max_y_});
+    return nodes_.empty() ? AABox2d() : GetBoundingBox(nodes_.front());
+  }
+
+  /**
+   * @brief Remove and add objects in place, without rebuilding the tree.
+   *        The partitions stay as they are: an added object goes to the
+   *        deepest node it lies on one side of every partition above, and
+   *        the nodes on the way grow to cover it. Queries thus slow down as
+   *        more objects change, so rebuild the tree once a sizable fraction
+   *        of them has.
+   * @param removed Callable taking an ObjectPtr and returning true for the
+   *        objects to remove.
+   * @param added_objects The objects to add. Like the objects the tree is
+   *        built from, they must outlive the tree.
+   */
+  template <class Removed>
+  void Update(const Removed &removed,
+              const std::vector<ObjectPtr> &added_objects) {
+    const bool compact = compact_;
+    if (compact) {
+      RestoreSortKeys();
+    }
+    if (nodes_.empty()) {
+      if (added_objects.empty()) {
+        return;
+      }
+      Node root;
+      ComputeBoundary(added_objects, &root);
+      ComputePartition(added_objects, AABoxKDTreeParams(), &root);
+      nodes_.push_back(root);
+    }
+    // The objects each node gains.
+    std::vector<std::vector<ObjectPtr>> node_added_objects(nodes_.size());
+    for (ObjectPtr object : added_objects) {
+      node_added_objects[AddToNode(object)].push_back(object);
+    }
+
+    std::vector<ObjectPtr> old_sorted_by_min;
+    std::vector<ObjectPtr> old_sorted_by_max;
+    std::vector<double> old_sorted_by_min_bound;
+    std::vector<double> old_sorted_by_max_bound;
+    std::vector<int> old_sorted_by_max_index;
+    old_sorted_by_min.swap(objects_sorted_by_min_);
+    old_sorted_by_max.swap(objects_sorted_by_max_);
+    old_sorted_by_min_bound.swap(objects_sorted_by_min_bound_);
+    old_sorted_by_max_bound.swap(objects_sorted_by_max_bound_);
+    old_sorted_by_max_index.swap(objects_sorted_by_max_index_);
+    segments_ = LineSegment2dBatch();
+    ReserveObjects(old_sorted_by_min.size() + added_objects.size());
+
+    // Lay the nodes out again in preorder. Nodes that keep all their objects
+    // and gain none are copied; the others are sorted anew.
+    std::vector<ObjectPtr> objects;
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+      Node &node = nodes_[i];
+      objects.clear();
+      for (int j = node.objects_begin; j < node.objects_end; ++j) {
+        if (!removed(old_sorted_by_min[j])) {
+          objects.push_back(old_sorted_by_min[j]);
+        }
+      }
+      const int num_objects = node.objects_end - node.objects_begin;
+      if (static_cast<int>(objects.size()) < num_objects ||
+          !node_added_objects[i].empty()) {
+        objects.insert(objects.end(), node_added_objects[i].begin(),
+                       node_added_objects[i].end());
+        InitObjects(objects, &node);
+        continue;
+      }
+      const int begin = static_cast<int>(objects_sorted_by_min_.size());
+      for (int j = node.objects_begin; j < node.objects_end; ++j) {
+        objects_sorted_by_min_.push_back(old_sorted_by_min[j]);
+        objects_sorted_by_max_.push_back(old_sorted_by_max[j]);
+        objects_sorted_by_min_bound_.push_back(old_sorted_by_min_bound[j]);
+        objects_sorted_by_max_bound_.push_back(old_sorted_by_max_bound[j]);
+        if constexpr (kLineSegmentObjects) {
+          segments_.Append(*old_sorted_by_min[j]->geo_object());
+          objects_sorted_by_max_index_.push_back(
+              old_sorted_by_max_index[j] - node.objects_begin + begin);
+        }
+      }
+      node.objects_begin = begin;
+      node.objects_end = begin + num_objects;
+    }
+    // Children come after their parent.
+    for (size_t i = nodes_.size(); i-- > 0;) {
+      Node &node = nodes_[i];
+      node.subtree_end = node.objects_end;
+      for (const int child : {node.left_subnode, node.right_subnode}) {
+        if (child >= 0) {
+          node.subtree_end =
+              std::max(node.subtree_end, nodes_[child].subtree_end);
+        }
+      }
+    }
+    if (compact) {
+      Compact();
+    }
+  }
+
+  /**
+   * @brief Serialize the tree: its nodes and the order of its objects, which
+   *        are saved as their indices in objects. The sort keys and segment
+   *        copies are not saved, since they follow from the objects.
+   * @param objects The objects the tree was built from.
+   * @param data The string to append the tree to.
+   * @return false if the tree holds objects that are not in objects, as it
+   *         does once Update() has added some; data is then unchanged.
+   */
+  bool Serialize(const std::vector<ObjectType> &objects,
+                 std::string *const data) const {
+    const size_t num_objects = objects_sorted_by_min_.size();
+    std::vector<uint32_t> indices;
+    indices.reserve(2 * num_objects);
+    for (const auto *sorted : {&objects_sorted_by_min_,
+                               &objects_sorted_by_max_}) {
+      for (ObjectPtr object : *sorted) {
+        if (object < objects.data() ||
+            object >= objects.data() + objects.size()) {
+          return false;
+        }
+        indices.push_back(static_cast<uint32_t>(object - objects.data()));
+      }
+    }
+    AppendValue(static_cast<uint32_t>(nodes_.size()), data);
+    for (const Node &node : nodes_) {
+      for (const double value :
+           {node.min_x, node.max_x, node.min_y, node.max_y, node.mid_x,
+            node.mid_y, node.partition_position}) {
+        AppendValue(value, data);
+      }
+      for (const int value :
+           {static_cast<int>(node.partition), node.left_subnode,
+            node.right_subnode, node.objects_begin, node.objects_end,
+            node.subtree_end}) {
+        AppendValue(static_cast<int32_t>(value), data);
+      }
+    }
+    AppendValue(static_cast<uint32_t>(num_objects), data);
+    data->append(reinterpret_cast<const char *>(indices.data()),
+                 indices.size() * sizeof(uint32_t));
+    return true;
+  }
+
+  /**
+   * @brief Restore a tree saved by Serialize().
+   * @param objects The objects the saved tree was built from, at the same
+   *        addresses the restored tree is to use.
+   * @param params Only params.compact is used, since the partitions are
+   *        restored rather than computed.
+   * @param data The saved tree at its front; it is consumed.
+   * @return The tree, or nullptr if data does not hold a tree of objects.
+   */
+  static std::unique_ptr<AABoxKDTree2d> Deserialize(
+      const std::vector<ObjectType> &objects, const AABoxKDTreeParams &params,
+      std::string_view *const data) {
+    std::unique_ptr<AABoxKDTree2d> tree(new AABoxKDTree2d());
+    uint32_t num_nodes = 0;
+    if (!ReadValue(data, &num_nodes) ||
+        num_nodes > data->size() / kSerializedNodeSize) {
+      return nullptr;
+    }
+    tree->nodes_.resize(num_nodes);
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+      Node &node = tree->nodes_[i];
+      int32_t values[6];
+      for (double *value :
+           {&node.min_x, &node.max_x, &node.min_y, &node.max_y, &node.mid_x,
+            &node.mid_y, &node.partition_position}) {
+        ReadValue(data, value);
+      }
+      for (int32_t &value : values) {
+        ReadValue(data, &value);
+      }
+      if (values[0] != PARTITION_X && values[0] != PARTITION_Y) {
+        return nullptr;
+      }
+      node.partition = static_cast<Partition>(values[0]);
+      node.left_subnode = values[1];
+      node.right_subnode = values[2];
+      node.objects_begin = values[3];
+      node.objects_end = values[4];
+      node.subtree_end = values[5];
+      for (const int child : {node.left_subnode, node.right_subnode}) {
+        if (child != -1 && (child <= static_cast<int>(i) ||
+                            child >= static_cast<int>(num_nodes))) {
+          return nullptr;
+        }
+      }
+      if (node.objects_begin < 0 || node.objects_begin > node.objects_end ||
+          node.objects_end > node.subtree_end ||
+          node.subtree_end > static_cast<int>(objects.size())) {
+        return nullptr;
+      }
+    }
+    uint32_t num_objects = 0;
+    if (!ReadValue(data, &num_objects) || num_objects != objects.size() ||
+        data->size() / sizeof(uint32_t) < 2 * size_t{num_objects}) {
+      return nullptr;
+    }
+    std::vector<uint32_t> indices(2 * size_t{num_objects});
+    std::memcpy(indices.data(), data->data(),
+                indices.size() * sizeof(uint32_t));
+    data->remove_prefix(indices.size() * sizeof(uint32_t));
+    for (const uint32_t index : indices) {
+      if (index >= num_objects) {
+        return nullptr;
+      }
+    }
+
+    tree->ReserveObjects(num_objects);
+    // Where each object is in objects_sorted_by_min_.
+    std::vector<int> min_order_index(kLineSegmentObjects ? num_objects : 0);
+    for (const Node &node : tree->nodes_) {
+      // The nodes must cover the objects one after another, in preorder.
+      if (node.objects_begin !=
+          static_cast<int>(tree->objects_sorted_by_min_.size())) {
+        return nullptr;
+      }
+      for (int i = node.objects_begin; i < node.objects_end; ++i) {
+        tree->objects_sorted_by_min_.push_back(&objects[indices[i]]);
+        if constexpr (kLineSegmentObjects) {
+          min_order_index[indices[i]] = i;
+        }
+      }
+      for (int i = node.objects_begin; i < node.objects_end; ++i) {
+        const uint32_t index = indices[num_objects + i];
+        tree->objects_sorted_by_max_.push_back(&objects[index]);
+        if constexpr (kLineSegmentObjects) {
+          tree->objects_sorted_by_max_index_.push_back(
+              min_order_index[index]);
+        }
+      }
+    }
+    if (tree->objects_sorted_by_min_.size() != num_objects) {
+      return nullptr;
+    }
+    tree->RestoreSortKeys();
+    if (params.compact) {
+      tree->Compact();
+    }
+    return tree;
+  }
+
+  /**
+   * @brief Get statistics on the shape of the tree, for tuning the
+   *        parameters it is built with.
+   * @return The statistics.
+   */
+  AABoxKDTreeStats GetStats() const {
+    AABoxKDTreeStats stats;
+    stats.num_nodes = static_cast<int>(nodes_.size());
+    stats.num_objects = static_cast<int>(objects_sorted_by_min_.size());
+    stats.num_bytes =
+        nodes_.size() * sizeof(Node) +
+        2 * objects_sorted_by_min_.size() * sizeof(ObjectPtr) +
+        (objects_sorted_by_min_bound_.size() +
+         objects_sorted_by_max_bound_.size()) * sizeof(double) +
+        (compact_sorted_by_min_bound_.size() +
+         compact_sorted_by_max_bound_.size()) * sizeof(float) +
+        objects_sorted_by_max_index_.size() * sizeof(int) +
+        segments_.num_bytes() + compact_segments_.num_bytes();
+    // Nodes are in preorder, so a parent comes before its children.
+    std::vector<int> depths(nodes_.size(), 0);
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+      const Node &node = nodes_[i];
+      const int num_objects = node.objects_end - node.objects_begin;
+      if (node.left_subnode < 0 && node.right_subnode < 0) {
+        ++stats.num_leaves;
+        stats.depth = std::max(stats.depth, depths[i]);
+        stats.max_leaf_size = std::max(stats.max_leaf_size, num_objects);
+        continue;
+      }
+      stats.num_straddling_objects += num_objects;
+      for (const int child : {node.left_subnode, node.right_subnode}) {
+        if (child >= 0) {
+          depths[child] = depths[i] + 1;
+        }
+      }
+    }
+    return stats;
+  }
+
+  /**
+   * @brief Count the work GetObjects does for a query, for tuning the
+   *        parameters the tree is built with.
+   * @param point The center point of the range to search objects.
+   * @param distance The radius of the range to search objects.
+   * @return The nodes and objects the query visits; the other counts are
+   *         left at 0.
+   */
+  AABoxKDTreeQueryCost GetObjectsQueryCost(const Vec2d &point,
+                                           const double distance) const {
+    AABoxKDTreeQueryCost cost;
+    GetObjectsInternal(
+        point, distance,
+        [&cost](ObjectPtr) {
+          ++cost.objects_tested;
+          return false;
+        },
+        [](ObjectPtr) {});
+    if (nodes_.empty()) {
+      return cost;
+    }
+    // The nodes GetObjectsInternal takes off its stack.
+    const double distance_sqr = Square(distance);
+    TraversalStack stack;
+    stack.push(0);
+    while (!stack.empty()) {
+      const Node &node = nodes_[stack.pop()];
+      ++cost.nodes_visited;
+      if (LowerDistanceSquareToPoint(node, point) <= distance_sqr &&
+          UpperDistanceSquareToPoint(node, point) > distance_sqr) {
+        PushChildren(node, &stack);
+      }
+    }
+    return cost;
+  }
+
+  /**
+   * @brief Get the histograms of the work of the queries on this tree so
+   *        far. They are only kept when built with APOLLO_HDMAP_KDTREE_STATS.
+   * @return The histograms, empty if they are not kept.
+   */
+  AABoxKDTreeQueryHistograms GetQueryHistograms() const {
+#ifdef APOLLO_HDMAP_KDTREE_STATS
+    std::lock_guard<std::mutex> lock(query_histograms_mutex_);
+    return query_histograms_;
+#else
+    return AABoxKDTreeQueryHistograms();
+#endif
+  }
+
+  /**
+   * @brief Clear the histograms of the work of the queries.
+   */
+  void ClearQueryHistograms() {
+#ifdef APOLLO_HDMAP_KDTREE_STATS
+    std::lock_guard<std::mutex> lock(query_histograms_mutex_);
+    query_histograms_ = AABoxKDTreeQueryHistograms();
+#endif
   }
 
  private:
-  void InitObjects(const std::vector<ObjectPtr> &objects) {
-    num_objects_ = static_cast<int>(objects.size());
-    objects_sorted_by_min_ = objects;
-    objects_sorted_by_max_ = objects;
-    std::sort(objects_sorted_by_min_.begin(), objects_sorted_by_min_.end(),
-              [&](ObjectPtr obj1, ObjectPtr obj2) {
-                return partition_ == PARTITION_X
-                           ? obj1->aabox().min_x() < obj2->aabox().min_x()
-                           : obj1->aabox().min_y() < obj2->aabox().min_y();
-              });
-    std::sort(objects_sorted_by_max_.begin(), objects_sorted_by_max_.end(),
-              [&](ObjectPtr obj1, ObjectPtr obj2) {
-                return partition_ == PARTITION_X
-                           ? obj1->aabox().max_x() > obj2->aabox().max_x()
-                           : obj1->aabox().max_y() > obj2->aabox().max_y();
-              });
-    objects_sorted_by_min_bound_.reserve(num_objects_);
-    for (ObjectPtr object : objects_sorted_by_min_) {
-      objects_sorted_by_min_bound_.push_back(partition_ == PARTITION_X
-                                                 ? object->aabox().min_x()
-                                                 : object->aabox().min_y());
+#ifdef APOLLO_HDMAP_KDTREE_STATS
+  // The cost of the query running on this thread.
+  static AABoxKDTreeQueryCost &ThreadQueryCost() {
+    static thread_local AABoxKDTreeQueryCost cost;
+    return cost;
+  }
+
+  // Counts the work of a query into ThreadQueryCost(), and adds it to the
+  // histograms of the tree once the outermost query on the thread ends.
+  class QueryScope {
+   public:
+    QueryScope(const AABoxKDTree2d &tree, const Vec2d &point)
+        : tree_(tree), point_(point) {
+      if (Depth()++ == 0) {
+        ThreadQueryCost() = AABoxKDTreeQueryCost();
+      }
     }
-    objects_sorted_by_max_bound_.reserve(num_objects_);
-    for (ObjectPtr object : objects_sorted_by_max_) {
-      objects_sorted_by_max_bound_.push_back(partition_ == PARTITION_X
-                                                 ? object->aabox().max_x()
-                                                 : object->aabox().max_y());
+
+    ~QueryScope() {
+      if (--Depth() == 0) {
+        std::lock_guard<std::mutex> lock(tree_.query_histograms_mutex_);
+        tree_.query_histograms_.Add(point_, ThreadQueryCost());
+      }
+    }
+
+   private:
+    static int &Depth() {
+      static thread_local int depth = 0;
+      return depth;
+    }
+
+    const AABoxKDTree2d &tree_;
+    const Vec2d point_;
+  };
+#else
+  struct QueryScope {
+    QueryScope(const AABoxKDTree2d &, const Vec2d &) {}
+  };
+#endif
+
+  enum Partition {
+    PARTITION_X = 1,
+    PARTITION_Y = 2,
+  };
+
+  struct Node {
+    // Boundary
+    double min_x = 0.0;
+    double max_x = 0.0;
+    double min_y = 0.0;
+    double max_y = 0.0;
+    double mid_x = 0.0;
+    double mid_y = 0.0;
+
+    Partition partition = PARTITION_X;
+    double partition_position = 0.0;
+
+    // Indices into nodes_, or -1 if there is no such child.
+    int left_subnode = -1;
+    int right_subnode = -1;
+
+    // This node's objects are [objects_begin, objects_end) of the shared
+    // object arrays; its whole subtree's are [objects_begin, subtree_end).
+    int objects_begin = 0;
+    int objects_end = 0;
+    int subtree_end = 0;
+  };
+
+  // A LIFO of node indices pending traversal. It lives on the call stack for
+  // the depths real maps produce, and only spills to the heap beyond that.
+  class TraversalStack {
+   public:
+    void push(const int node_index) {
+      if (size_ < kInlineSize) {
+        inline_entries_[size_] = node_index;
+      } else {
+        overflow_entries_.push_back(node_index);
+      }
+      ++size_;
+    }
+
+    int pop() {
+      --size_;
+      if (size_ < kInlineSize) {
+        return inline_entries_[size_];
+      }
+      const int node_index = overflow_entries_.back();
+      overflow_entries_.pop_back();
+      return node_index;
+    }
+
+    bool empty() const { return size_ == 0; }
+
+   private:
+    static constexpr size_t kInlineSize = 128;
+    std::array<int, kInlineSize> inline_entries_;
+    std::vector<int> overflow_entries_;
+    size_t size_ = 0;
+  };
+
+  struct AcceptAll {
+    bool operator()(ObjectPtr) const { return true; }
+  };
+
+  static constexpr bool kLineSegmentObjects =
+      IsLineSegmentObject<ObjectType>::value;
+  // The number of objects whose distances a scan computes at once.
+  static constexpr int kDistanceBatchSize = kLineSegmentObjects ? 4 : 1;
+
+  // Squared distances from point to [first, last) of objects_sorted_by_max_
+  // if sorted_by_max, or else of objects_sorted_by_min_.
+  void DistanceSquareToObjects(const Vec2d &point, const bool sorted_by_max,
+                               const int first, const int last,
+                               double *const distances_sqr) const {
+    if constexpr (kLineSegmentObjects) {
+      if (sorted_by_max) {
+        segments_.DistanceSquareTo(point,
+                                   objects_sorted_by_max_index_.data() + first,
+                                   last - first, distances_sqr);
+      } else {
+        segments_.DistanceSquareTo(point, first, last, distances_sqr);
+      }
+    } else {
+      const auto &objects =
+          sorted_by_max ? objects_sorted_by_max_ : objects_sorted_by_min_;
+      for (int i = first; i < last; ++i) {
+        distances_sqr[i - first] = objects[i]->DistanceSquareTo(point);
+      }
     }
   }
 
-  bool SplitToSubNodes(const std::vector<ObjectPtr> &objects,
-                       const AABoxKDTreeParams &params) {
-    if (params.max_depth >= 0 && depth_ >= params.max_depth) {
-      return false;
+  // Calls visit(i, distance_sqr) for i = objects_begin, objects_begin + 1,
+  // ... of node in one sorted object array, stopping before the first i for
+  // which stop(i) is true. Distances are computed kDistanceBatchSize at a
+  // time; stop must stay true once true, even as visit runs, so that no batch
+  // reaches past it.
+  //
+  // For line segments in compact mode, visit must ignore objects beyond
+  // max_distance_sqr(), which are then skipped on their float distances.
+  // Unless nearest, objects whose float distances put them within
+  // max_distance_sqr() are visited with max_distance_sqr() as their distance.
+  // If nearest, visit keeps only the nearest object, so objects certainly
+  // farther than another one of their batch are skipped as well. Only the
+  // remaining objects get their exact distance computed.
+  template <class Stop, class MaxDistanceSquare, class Visit>
+  void ScanObjects(const Vec2d &point, const Node &node,
+                   const bool sorted_by_max, const Stop &stop,
+                   const MaxDistanceSquare &max_distance_sqr,
+                   const bool nearest, const Visit &visit) const {
+    const int begin = node.objects_begin;
+    const int end = node.objects_end;
+    if constexpr (kLineSegmentObjects) {
+      if (compact_) {
+        ScanCompactSegments(point, node, sorted_by_max, stop,
+                            max_distance_sqr, nearest, visit);
+        return;
+      }
     }
-    if (static_cast<int>(objects.size()) <= std::max(1, params.max_leaf_size)) {
-      return false;
+    double distances_sqr[kDistanceBatchSize];
+    for (int first = begin; first < end; first += kDistanceBatchSize) {
+      const int batch_end = std::min(end, first + kDistanceBatchSize);
+      int last = first;
+      while (last < batch_end && !stop(last)) {
+        ++last;
+      }
+      DistanceSquareToObjects(point, sorted_by_max, first, last,
+                              distances_sqr);
+      APOLLO_HDMAP_KDTREE_COUNT(objects_tested, last - first);
+      APOLLO_HDMAP_KDTREE_COUNT(distances_computed, last - first);
+      for (int i = first; i < last; ++i) {
+        if (stop(i)) {
+          return;
+        }
+        visit(i, distances_sqr[i - first]);
+      }
+      if (last < batch_end) {
+        return;
+      }
     }
-    if (params.max_leaf_dimension >= 0.0 &&
-        std::max(max_x_ - min_x_, max_y_ - min_y_) <=
-            params.max_leaf_dimension) {
-      return false;
+  }
+
+  template <class Stop, class MaxDistanceSquare, class Visit>
+  void ScanCompactSegments(const Vec2d &point, const Node &node,
+                           const bool sorted_by_max, const Stop &stop,
+                           const MaxDistanceSquare &max_distance_sqr,
+                           const bool nearest, const Visit &visit) const {
+    if (node.objects_begin == node.objects_end || stop(node.objects_begin)) {
+      return;
+    }
+    const Vec2d relative_point(point.x() - node.mid_x,
+                               point.y() - node.mid_y);
+    const double margin = CompactLineSegment2dBatch::MaxDistanceError(
+        std::max({std::abs(relative_point.x()), std::abs(relative_point.y()),
+                  node.max_x - node.mid_x, node.mid_x - node.min_x,
+                  node.max_y - node.mid_y, node.mid_y - node.min_y}));
+    // Float distances above reject_sqr rule an object out, and, unless
+    // nearest, those up to accept_sqr let it in.
+    double max_sqr = std::numeric_limits<double>::quiet_NaN();
+    double reject_sqr = 0.0;
+    double accept_sqr = -1.0;
+    const auto &objects =
+        sorted_by_max ? objects_sorted_by_max_ : objects_sorted_by_min_;
+    float distances_sqr[kDistanceBatchSize];
+    for (int first = node.objects_begin; first < node.objects_end;
+         first += kDistanceBatchSize) {
+      const int batch_end = std::min(node.objects_end,
+                                     first + kDistanceBatchSize);
+      int last = first;
+      while (last < batch_end && !stop(last)) {
+        ++last;
+      }
+      if (sorted_by_max) {
+        compact_segments_.DistanceSquareTo(
+            relative_point, objects_sorted_by_max_index_.data() + first,
+            last - first, distances_sqr);
+      } else {
+        compact_segments_.DistanceSquareTo(relative_point, first, last,
+                                           distances_sqr);
+      }
+      APOLLO_HDMAP_KDTREE_COUNT(objects_tested, last - first);
+      APOLLO_HDMAP_KDTREE_COUNT(distances_computed, last - first);
+      // Farther than this, an object is certainly farther than the nearest
+      // one of the batch.
+      double batch_reject_sqr = std::numeric_limits<double>::infinity();
+      if (nearest && last > first) {
+        batch_reject_sqr = Square(
+            std::sqrt(*std::min_element(distances_sqr,
+                                        distances_sqr + (last - first))) +
+            2.0 * margin);
+      }
+      for (int i = first; i < last; ++i) {
+        if (stop(i)) {
+          return;
+        }
+        // Only a visit can change it.
+        if (!(max_distance_sqr() == max_sqr)) {
+          max_sqr = max_distance_sqr();
+          const double max_distance = std::sqrt(max_sqr);
+          reject_sqr = Square(max_distance + margin);
+          if (!nearest && max_distance > margin) {
+            accept_sqr = Square(max_distance - margin);
+          }
+        }
+        const double distance_sqr = distances_sqr[i - first];
+        if (distance_sqr > reject_sqr || distance_sqr > batch_reject_sqr) {
+          continue;
+        }
+        if (distance_sqr <= accept_sqr) {
+          visit(i, max_sqr);
+          continue;
+        }
+        APOLLO_HDMAP_KDTREE_COUNT(distances_computed, 1);
+        visit(i, objects[i]->geo_object()->DistanceSquareTo(point));
+      }
+      if (last < batch_end) {
+        return;
+      }
+    }
+  }
+
+  // The sort keys of the objects of node; in compact mode they are rounded
+  // outwards, so that MinBound(node, i) <= the exact key <= MaxBound(node, i).
+  double MinBound(const Node &node, const int i) const {
+    if (compact_) {
+      return PartitionOrigin(node) + compact_sorted_by_min_bound_[i];
+    }
+    return objects_sorted_by_min_bound_[i];
+  }
+
+  double MaxBound(const Node &node, const int i) const {
+    if (compact_) {
+      return PartitionOrigin(node) + compact_sorted_by_max_bound_[i];
+    }
+    return objects_sorted_by_max_bound_[i];
+  }
+
+  // The origin of the compact sort keys of node.
+  static double PartitionOrigin(const Node &node) {
+    return node.partition == PARTITION_X ? node.mid_x : node.mid_y;
+  }
+
+  static AABox2d GetBoundingBox(const Node &node) {
+    return AABox2d({node.min_x, node.min_y}, {node.max_x, node.max_y});
+  }
+
+  // Pushes the children so that the left subtree is visited first.
+  static void PushChildren(const Node &node, TraversalStack *stack) {
+    if (node.right_subnode >= 0) {
+      stack->push(node.right_subnode);
+    }
+    if (node.left_subnode >= 0) {
+      stack->push(node.left_subnode);
     }
-    return true;
   }
 
-  double LowerDistanceSquareToPoint(const Vec2d &point) const {
+  static double LowerDistanceSquareToPoint(const Node &node,
+                                           const Vec2d &point) {
     double dx = 0.0;
-    if (point.x() < min_x_) {
-      dx = min_x_ - point.x();
-    } else if (point.x() > max_x_) {
-      dx = point.x() - max_x_;
+    if (point.x() < node.min_x) {
+      dx = node.min_x - point.x();
+    } else if (point.x() > node.max_x) {
+      dx = point.x() - node.max_x;
     }
     double dy = 0.0;
-    if (point.y() < min_y_) {
-      dy = min_y_ - point.y();
-    } else if (point.y() > max_y_) {
-      dy = point.y() - max_y_;
+    if (point.y() < node.min_y) {
+      dy = node.min_y - point.y();
+    } else if (point.y() > node.max_y) {
+      dy = point.y() - node.max_y;
     }
     return dx * dx + dy * dy;
   }
 
-  double UpperDistanceSquareToPoint(const Vec2d &point) const {
-    const double dx =
-        (point.x() > mid_x_ ? (point.x() - min_x_) : (point.x() - max_x_));
-    const double dy =
-        (point.y() > mid_y_ ? (point.y() - min_y_) : (point.y() - max_y_));
+  static double UpperDistanceSquareToPoint(const Node &node,
+                                           const Vec2d &point) {
+    const double dx = (point.x() > node.mid_x ? (point.x() - node.min_x)
+                                              : (point.x() - node.max_x));
+    const double dy = (point.y() > node.mid_y ? (point.y() - node.min_y)
+                                              : (point.y() - node.max_y));
     return dx * dx + dy * dy;
   }
 
-  void GetAllObjects(std::vector<ObjectPtr> *const result_objects) const {
-    result_objects->insert(result_objects->end(),
-                           objects_sorted_by_min_.begin(),
-                           objects_sorted_by_min_.end());
-    if (left_subnode_ != nullptr) {
-      left_subnode_->GetAllObjects(result_objects);
-    }
-    if (right_subnode_ != nullptr) {
-      right_subnode_->GetAllObjects(result_objects);
+  // Scratch state of VisitNearestOwners, kept per thread so that, once
+  // warmed up, its queries make no heap allocations.
+  struct NearestOwnersScratch {
+    // Either a node keyed by its lower bound, or an object keyed by its exact
+    // distance.
+    struct Entry {
+      double distance_sqr;
+      int node;
+      ObjectPtr object;
+    };
+
+    // Starts a pass over owners below num_owners, forgetting the owners seen
+    // in the previous pass in O(1).
+    void StartPass(const int num_owners) {
+      if (static_cast<int>(stamps.size()) < num_owners) {
+        stamps.resize(num_owners, 0);
+        owner_distances_sqr.resize(num_owners, 0.0);
+      }
+      if (++epoch == 0) {
+        std::fill(stamps.begin(), stamps.end(), 0);
+        epoch = 1;
+      }
+      queue.clear();
+      bounds_sqr.clear();
     }
+
+    // A min-heap on distance_sqr of the nodes and objects to visit.
+    std::vector<Entry> queue;
+    // An owner is seen in this pass iff its stamp equals epoch. Its
+    // owner_distances_sqr is then that of its nearest object queued so far,
+    // or negative once it has been visited.
+    std::vector<uint32_t> stamps;
+    std::vector<double> owner_distances_sqr;
+    uint32_t epoch = 0;
+    // A max-heap of the distances first queued for up to max_owners owners.
+    std::vector<double> bounds_sqr;
+  };
+
+  static NearestOwnersScratch &ThreadNearestOwnersScratch() {
+    static thread_local NearestOwnersScratch scratch;
+    return scratch;
   }
 
-  void GetObjectsInternal(const Vec2d &point, const double distance,
-                          const double distance_sqr,
-                          std::vector<ObjectPtr> *const result_objects) const {
-    if (LowerDistanceSquareToPoint(point) > distance_sqr) {
+  // Visits the nearest object of every owner (object_index(), below
+  // num_owners) within max_distance, nearest owner first, until visitor
+  // returns true or max_owners owners are visited. Only the nearest object
+  // found so far of an owner is queued, and once max_owners owners are
+  // queued, nothing farther than the farthest of them. The visitor must not
+  // run another such query on the same thread.
+  template <class Visitor>
+  void VisitNearestOwners(const Vec2d &point, const double max_distance,
+                          const int num_owners, const int max_owners,
+                          const Visitor &visitor) const {
+    if (nodes_.empty() || max_owners <= 0) {
       return;
     }
-    if (UpperDistanceSquareToPoint(point) <= distance_sqr) {
-      GetAllObjects(result_objects);
-      return;
-    }
-    const double pvalue = (partition_ == PARTITION_X ? point.x() : point.y());
-    if (pvalue < partition_position_) {
-      const double limit = pvalue + distance;
-      for (int i = 0; i < num_objects_; ++i) {
-        if (objects_sorted_by_min_bound_[i] > limit) {
+    using Entry = typename NearestOwnersScratch::Entry;
+    NearestOwnersScratch &scratch = ThreadNearestOwnersScratch();
+    scratch.StartPass(num_owners);
+    auto &queue = scratch.queue;
+    auto &bounds_sqr = scratch.bounds_sqr;
+    // Entries pop in nondecreasing key order, so the first object popped
+    // for an owner is that owner's nearest one.
+    auto farther = [](const Entry &entry1, const Entry &entry2) {
+      return entry1.distance_sqr > entry2.distance_sqr;
+    };
+    auto push = [&queue, &farther](const Entry &entry) {
+      queue.push_back(entry);
+      std::push_heap(queue.begin(), queue.end(), farther);
+    };
+    // Bounding the owners only pays when fewer than all may be visited.
+    const bool bounded = max_owners < num_owners;
+    double limit_sqr = Square(max_distance);
+    push({LowerDistanceSquareToPoint(nodes_.front(), point), 0, nullptr});
+    int num_visited = 0;
+    while (!queue.empty()) {
+      std::pop_heap(queue.begin(), queue.end(), farther);
+      const Entry entry = queue.back();
+      queue.pop_back();
+      if (entry.distance_sqr > limit_sqr) {
+        break;
+      }
+      if (entry.object != nullptr) {
+        double &owner_distance_sqr =
+            scratch.owner_distances_sqr[entry.object->object_index()];
+        if (owner_distance_sqr < 0.0) {
+          continue;
+        }
+        owner_distance_sqr = -1.0;
+        if (visitor(entry.object) || ++num_visited == max_owners) {
           break;
         }
+        continue;
+      }
+      const Node &node = nodes_[entry.node];
+      APOLLO_HDMAP_KDTREE_COUNT(nodes_visited, 1);
+      APOLLO_HDMAP_KDTREE_COUNT(objects_tested,
+                                node.objects_end - node.objects_begin);
+      for (int i = node.objects_begin; i < node.objects_end; ++i) {
         ObjectPtr object = objects_sorted_by_min_[i];
-        if (object->DistanceSquareTo(point) <= distance_sqr) {
-          result_objects->push_back(object);
+        const int owner = object->object_index();
+        const bool seen = scratch.stamps[owner] == scratch.epoch;
+        double &owner_distance_sqr = scratch.owner_distances_sqr[owner];
+        if (seen && owner_distance_sqr < 0.0) {
+          continue;
+        }
+        APOLLO_HDMAP_KDTREE_COUNT(distances_computed, 1);
+        const double distance_sqr = object->DistanceSquareTo(point);
+        if (distance_sqr > limit_sqr ||
+            (seen && distance_sqr >= owner_distance_sqr)) {
+          continue;
         }
+        if (!seen) {
+          scratch.stamps[owner] = scratch.epoch;
+          if (bounded) {
+            // The max_owners nearest owners are all within the farthest of
+            // the first distances of any max_owners owners.
+            bounds_sqr.push_back(distance_sqr);
+            std::push_heap(bounds_sqr.begin(), bounds_sqr.end());
+            if (static_cast<int>(bounds_sqr.size()) > max_owners) {
+              std::pop_heap(bounds_sqr.begin(), bounds_sqr.end());
+              bounds_sqr.pop_back();
+            }
+            if (static_cast<int>(bounds_sqr.size()) == max_owners) {
+              limit_sqr = std::min(limit_sqr, bounds_sqr.front());
+            }
+          }
+        }
+        owner_distance_sqr = distance_sqr;
+        push({distance_sqr, -1, object});
       }
-    } else {
-      const double limit = pvalue - distance;
-      for (int i = 0; i < num_objects_; ++i) {
-        if (objects_sorted_by_max_bound_[i] < limit) {
-          break;
+      for (const int subnode : {node.left_subnode, node.right_subnode}) {
+        if (subnode < 0) {
+          continue;
         }
-        ObjectPtr object = objects_sorted_by_max_[i];
-        if (object->DistanceSquareTo(point) <= distance_sqr) {
-          result_objects->push_back(object);
+        const double lower_distance_sqr =
+            LowerDistanceSquareToPoint(nodes_[subnode], point);
+        if (lower_distance_sqr <= limit_sqr) {
+          push({lower_distance_sqr, subnode, nullptr});
         }
       }
     }
-    if (left_subnode_ != nullptr) {
-      left_subnode_->GetObjectsInternal(point, distance, distance_sqr,
-                                        result_objects);
+  }
+
+  template <class Filter, class Visitor>
+  void GetObjectsInternal(const Vec2d &point, const double distance,
+                          const Filter &filter,
+                          const Visitor &visitor) const {
+    if (nodes_.empty()) {
+      return;
     }
-    if (right_subnode_ != nullptr) {
-      right_subnode_->GetObjectsInternal(point, distance, distance_sqr,
-                                         result_objects);
+    const double distance_sqr = Square(distance);
+    TraversalStack stack;
+    stack.push(0);
+    while (!stack.empty()) {
+      const Node &node = nodes_[stack.pop()];
+      APOLLO_HDMAP_KDTREE_COUNT(nodes_visited, 1);
+      if (LowerDistanceSquareToPoint(node, point) > distance_sqr) {
+        continue;
+      }
+      if (UpperDistanceSquareToPoint(node, point) <= distance_sqr) {
+        // The whole subtree is in range, and its objects are contiguous.
+        APOLLO_HDMAP_KDTREE_COUNT(subtrees_copied, 1);
+        APOLLO_HDMAP_KDTREE_COUNT(objects_tested,
+                                  node.subtree_end - node.objects_begin);
+        for (int i = node.objects_begin; i < node.subtree_end; ++i) {
+          ObjectPtr object = objects_sorted_by_min_[i];
+          if (filter(object)) {
+            visitor(object);
+          }
+        }
+        continue;
+      }
+      const double pvalue =
+          (node.partition == PARTITION_X ? point.x() : point.y());
+      if (pvalue < node.partition_position) {
+        const double limit = pvalue + distance;
+        ScanObjects(
+            point, node, false,
+            [&](const int i) { return MinBound(node, i) > limit; },
+            [distance_sqr] { return distance_sqr; }, false,
+            [&](const int i, const double object_distance_sqr) {
+              ObjectPtr object = objects_sorted_by_min_[i];
+              if (filter(object) && object_distance_sqr <= distance_sqr) {
+                visitor(object);
+              }
+            });
+      } else {
+        const double limit = pvalue - distance;
+        ScanObjects(
+            point, node, true,
+            [&](const int i) { return MaxBound(node, i) < limit; },
+            [distance_sqr] { return distance_sqr; }, false,
+            [&](const int i, const double object_distance_sqr) {
+              ObjectPtr object = objects_sorted_by_max_[i];
+              if (filter(object) && object_distance_sqr <= distance_sqr) {
+                visitor(object);
+              }
+            });
+      }
+      PushChildren(node, &stack);
     }
   }
 
+  // Depth-first search that visits, at each node, the child on the point's
+  // side of the partition, then the node's own objects, then the other
+  // child. The search ends as soon as an object within kMathEpsilon is found.
   void GetNearestObjectInternal(const Vec2d &point,
                                 double *const min_distance_sqr,
                                 ObjectPtr *const nearest_object) const {
-    if (LowerDistanceSquareToPoint(point) >= *min_distance_sqr - kMathEpsilon) {
+    if (nodes_.empty()) {
       return;
     }
-    const double pvalue = (partition_ == PARTITION_X ? point.x() : point.y());
-    const bool search_left_first = (pvalue < partition_position_);
-    if (search_left_first) {
-      if (left_subnode_ != nullptr) {
-        left_subnode_->GetNearestObjectInternal(point, min_distance_sqr,
-                                                nearest_object);
+    // Nodes whose near subtree is being searched, waiting for their own
+    // objects and far subtree.
+    TraversalStack stack;
+    int node_index = 0;
+    while (true) {
+      while (node_index >= 0) {
+        const Node &node = nodes_[node_index];
+        APOLLO_HDMAP_KDTREE_COUNT(nodes_visited, 1);
+        if (LowerDistanceSquareToPoint(node, point) >=
+            *min_distance_sqr - kMathEpsilon) {
+          break;
+        }
+        stack.push(node_index);
+        const double pvalue =
+            (node.partition == PARTITION_X ? point.x() : point.y());
+        node_index = pvalue < node.partition_position ? node.left_subnode
+                                                      : node.right_subnode;
       }
-    } else {
-      if (right_subnode_ != nullptr) {
-        right_subnode_->GetNearestObjectInternal(point, min_distance_sqr,
-                                                 nearest_object);
+      if (stack.empty() || *min_distance_sqr <= kMathEpsilon) {
+        return;
+      }
+      const Node &node = nodes_[stack.pop()];
+      const double pvalue =
+          (node.partition == PARTITION_X ? point.x() : point.y());
+      if (pvalue < node.partition_position) {
+        ScanObjects(
+            point, node, false,
+            [&](const int i) {
+              const double bound = MinBound(node, i);
+              return bound > pvalue &&
+                     Square(bound - pvalue) > *min_distance_sqr;
+            },
+            [min_distance_sqr] { return *min_distance_sqr; }, true,
+            [&](const int i, const double distance_sqr) {
+              if (distance_sqr < *min_distance_sqr) {
+                *min_distance_sqr = distance_sqr;
+                *nearest_object = objects_sorted_by_min_[i];
+              }
+            });
+        node_index = node.right_subnode;
+      } else {
+        ScanObjects(
+            point, node, true,
+            [&](const int i) {
+              const double bound = MaxBound(node, i);
+              return bound < pvalue &&
+                     Square(bound - pvalue) > *min_distance_sqr;
+            },
+            [min_distance_sqr] { return *min_distance_sqr; }, true,
+            [&](const int i, const double distance_sqr) {
+              if (distance_sqr < *min_distance_sqr) {
+                *min_distance_sqr = distance_sqr;
+                *nearest_object = objects_sorted_by_max_[i];
+              }
+            });
+        node_index = node.left_subnode;
+      }
+      if (*min_distance_sqr <= kMathEpsilon) {
+        return;
       }
     }
-    if (*min_distance_sqr <= kMathEpsilon) {
-      return;
+  }
+
+  // A node above the subtrees that are built as separate tasks. Each child
+  // is either another planned node or the subtree of a task.
+  struct PlannedNode {
+    Node node;
+    // The objects this node keeps for itself.
+    std::vector<ObjectPtr> objects;
+    std::unique_ptr<PlannedNode> left_subnode;
+    std::unique_ptr<PlannedNode> right_subnode;
+    int left_subtree_task = -1;
+    int right_subtree_task = -1;
+  };
+
+  // A subtree to build on its own: its objects and the depth of its root.
+  struct SubtreeTask {
+    std::vector<ObjectPtr> objects;
+    int depth = 0;
+  };
+
+  // The bytes Serialize() writes per node.
+  static constexpr size_t kSerializedNodeSize =
+      7 * sizeof(double) + 6 * sizeof(int32_t);
+
+  template <class T>
+  static void AppendValue(const T value, std::string *const data) {
+    data->append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  template <class T>
+  static bool ReadValue(std::string_view *const data, T *const value) {
+    if (data->size() < sizeof(T)) {
+      return false;
     }
+    std::memcpy(value, data->data(), sizeof(T));
+    data->remove_prefix(sizeof(T));
+    return true;
+  }
 
-    if (search_left_first) {
-      for (int i = 0; i < num_objects_; ++i) {
-        const double bound = objects_sorted_by_min_bound_[i];
-        if (bound > pvalue && Square(bound - pvalue) > *min_distance_sqr) {
-          break;
+  // Subtrees with at most this many objects are never split across tasks.
+  static constexpr size_t kMinSubtreeTaskSize = 1024;
+
+  AABoxKDTree2d() = default;
+
+  void ReserveObjects(const size_t size) {
+    objects_sorted_by_min_.reserve(size);
+    objects_sorted_by_max_.reserve(size);
+    objects_sorted_by_min_bound_.reserve(size);
+    objects_sorted_by_max_bound_.reserve(size);
+    if (kLineSegmentObjects) {
+      segments_.Reserve(static_cast<int>(size));
+      objects_sorted_by_max_index_.reserve(size);
+    }
+  }
+
+  void BuildInParallel(const std::vector<ObjectPtr> &objects,
+                       const AABoxKDTreeParams &params) {
+    const size_t max_task_size =
+        std::max(kMinSubtreeTaskSize, objects.size() / 64);
+    std::vector<SubtreeTask> tasks;
+    const std::unique_ptr<PlannedNode> root =
+        PlanNode(objects, params, 0, max_task_size, &tasks);
+    std::vector<std::unique_ptr<AABoxKDTree2d>> subtrees(tasks.size());
+    params.parallel_for(static_cast<int>(tasks.size()), [&](const int i) {
+      subtrees[i].reset(new AABoxKDTree2d());
+      subtrees[i]->ReserveObjects(tasks[i].objects.size());
+      subtrees[i]->BuildNode(tasks[i].objects, params, tasks[i].depth);
+    });
+    BuildPlannedNode(*root, subtrees);
+  }
+
+  // Partitions the objects the way BuildNode would, down to the subtrees of
+  // at most max_task_size objects, which are left to tasks.
+  static std::unique_ptr<PlannedNode> PlanNode(
+      const std::vector<ObjectPtr> &objects, const AABoxKDTreeParams &params,
+      const int depth, const size_t max_task_size,
+      std::vector<SubtreeTask> *const tasks) {
+    std::unique_ptr<PlannedNode> planned(new PlannedNode());
+    ComputeBoundary(objects, &planned->node);
+    ComputePartition(objects, params, &planned->node);
+    if (!SplitToSubNodes(planned->node, objects, params, depth)) {
+      planned->objects = objects;
+      return planned;
+    }
+    std::vector<ObjectPtr> left_subnode_objects;
+    std::vector<ObjectPtr> right_subnode_objects;
+    PartitionObjects(planned->node, objects, &left_subnode_objects,
+                     &right_subnode_objects, &planned->objects);
+    auto plan_subnode = [&](std::vector<ObjectPtr> *const subnode_objects,
+                            std::unique_ptr<PlannedNode> *const subnode,
+                            int *const subtree_task) {
+      if (subnode_objects->empty()) {
+        return;
+      }
+      if (subnode_objects->size() <= max_task_size) {
+        *subtree_task = static_cast<int>(tasks->size());
+        tasks->push_back({std::move(*subnode_objects), depth + 1});
+      } else {
+        *subnode = PlanNode(*subnode_objects, params, depth + 1,
+                            max_task_size, tasks);
+      }
+    };
+    plan_subnode(&left_subnode_objects, &planned->left_subnode,
+                 &planned->left_subtree_task);
+    plan_subnode(&right_subnode_objects, &planned->right_subnode,
+                 &planned->right_subtree_task);
+    return planned;
+  }
+
+  // The counterpart of BuildNode for planned nodes, which splices in the
+  // subtrees built by the tasks.
+  int BuildPlannedNode(
+      const PlannedNode &planned,
+      const std::vector<std::unique_ptr<AABoxKDTree2d>> &subtrees) {
+    const int index = static_cast<int>(nodes_.size());
+    nodes_.emplace_back();
+    Node node = planned.node;
+    InitObjects(planned.objects, &node);
+    nodes_[index] = node;
+    if (planned.left_subnode != nullptr) {
+      const int left_subnode =
+          BuildPlannedNode(*planned.left_subnode, subtrees);
+      nodes_[index].left_subnode = left_subnode;
+    } else if (planned.left_subtree_task >= 0) {
+      const int left_subnode =
+          AppendSubtree(*subtrees[planned.left_subtree_task]);
+      nodes_[index].left_subnode = left_subnode;
+    }
+    if (planned.right_subnode != nullptr) {
+      const int right_subnode =
+          BuildPlannedNode(*planned.right_subnode, subtrees);
+      nodes_[index].right_subnode = right_subnode;
+    } else if (planned.right_subtree_task >= 0) {
+      const int right_subnode =
+          AppendSubtree(*subtrees[planned.right_subtree_task]);
+      nodes_[index].right_subnode = right_subnode;
+    }
+    nodes_[index].subtree_end =
+        static_cast<int>(objects_sorted_by_min_.size());
+    return index;
+  }
+
+  // Replaces the sort keys and segment copies with their compact forms.
+  void Compact() {
+    const size_t num_objects = objects_sorted_by_min_.size();
+    compact_sorted_by_min_bound_.resize(num_objects);
+    compact_sorted_by_max_bound_.resize(num_objects);
+    compact_segments_ = CompactLineSegment2dBatch();
+    if constexpr (kLineSegmentObjects) {
+      compact_segments_.Reserve(static_cast<int>(num_objects));
+    }
+    constexpr float kInfinity = std::numeric_limits<float>::infinity();
+    for (const Node &node : nodes_) {
+      const double origin = PartitionOrigin(node);
+      for (int i = node.objects_begin; i < node.objects_end; ++i) {
+        // Rounded outwards as MinBound() and MaxBound() add them back.
+        float min_offset =
+            static_cast<float>(objects_sorted_by_min_bound_[i] - origin);
+        while (origin + min_offset > objects_sorted_by_min_bound_[i]) {
+          min_offset = std::nextafter(min_offset, -kInfinity);
         }
-        ObjectPtr object = objects_sorted_by_min_[i];
-        const double distance_sqr = object->DistanceSquareTo(point);
-        if (distance_sqr < *min_distance_sqr) {
-          *min_distance_sqr = distance_sqr;
-          *nearest_object = object;
+        compact_sorted_by_min_bound_[i] = min_offset;
+        float max_offset =
+            static_cast<float>(objects_sorted_by_max_bound_[i] - origin);
+        while (origin + max_offset < objects_sorted_by_max_bound_[i]) {
+          max_offset = std::nextafter(max_offset, kInfinity);
         }
-      }
-    } else {
-      for (int i = 0; i < num_objects_; ++i) {
-        const double bound = objects_sorted_by_max_bound_[i];
-        if (bound < pvalue && Square(bound - pvalue) > *min_distance_sqr) {
-          break;
+        compact_sorted_by_max_bound_[i] = max_offset;
+        if constexpr (kLineSegmentObjects) {
+          compact_segments_.Append(*objects_sorted_by_min_[i]->geo_object(),
+                                   {node.mid_x, node.mid_y});
         }
-        ObjectPtr object = objects_sorted_by_max_[i];
-        const double distance_sqr = object->DistanceSquareTo(point);
-        if (distance_sqr < *min_distance_sqr) {
-          *min_distance_sqr = distance_sqr;
-          *nearest_object = object;
+      }
+    }
+    std::vector<double>().swap(objects_sorted_by_min_bound_);
+    std::vector<double>().swap(objects_sorted_by_max_bound_);
+    segments_ = LineSegment2dBatch();
+    compact_ = true;
+  }
+
+  // Computes the sort keys and segment copies from the objects, in their
+  // exact form.
+  void RestoreSortKeys() {
+    const size_t num_objects = objects_sorted_by_min_.size();
+    objects_sorted_by_min_bound_.clear();
+    objects_sorted_by_max_bound_.clear();
+    objects_sorted_by_min_bound_.reserve(num_objects);
+    objects_sorted_by_max_bound_.reserve(num_objects);
+    segments_ = LineSegment2dBatch();
+    if constexpr (kLineSegmentObjects) {
+      segments_.Reserve(static_cast<int>(num_objects));
+    }
+    for (const Node &node : nodes_) {
+      const bool along_x = node.partition == PARTITION_X;
+      for (int i = node.objects_begin; i < node.objects_end; ++i) {
+        const AABox2d &min_box = objects_sorted_by_min_[i]->aabox();
+        const AABox2d &max_box = objects_sorted_by_max_[i]->aabox();
+        objects_sorted_by_min_bound_.push_back(along_x ? min_box.min_x()
+                                                       : min_box.min_y());
+        objects_sorted_by_max_bound_.push_back(along_x ? max_box.max_x()
+                                                       : max_box.max_y());
+        if constexpr (kLineSegmentObjects) {
+          segments_.Append(*objects_sorted_by_min_[i]->geo_object());
         }
       }
     }
-    if (*min_distance_sqr <= kMathEpsilon) {
-      return;
+    std::vector<float>().swap(compact_sorted_by_min_bound_);
+    std::vector<float>().swap(compact_sorted_by_max_bound_);
+    compact_segments_ = CompactLineSegment2dBatch();
+    compact_ = false;
+  }
+
+  // Grows the nodes on the path of an added object to cover it, and returns
+  // the index of the node that is to keep it.
+  int AddToNode(ObjectPtr object) {
+    const AABox2d &box = object->aabox();
+    int index = 0;
+    while (true) {
+      Node &node = nodes_[index];
+      node.min_x = std::fmin(node.min_x, box.min_x());
+      node.max_x = std::fmax(node.max_x, box.max_x());
+      node.min_y = std::fmin(node.min_y, box.min_y());
+      node.max_y = std::fmax(node.max_y, box.max_y());
+      node.mid_x = (node.min_x + node.max_x) / 2.0;
+      node.mid_y = (node.min_y + node.max_y) / 2.0;
+      const bool along_x = node.partition == PARTITION_X;
+      int child = -1;
+      if ((along_x ? box.max_x() : box.max_y()) <= node.partition_position) {
+        child = node.left_subnode;
+      } else if ((along_x ? box.min_x() : box.min_y()) >=
+                 node.partition_position) {
+        child = node.right_subnode;
+      }
+      if (child < 0) {
+        return index;
+      }
+      index = child;
     }
-    if (search_left_first) {
-      if (right_subnode_ != nullptr) {
-        right_subnode_->GetNearestObjectInternal(point, min_distance_sqr,
-                                                 nearest_object);
+  }
+
+  // Appends a subtree built as a separate tree, and returns the index of its
+  // root. The subtree's indices are relative to its own arrays.
+  int AppendSubtree(const AABoxKDTree2d &subtree) {
+    const int node_offset = static_cast<int>(nodes_.size());
+    const int object_offset = static_cast<int>(objects_sorted_by_min_.size());
+    for (Node node : subtree.nodes_) {
+      if (node.left_subnode >= 0) {
+        node.left_subnode += node_offset;
+      }
+      if (node.right_subnode >= 0) {
+        node.right_subnode += node_offset;
+      }
+      node.objects_begin += object_offset;
+      node.objects_end += object_offset;
+      node.subtree_end += object_offset;
+      nodes_.push_back(node);
+    }
+    auto append = [](const auto &from, auto *to) {
+      to->insert(to->end(), from.begin(), from.end());
+    };
+    append(subtree.objects_sorted_by_min_, &objects_sorted_by_min_);
+    append(subtree.objects_sorted_by_max_, &objects_sorted_by_max_);
+    append(subtree.objects_sorted_by_min_bound_,
+           &objects_sorted_by_min_bound_);
+    append(subtree.objects_sorted_by_max_bound_,
+           &objects_sorted_by_max_bound_);
+    if constexpr (kLineSegmentObjects) {
+      segments_.Append(subtree.segments_);
+      for (const int index : subtree.objects_sorted_by_max_index_) {
+        objects_sorted_by_max_index_.push_back(index + object_offset);
+      }
+    }
+    return node_offset;
+  }
+
+  // Appends the subtree of the given objects to nodes_ in preorder, and
+  // returns the index of its root.
+  int BuildNode(const std::vector<ObjectPtr> &objects,
+                const AABoxKDTreeParams &params, const int depth) {
+    ACHECK(!objects.empty());
+
+    const int index = static_cast<int>(nodes_.size());
+    nodes_.emplace_back();
+    Node node;
+    ComputeBoundary(objects, &node);
+    ComputePartition(objects, params, &node);
+
+    if (SplitToSubNodes(node, objects, params, depth)) {
+      std::vector<ObjectPtr> left_subnode_objects;
+      std::vector<ObjectPtr> right_subnode_objects;
+      std::vector<ObjectPtr> other_objects;
+      PartitionObjects(node, objects, &left_subnode_objects,
+                       &right_subnode_objects, &other_objects);
+      InitObjects(other_objects, &node);
+      nodes_[index] = node;
+
+      // Split to sub-nodes.
+      if (!left_subnode_objects.empty()) {
+        const int left_subnode =
+            BuildNode(left_subnode_objects, params, depth + 1);
+        nodes_[index].left_subnode = left_subnode;
+      }
+      if (!right_subnode_objects.empty()) {
+        const int right_subnode =
+            BuildNode(right_subnode_objects, params, depth + 1);
+        nodes_[index].right_subnode = right_subnode;
       }
     } else {
-      if (left_subnode_ != nullptr) {
-        left_subnode_->GetNearestObjectInternal(point, min_distance_sqr,
-                                                nearest_object);
+      InitObjects(objects, &node);
+      nodes_[index] = node;
+    }
+    nodes_[index].subtree_end =
+        static_cast<int>(objects_sorted_by_min_.size());
+    return index;
+  }
+
+  void InitObjects(const std::vector<ObjectPtr> &objects, Node *const node) {
+    std::vector<int> sorted_by_min(objects.size());
+    std::iota(sorted_by_min.begin(), sorted_by_min.end(), 0);
+    std::vector<int> sorted_by_max = sorted_by_min;
+    const Partition partition = node->partition;
+    std::sort(sorted_by_min.begin(), sorted_by_min.end(),
+              [&objects, partition](const int i1, const int i2) {
+                const AABox2d &box1 = objects[i1]->aabox();
+                const AABox2d &box2 = objects[i2]->aabox();
+                return partition == PARTITION_X ? box1.min_x() < box2.min_x()
+                                                : box1.min_y() < box2.min_y();
+              });
+    std::sort(sorted_by_max.begin(), sorted_by_max.end(),
+              [&objects, partition](const int i1, const int i2) {
+                const AABox2d &box1 = objects[i1]->aabox();
+                const AABox2d &box2 = objects[i2]->aabox();
+                return partition == PARTITION_X ? box1.max_x() > box2.max_x()
+                                                : box1.max_y() > box2.max_y();
+              });
+    node->objects_begin = static_cast<int>(objects_sorted_by_min_.size());
+    // Where each object lands in objects_sorted_by_min_.
+    std::vector<int> min_order_index(objects.size());
+    for (const int i : sorted_by_min) {
+      ObjectPtr object = objects[i];
+      min_order_index[i] = static_cast<int>(objects_sorted_by_min_.size());
+      objects_sorted_by_min_.push_back(object);
+      objects_sorted_by_min_bound_.push_back(partition == PARTITION_X
+                                                 ? object->aabox().min_x()
+                                                 : object->aabox().min_y());
+      if constexpr (kLineSegmentObjects) {
+        segments_.Append(*object->geo_object());
+      }
+    }
+    for (const int i : sorted_by_max) {
+      ObjectPtr object = objects[i];
+      objects_sorted_by_max_.push_back(object);
+      objects_sorted_by_max_bound_.push_back(partition == PARTITION_X
+                                                 ? object->aabox().max_x()
+                                                 : object->aabox().max_y());
+      if constexpr (kLineSegmentObjects) {
+        objects_sorted_by_max_index_.push_back(min_order_index[i]);
       }
     }
+    node->objects_end = static_cast<int>(objects_sorted_by_min_.size());
   }
 
-  void ComputeBoundary(const std::vector<ObjectPtr> &objects) {
-    min_x_ = std::numeric_limits<double>::infinity();
-    min_y_ = std::numeric_limits<double>::infinity();
-    max_x_ = -std::numeric_limits<double>::infinity();
-    max_y_ = -std::numeric_limits<double>::infinity();
+  static bool SplitToSubNodes(const Node &node,
+                              const std::vector<ObjectPtr> &objects,
+                              const AABoxKDTreeParams &params,
+                              const int depth) {
+    if (params.max_depth >= 0 && depth >= params.max_depth) {
+      return false;
+    }
+    if (static_cast<int>(objects.size()) <= std::max(1, params.max_leaf_size)) {
+      return false;
+    }
+    if (params.max_leaf_dimension >= 0.0 &&
+        std::max(node.max_x - node.min_x, node.max_y - node.min_y) <=
+            params.max_leaf_dimension) {
+      return false;
+    }
+    return true;
+  }
+
+  static void ComputeBoundary(const std::vector<ObjectPtr> &objects,
+                              Node *const node) {
+    node->min_x = std::numeric_limits<double>::infinity();
+    node->min_y = std::numeric_limits<double>::infinity();
+    node->max_x = -std::numeric_limits<double>::infinity();
+    node->max_y = -std::numeric_limits<double>::infinity();
     for (ObjectPtr object : objects) {
-      min_x_ = std::fmin(min_x_, object->aabox().min_x());
-      max_x_ = std::fmax(max_x_, object->aabox().max_x());
-      min_y_ = std::fmin(min_y_, object->aabox().min_y());
-      max_y_ = std::fmax(max_y_, object->aabox().max_y());
-    }
-    mid_x_ = (min_x_ + max_x_) / 2.0;
-    mid_y_ = (min_y_ + max_y_) / 2.0;
-    ACHECK(!std::isinf(max_x_) && !std::isinf(max_y_) && !std::isinf(min_x_) &&
-           !std::isinf(min_y_))
+      node->min_x = std::fmin(node->min_x, object->aabox().min_x());
+      node->max_x = std::fmax(node->max_x, object->aabox().max_x());
+      node->min_y = std::fmin(node->min_y, object->aabox().min_y());
+      node->max_y = std::fmax(node->max_y, object->aabox().max_y());
+    }
+    node->mid_x = (node->min_x + node->max_x) / 2.0;
+    node->mid_y = (node->min_y + node->max_y) / 2.0;
+    ACHECK(!std::isinf(node->max_x) && !std::isinf(node->max_y) &&
+           !std::isinf(node->min_x) && !std::isinf(node->min_y))
         << "the provided object box size is infinity";
   }
 
-  void ComputePartition() {
-    if (max_x_ - min_x_ >= max_y_ - min_y_) {
-      partition_ = PARTITION_X;
-      partition_position_ = (min_x_ + max_x_) / 2.0;
+  static void ComputePartition(const std::vector<ObjectPtr> &objects,
+                               const AABoxKDTreeParams &params,
+                               Node *const node) {
+    if (node->max_x - node->min_x >= node->max_y - node->min_y) {
+      node->partition = PARTITION_X;
+      node->partition_position = (node->min_x + node->max_x) / 2.0;
     } else {
-      partition_ = PARTITION_Y;
-      partition_position_ = (min_y_ + max_y_) / 2.0;
+      node->partition = PARTITION_Y;
+      node->partition_position = (node->min_y + node->max_y) / 2.0;
+    }
+    if (params.split == AABoxKDTreeSplit::OBJECT_MEDIAN) {
+      ComputeObjectMedianPartition(objects, node);
+    } else if (params.split == AABoxKDTreeSplit::SURFACE_AREA) {
+      ComputeSurfaceAreaPartition(objects, node);
+    }
+  }
+
+  // Moves the partition of the node's longer axis to the median of the
+  // objects' centers. The midpoint stays if the median is on the node's
+  // boundary, where one child would get every object.
+  static void ComputeObjectMedianPartition(
+      const std::vector<ObjectPtr> &objects, Node *const node) {
+    const bool along_x = node->partition == PARTITION_X;
+    std::vector<double> centers;
+    centers.reserve(objects.size());
+    for (ObjectPtr object : objects) {
+      centers.push_back(along_x ? object->aabox().center_x()
+                                : object->aabox().center_y());
+    }
+    const auto median = centers.begin() + centers.size() / 2;
+    std::nth_element(centers.begin(), median, centers.end());
+    const double min = along_x ? node->min_x : node->min_y;
+    const double max = along_x ? node->max_x : node->max_y;
+    if (*median > min && *median < max) {
+      node->partition_position = *median;
+    }
+  }
+
+  // Tries kNumBins - 1 evenly spaced positions along each axis, counting
+  // objects by which bins their bounds fall into, and keeps the cheapest.
+  // The positions are strictly inside the node, so neither child can get
+  // every object.
+  static void ComputeSurfaceAreaPartition(
+      const std::vector<ObjectPtr> &objects, Node *const node) {
+    constexpr int kNumBins = 32;
+    const double width = node->max_x - node->min_x;
+    const double height = node->max_y - node->min_y;
+    const int num_objects = static_cast<int>(objects.size());
+    double min_cost = std::numeric_limits<double>::infinity();
+    for (const Partition partition : {PARTITION_X, PARTITION_Y}) {
+      const bool along_x = partition == PARTITION_X;
+      const double start = along_x ? node->min_x : node->min_y;
+      const double extent = along_x ? width : height;
+      const double across = along_x ? height : width;
+      if (extent <= 0.0) {
+        continue;
+      }
+      auto bin_of = [&](const double value) {
+        const int bin = static_cast<int>((value - start) / extent * kNumBins);
+        return std::min(kNumBins - 1, std::max(0, bin));
+      };
+      // Objects whose upper, respectively lower, bound falls into each bin.
+      std::array<int, kNumBins> max_counts{};
+      std::array<int, kNumBins> min_counts{};
+      for (ObjectPtr object : objects) {
+        const AABox2d &box = object->aabox();
+        ++max_counts[bin_of(along_x ? box.max_x() : box.max_y())];
+        ++min_counts[bin_of(along_x ? box.min_x() : box.min_y())];
+      }
+      int num_left = 0;
+      int num_right = num_objects - min_counts[0];
+      for (int bin = 1; bin < kNumBins; ++bin) {
+        num_left += max_counts[bin - 1];
+        const double fraction = static_cast<double>(bin) / kNumBins;
+        const double left_half_perimeter = extent * fraction + across;
+        const double right_half_perimeter =
+            extent * (1.0 - fraction) + across;
+        const double cost =
+            (num_objects - num_left - num_right) +
+            (num_left * left_half_perimeter +
+             num_right * right_half_perimeter) /
+                (extent + across);
+        if (cost < min_cost) {
+          min_cost = cost;
+          node->partition = partition;
+          node->partition_position = start + extent * fraction;
+        }
+        num_right -= min_counts[bin];
+      }
     }
   }
 
-  void PartitionObjects(const std::vector<ObjectPtr> &objects,
-                        std::vector<ObjectPtr> *const left_subnode_objects,
-                        std::vector<ObjectPtr> *const right_subnode_objects) {
-    left_subnode_objects->clear();
-    right_subnode_objects->clear();
-    std::vector<ObjectPtr> other_objects;
-    if (partition_ == PARTITION_X) {
+  static void PartitionObjects(
+      const Node &node, const std::vector<ObjectPtr> &objects,
+      std::vector<ObjectPtr> *const left_subnode_objects,
+      std::vector<ObjectPtr> *const right_subnode_objects,
+      std::vector<ObjectPtr> *const other_objects) {
+    if (node.partition == PARTITION_X) {
       for (ObjectPtr object : objects) {
-        if (object->aabox().max_x() <= partition_position_) {
+        if (object->aabox().max_x() <= node.partition_position) {
           left_subnode_objects->push_back(object);
-        } else if (object->aabox().min_x() >= partition_position_) {
+        } else if (object->aabox().min_x() >= node.partition_position) {
           right_subnode_objects->push_back(object);
         } else {
-          other_objects.push_back(object);
+          other_objects->push_back(object);
         }
       }
     } else {
       for (ObjectPtr object : objects) {
-        if (object->aabox().max_y() <= partition_position_) {
+        if (object->aabox().max_y() <= node.partition_position) {
           left_subnode_objects->push_back(object);
-        } else if (object->aabox().min_y() >= partition_position_) {
+        } else if (object->aabox().min_y() >= node.partition_position) {
           right_subnode_objects->push_back(object);
         } else {
-          other_objects.push_back(object);
+          other_objects->push_back(object);
         }
       }
     }
-    InitObjects(other_objects);
   }
 
  private:
-  int num_objects_ = 0;
+  // Nodes in preorder; the root, if any, is nodes_[0].
+  std::vector<Node> nodes_;
+
+  // The objects of all nodes, each node's range sorted along its partition
+  // axis by lower bound (ascending) and by upper bound (descending), with the
+  // sort keys alongside.
   std::vector<ObjectPtr> objects_sorted_by_min_;
   std::vector<ObjectPtr> objects_sorted_by_max_;
   std::vector<double> objects_sorted_by_min_bound_;
   std::vector<double> objects_sorted_by_max_bound_;
-  int depth_ = 0;
 
-  // Boundary
-  double min_x_ = 0.0;
-  double max_x_ = 0.0;
-  double min_y_ = 0.0;
-  double max_y_ = 0.0;
-  double mid_x_ = 0.0;
-  double mid_y_ = 0.0;
+  // Only for line segment objects: copies of the segments in the order of
+  // objects_sorted_by_min_, and for each entry of objects_sorted_by_max_ the
+  // index of the same object in objects_sorted_by_min_.
+  LineSegment2dBatch segments_;
+  std::vector<int> objects_sorted_by_max_index_;
 
-  enum Partition {
-    PARTITION_X = 1,
-    PARTITION_Y = 2,
-  };
-  Partition partition_ = PARTITION_X;
-  double partition_position_ = 0.0;
+  // In compact mode, the above sort keys and segment copies are empty, and
+  // these take their place.
+  bool compact_ = false;
+  std::vector<float> compact_sorted_by_min_bound_;
+  std::vector<float> compact_sorted_by_max_bound_;
+  CompactLineSegment2dBatch compact_segments_;
 
-  std::unique_ptr<AABoxKDTree2dNode<ObjectType>> left_subnode_ = nullptr;
-  std::unique_ptr<AABoxKDTree2dNode<ObjectType>> right_subnode_ = nullptr;
+#ifdef APOLLO_HDMAP_KDTREE_STATS
+  mutable std::mutex query_histograms_mutex_;
+  mutable AABoxKDTreeQueryHistograms query_histograms_;
+#endif
 };
 
-/**
- * @class AABoxKDTree2d
- * @brief The class of KD-tree of Aligned Axis Bounding Box(AABox).
- */
-template <class ObjectType>
-class AABoxKDTree2d {
- public:
-  using ObjectPtr = const ObjectType *;
-
-  /**
-   * @brief Constructor which takes a vector of objects and parameters.
-   * @param params Parameters to build the KD-tree.
-   */
-  AABoxKDTree2d(const std::vector<ObjectType> &objects,
-                const AABoxKDTreeParams &params) {
-    if (!objects.empty()) {
-      std::vector<ObjectPtr> object_ptrs;
-      for (const auto &object : objects) {
-        object_ptrs.push_back(&object);
-      }
-      root_.reset(new AABoxKDTree2dNode<ObjectType>(object_ptrs, params, 0));
-    }
-  }
-
-  /**
-   * @brief Get the nearest object to a target point.
-   * @param point The target point. Search it's nearest object.
-   * @return The nearest object to the target point.
-   */
-  ObjectPtr GetNearestObject(const Vec2d &point) const {
-    return root_ == nullptr ? nullptr : root_->GetNearestObject(point);
-  }
-
-  /**
-   * @brief Get objects within a distance to a point.
-   * @param point The center point of the range to search objects.
-   * @param distance The radius of the range to search objects.
-   * @return All objects within the specified distance to the specified point.
-   */
-  std::vector<ObjectPtr> GetObjects(const Vec2d &point,
-                                    const double distance) const {
-    if (root_ == nullptr) {
-      return {};
-    }
-    return root_->GetObjects(point, distance);
-  }
-
-  /**
-   * @brief Get the axis-aligned bounding box of the objects.
-   * @return The axis-aligned bounding box of the objects.
-   */
-  AABox2d GetBoundingBox() const {
-    return root_ == nullptr ? AABox2d() : root_->GetBoundingBox();
-  }
-
- private:
-  std::unique_ptr<AABoxKDTree2dNode<ObjectType>> root_ = nullptr;
-};
+#undef APOLLO_HDMAP_KDTREE_COUNT
 
 }  // namespace math
 }  // namespace common
@@ -0,0 +1,384 @@
+/******************************************************************************
+ * Copyright 2017 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "math/line_segment2d_batch.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define APOLLO_HDMAP_HAS_AVX2_KERNEL 1
+#endif
+
+namespace apollo {
+namespace common {
+namespace math {
+namespace {
+
+// The float distances of CompactLineSegment2dBatch are within this fraction
+// of the magnitude of their inputs of the exact ones. Rounding the inputs and
+// evaluating in float contribute some 50 float epsilons; this allows 128.
+constexpr double kCompactRelativeError = 128.0 / (1 << 24);
+
+#ifdef APOLLO_HDMAP_HAS_AVX2_KERNEL
+bool CpuSupportsAvx2() {
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+
+// Four lanes of LineSegment2d::DistanceSquareTo. Every lane performs the
+// scalar path's multiplies, adds and comparisons without fusing them, and the
+// branches become blends, so the results match bit for bit. A zero-length
+// segment has a zero unit direction, so its projection is zero and it takes
+// the distance to its start, as in the scalar path.
+__attribute__((target("avx2"))) __m256d DistanceSquareAvx2(
+    const __m256d point_x, const __m256d point_y, const __m256d start_x,
+    const __m256d start_y, const __m256d end_x, const __m256d end_y,
+    const __m256d unit_direction_x, const __m256d unit_direction_y,
+    const __m256d length) {
+  const __m256d x0 = _mm256_sub_pd(point_x, start_x);
+  const __m256d y0 = _mm256_sub_pd(point_y, start_y);
+  const __m256d proj = _mm256_add_pd(_mm256_mul_pd(x0, unit_direction_x),
+                                     _mm256_mul_pd(y0, unit_direction_y));
+  const __m256d start_distance_sqr =
+      _mm256_add_pd(_mm256_mul_pd(x0, x0), _mm256_mul_pd(y0, y0));
+  const __m256d dx = _mm256_sub_pd(point_x, end_x);
+  const __m256d dy = _mm256_sub_pd(point_y, end_y);
+  const __m256d end_distance_sqr =
+      _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+  const __m256d cross = _mm256_sub_pd(_mm256_mul_pd(x0, unit_direction_y),
+                                      _mm256_mul_pd(y0, unit_direction_x));
+  const __m256d line_distance_sqr = _mm256_mul_pd(cross, cross);
+  const __m256d before_start =
+      _mm256_cmp_pd(proj, _mm256_setzero_pd(), _CMP_LE_OQ);
+  const __m256d after_end = _mm256_cmp_pd(proj, length, _CMP_GE_OQ);
+  const __m256d result =
+      _mm256_blendv_pd(line_distance_sqr, end_distance_sqr, after_end);
+  return _mm256_blendv_pd(result, start_distance_sqr, before_start);
+}
+
+__attribute__((target("avx2"))) int DistanceSquareRangeAvx2(
+    const Vec2d &point, const double *start_x, const double *start_y,
+    const double *end_x, const double *end_y, const double *unit_direction_x,
+    const double *unit_direction_y, const double *length, const int size,
+    double *distances_sqr) {
+  const __m256d point_x = _mm256_set1_pd(point.x());
+  const __m256d point_y = _mm256_set1_pd(point.y());
+  int i = 0;
+  for (; i + 4 <= size; i += 4) {
+    _mm256_storeu_pd(
+        distances_sqr + i,
+        DistanceSquareAvx2(point_x, point_y, _mm256_loadu_pd(start_x + i),
+                           _mm256_loadu_pd(start_y + i),
+                           _mm256_loadu_pd(end_x + i),
+                           _mm256_loadu_pd(end_y + i),
+                           _mm256_loadu_pd(unit_direction_x + i),
+                           _mm256_loadu_pd(unit_direction_y + i),
+                           _mm256_loadu_pd(length + i)));
+  }
+  return i;
+}
+
+// Gathers base[index[i]] through the masked gather with a zero source and
+// all lanes enabled. GCC 12 warns that the plain gather may read an
+// uninitialized register, which it leaves as its source operand.
+__attribute__((target("avx2"))) __m256d Gather(const double *base,
+                                              const __m128i index) {
+  return _mm256_mask_i32gather_pd(
+      _mm256_setzero_pd(), base, index,
+      _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+}
+
+__attribute__((target("avx2"))) int DistanceSquareIndexedAvx2(
+    const Vec2d &point, const double *start_x, const double *start_y,
+    const double *end_x, const double *end_y, const double *unit_direction_x,
+    const double *unit_direction_y, const double *length, const int *indices,
+    const int num_indices, double *distances_sqr) {
+  const __m256d point_x = _mm256_set1_pd(point.x());
+  const __m256d point_y = _mm256_set1_pd(point.y());
+  int i = 0;
+  for (; i + 4 <= num_indices; i += 4) {
+    const __m128i index = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(indices + i));
+    _mm256_storeu_pd(
+        distances_sqr + i,
+        DistanceSquareAvx2(point_x, point_y, Gather(start_x, index),
+                           Gather(start_y, index), Gather(end_x, index),
+                           Gather(end_y, index),
+                           Gather(unit_direction_x, index),
+                           Gather(unit_direction_y, index),
+                           Gather(length, index)));
+  }
+  return i;
+}
+
+// Eight lanes of CompactLineSegment2dBatch::DistanceSquareTo.
+__attribute__((target("avx2"))) __m256 DistanceSquareAvx2(
+    const __m256 point_x, const __m256 point_y, const __m256 start_x,
+    const __m256 start_y, const __m256 end_x, const __m256 end_y,
+    const __m256 unit_direction_x, const __m256 unit_direction_y,
+    const __m256 length) {
+  const __m256 x0 = _mm256_sub_ps(point_x, start_x);
+  const __m256 y0 = _mm256_sub_ps(point_y, start_y);
+  const __m256 proj = _mm256_add_ps(_mm256_mul_ps(x0, unit_direction_x),
+                                    _mm256_mul_ps(y0, unit_direction_y));
+  const __m256 start_distance_sqr =
+      _mm256_add_ps(_mm256_mul_ps(x0, x0), _mm256_mul_ps(y0, y0));
+  const __m256 dx = _mm256_sub_ps(point_x, end_x);
+  const __m256 dy = _mm256_sub_ps(point_y, end_y);
+  const __m256 end_distance_sqr =
+      _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+  const __m256 cross = _mm256_sub_ps(_mm256_mul_ps(x0, unit_direction_y),
+                                     _mm256_mul_ps(y0, unit_direction_x));
+  const __m256 line_distance_sqr = _mm256_mul_ps(cross, cross);
+  const __m256 before_start =
+      _mm256_cmp_ps(proj, _mm256_setzero_ps(), _CMP_LE_OQ);
+  const __m256 after_end = _mm256_cmp_ps(proj, length, _CMP_GE_OQ);
+  const __m256 result =
+      _mm256_blendv_ps(line_distance_sqr, end_distance_sqr, after_end);
+  return _mm256_blendv_ps(result, start_distance_sqr, before_start);
+}
+
+__attribute__((target("avx2"))) int CompactDistanceSquareRangeAvx2(
+    const Vec2d &point, const float *start_x, const float *start_y,
+    const float *end_x, const float *end_y, const float *unit_direction_x,
+    const float *unit_direction_y, const float *length, const int size,
+    float *distances_sqr) {
+  const __m256 point_x = _mm256_set1_ps(static_cast<float>(point.x()));
+  const __m256 point_y = _mm256_set1_ps(static_cast<float>(point.y()));
+  int i = 0;
+  for (; i + 8 <= size; i += 8) {
+    _mm256_storeu_ps(
+        distances_sqr + i,
+        DistanceSquareAvx2(point_x, point_y, _mm256_loadu_ps(start_x + i),
+                           _mm256_loadu_ps(start_y + i),
+                           _mm256_loadu_ps(end_x + i),
+                           _mm256_loadu_ps(end_y + i),
+                           _mm256_loadu_ps(unit_direction_x + i),
+                           _mm256_loadu_ps(unit_direction_y + i),
+                           _mm256_loadu_ps(length + i)));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) __m256 Gather(const float *base,
+                                             const __m256i index) {
+  return _mm256_mask_i32gather_ps(
+      _mm256_setzero_ps(), base, index,
+      _mm256_castsi256_ps(_mm256_set1_epi32(-1)), 4);
+}
+
+__attribute__((target("avx2"))) int CompactDistanceSquareIndexedAvx2(
+    const Vec2d &point, const float *start_x, const float *start_y,
+    const float *end_x, const float *end_y, const float *unit_direction_x,
+    const float *unit_direction_y, const float *length, const int *indices,
+    const int num_indices, float *distances_sqr) {
+  const __m256 point_x = _mm256_set1_ps(static_cast<float>(point.x()));
+  const __m256 point_y = _mm256_set1_ps(static_cast<float>(point.y()));
+  int i = 0;
+  for (; i + 8 <= num_indices; i += 8) {
+    const __m256i index = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(indices + i));
+    _mm256_storeu_ps(
+        distances_sqr + i,
+        DistanceSquareAvx2(point_x, point_y, Gather(start_x, index),
+                           Gather(start_y, index), Gather(end_x, index),
+                           Gather(end_y, index),
+                           Gather(unit_direction_x, index),
+                           Gather(unit_direction_y, index),
+                           Gather(length, index)));
+  }
+  return i;
+}
+#endif
+
+}  // namespace
+
+void LineSegment2dBatch::Reserve(const int size) {
+  start_x_.reserve(size);
+  start_y_.reserve(size);
+  end_x_.reserve(size);
+  end_y_.reserve(size);
+  unit_direction_x_.reserve(size);
+  unit_direction_y_.reserve(size);
+  length_.reserve(size);
+}
+
+void LineSegment2dBatch::Append(const LineSegment2d &segment) {
+  start_x_.push_back(segment.start().x());
+  start_y_.push_back(segment.start().y());
+  end_x_.push_back(segment.end().x());
+  end_y_.push_back(segment.end().y());
+  unit_direction_x_.push_back(segment.unit_direction().x());
+  unit_direction_y_.push_back(segment.unit_direction().y());
+  length_.push_back(segment.length());
+}
+
+void LineSegment2dBatch::Append(const LineSegment2dBatch &other) {
+  auto append = [](const std::vector<double> &from, std::vector<double> *to) {
+    to->insert(to->end(), from.begin(), from.end());
+  };
+  append(other.start_x_, &start_x_);
+  append(other.start_y_, &start_y_);
+  append(other.end_x_, &end_x_);
+  append(other.end_y_, &end_y_);
+  append(other.unit_direction_x_, &unit_direction_x_);
+  append(other.unit_direction_y_, &unit_direction_y_);
+  append(other.length_, &length_);
+}
+
+double LineSegment2dBatch::DistanceSquareTo(const Vec2d &point,
+                                            const int index) const {
+  const double x0 = point.x() - start_x_[index];
+  const double y0 = point.y() - start_y_[index];
+  const double proj =
+      x0 * unit_direction_x_[index] + y0 * unit_direction_y_[index];
+  if (proj <= 0.0) {
+    return x0 * x0 + y0 * y0;
+  }
+  if (proj >= length_[index]) {
+    const double dx = point.x() - end_x_[index];
+    const double dy = point.y() - end_y_[index];
+    return dx * dx + dy * dy;
+  }
+  const double cross =
+      x0 * unit_direction_y_[index] - y0 * unit_direction_x_[index];
+  return cross * cross;
+}
+
+void LineSegment2dBatch::DistanceSquareTo(const Vec2d &point, const int begin,
+                                          const int end,
+                                          double *distances_sqr) const {
+  int i = 0;
+#ifdef APOLLO_HDMAP_HAS_AVX2_KERNEL
+  if (CpuSupportsAvx2()) {
+    i = DistanceSquareRangeAvx2(
+        point, start_x_.data() + begin, start_y_.data() + begin,
+        end_x_.data() + begin, end_y_.data() + begin,
+        unit_direction_x_.data() + begin, unit_direction_y_.data() + begin,
+        length_.data() + begin, end - begin, distances_sqr);
+  }
+#endif
+  for (; begin + i < end; ++i) {
+    distances_sqr[i] = DistanceSquareTo(point, begin + i);
+  }
+}
+
+void LineSegment2dBatch::DistanceSquareTo(const Vec2d &point,
+                                          const int *indices,
+                                          const int num_indices,
+                                          double *distances_sqr) const {
+  int i = 0;
+#ifdef APOLLO_HDMAP_HAS_AVX2_KERNEL
+  if (CpuSupportsAvx2()) {
+    i = DistanceSquareIndexedAvx2(
+        point, start_x_.data(), start_y_.data(), end_x_.data(), end_y_.data(),
+        unit_direction_x_.data(), unit_direction_y_.data(), length_.data(),
+        indices, num_indices, distances_sqr);
+  }
+#endif
+  for (; i < num_indices; ++i) {
+    distances_sqr[i] = DistanceSquareTo(point, indices[i]);
+  }
+}
+
+void CompactLineSegment2dBatch::Reserve(const int size) {
+  start_x_.reserve(size);
+  start_y_.reserve(size);
+  end_x_.reserve(size);
+  end_y_.reserve(size);
+  unit_direction_x_.reserve(size);
+  unit_direction_y_.reserve(size);
+  length_.reserve(size);
+}
+
+void CompactLineSegment2dBatch::Append(const LineSegment2d &segment,
+                                       const Vec2d &origin) {
+  start_x_.push_back(static_cast<float>(segment.start().x() - origin.x()));
+  start_y_.push_back(static_cast<float>(segment.start().y() - origin.y()));
+  end_x_.push_back(static_cast<float>(segment.end().x() - origin.x()));
+  end_y_.push_back(static_cast<float>(segment.end().y() - origin.y()));
+  unit_direction_x_.push_back(static_cast<float>(segment.unit_direction().x()));
+  unit_direction_y_.push_back(static_cast<float>(segment.unit_direction().y()));
+  length_.push_back(static_cast<float>(segment.length()));
+}
+
+float CompactLineSegment2dBatch::DistanceSquareTo(const float point_x,
+                                                  const float point_y,
+                                                  const int index) const {
+  const float x0 = point_x - start_x_[index];
+  const float y0 = point_y - start_y_[index];
+  const float proj =
+      x0 * unit_direction_x_[index] + y0 * unit_direction_y_[index];
+  if (proj <= 0.0f) {
+    return x0 * x0 + y0 * y0;
+  }
+  if (proj >= length_[index]) {
+    const float dx = point_x - end_x_[index];
+    const float dy = point_y - end_y_[index];
+    return dx * dx + dy * dy;
+  }
+  const float cross =
+      x0 * unit_direction_y_[index] - y0 * unit_direction_x_[index];
+  return cross * cross;
+}
+
+double CompactLineSegment2dBatch::MaxDistanceError(const double magnitude) {
+  return magnitude * kCompactRelativeError;
+}
+
+void CompactLineSegment2dBatch::DistanceSquareTo(const Vec2d &point,
+                                                 const int begin,
+                                                 const int end,
+                                                 float *distances_sqr) const {
+  int i = 0;
+#ifdef APOLLO_HDMAP_HAS_AVX2_KERNEL
+  if (CpuSupportsAvx2()) {
+    i = CompactDistanceSquareRangeAvx2(
+        point, start_x_.data() + begin, start_y_.data() + begin,
+        end_x_.data() + begin, end_y_.data() + begin,
+        unit_direction_x_.data() + begin, unit_direction_y_.data() + begin,
+        length_.data() + begin, end - begin, distances_sqr);
+  }
+#endif
+  const auto point_x = static_cast<float>(point.x());
+  const auto point_y = static_cast<float>(point.y());
+  for (; begin + i < end; ++i) {
+    distances_sqr[i] = DistanceSquareTo(point_x, point_y, begin + i);
+  }
+}
+
+void CompactLineSegment2dBatch::DistanceSquareTo(const Vec2d &point,
+                                                 const int *indices,
+                                                 const int num_indices,
+                                                 float *distances_sqr) const {
+  int i = 0;
+#ifdef APOLLO_HDMAP_HAS_AVX2_KERNEL
+  if (CpuSupportsAvx2()) {
+    i = CompactDistanceSquareIndexedAvx2(
+        point, start_x_.data(), start_y_.data(), end_x_.data(), end_y_.data(),
+        unit_direction_x_.data(), unit_direction_y_.data(), length_.data(),
+        indices, num_indices, distances_sqr);
+  }
+#endif
+  const auto point_x = static_cast<float>(point.x());
+  const auto point_y = static_cast<float>(point.y());
+  for (; i < num_indices; ++i) {
+    distances_sqr[i] = DistanceSquareTo(point_x, point_y, indices[i]);
+  }
+}
+
+}  // namespace math
+}  // namespace common
+}  // namespace apollo
@@ -0,0 +1,197 @@
+/******************************************************************************
+ * Copyright 2017 The Apollo Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+/**
+ * @file
+ * @brief Define the LineSegment2dBatch and CompactLineSegment2dBatch classes.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "math/line_segment2d.h"
+#include "math/vec2d.h"
+
+/**
+ * @namespace apollo::common::math
+ * @brief apollo::common::math
+ */
+namespace apollo {
+namespace common {
+namespace math {
+
+/**
+ * @class LineSegment2dBatch
+ * @brief Copies of line segments laid out as structure of arrays, so that the
+ *        distances from a point to several segments can be computed at once.
+ *
+ * Distances are computed with the same operations, in the same order, as
+ * LineSegment2d::DistanceSquareTo, so both give bit-identical results. On x86
+ * CPUs with AVX2 four segments are processed per instruction; elsewhere a
+ * scalar loop is used.
+ */
+class LineSegment2dBatch {
+ public:
+  /**
+   * @brief Reserve space for a number of segments.
+   * @param size The number of segments.
+   */
+  void Reserve(int size);
+
+  /**
+   * @brief Append a copy of a segment.
+   * @param segment The segment to append.
+   */
+  void Append(const LineSegment2d &segment);
+
+  /**
+   * @brief Append copies of all segments of another batch.
+   * @param other The batch to append.
+   */
+  void Append(const LineSegment2dBatch &other);
+
+  /**
+   * @brief Get the number of segments.
+   * @return The number of segments.
+   */
+  int size() const { return static_cast<int>(length_.size()); }
+
+  /**
+   * @brief Get the memory of the copies.
+   * @return The number of bytes.
+   */
+  size_t num_bytes() const { return 7 * sizeof(double) * length_.size(); }
+
+  /**
+   * @brief Compute the squared distances from a point to the segments
+   *        [begin, end).
+   * @param point The point to compute the distances to.
+   * @param begin The index of the first segment.
+   * @param end One past the index of the last segment.
+   * @param distances_sqr Output, end - begin squared distances.
+   */
+  void DistanceSquareTo(const Vec2d &point, int begin, int end,
+                        double *distances_sqr) const;
+
+  /**
+   * @brief Compute the squared distances from a point to the segments at
+   *        the given indices.
+   * @param point The point to compute the distances to.
+   * @param indices The indices of the segments.
+   * @param num_indices The number of indices.
+   * @param distances_sqr Output, num_indices squared distances.
+   */
+  void DistanceSquareTo(const Vec2d &point, const int *indices,
+                        int num_indices, double *distances_sqr) const;
+
+ private:
+  double DistanceSquareTo(const Vec2d &point, int index) const;
+
+  std::vector<double> start_x_;
+  std::vector<double> start_y_;
+  std::vector<double> end_x_;
+  std::vector<double> end_y_;
+  std::vector<double> unit_direction_x_;
+  std::vector<double> unit_direction_y_;
+  std::vector<double> length_;
+};
+
+/**
+ * @class CompactLineSegment2dBatch
+ * @brief Like LineSegment2dBatch, but with float copies of the segments,
+ *        relative to an origin given per segment, for half the memory and
+ *        twice the segments per instruction.
+ *
+ * The distances are computed in float, within MaxDistanceError() of the
+ * exact ones. Callers widen their thresholds by that error to rule segments
+ * in or out, and compute the exact distance of the few that are too close to
+ * call.
+ */
+class CompactLineSegment2dBatch {
+ public:
+  /**
+   * @brief Reserve space for a number of segments.
+   * @param size The number of segments.
+   */
+  void Reserve(int size);
+
+  /**
+   * @brief Append a copy of a segment, relative to an origin.
+   * @param segment The segment to append.
+   * @param origin The point the copy is relative to.
+   */
+  void Append(const LineSegment2d &segment, const Vec2d &origin);
+
+  /**
+   * @brief Get the number of segments.
+   * @return The number of segments.
+   */
+  int size() const { return static_cast<int>(length_.size()); }
+
+  /**
+   * @brief Get the memory of the copies.
+   * @return The number of bytes.
+   */
+  size_t num_bytes() const { return 7 * sizeof(float) * length_.size(); }
+
+  /**
+   * @brief Get how far the float distances of this class may be from the
+   *        exact ones.
+   * @param magnitude An upper bound of the absolute coordinates of the point
+   *        and of the segments, relative to their origin.
+   * @return The maximum error of a distance, not squared.
+   */
+  static double MaxDistanceError(double magnitude);
+
+  /**
+   * @brief Compute the float squared distances from a point to the segments
+   *        [begin, end).
+   * @param point The point, relative to the origin of the segments.
+   * @param begin The index of the first segment.
+   * @param end One past the index of the last segment.
+   * @param distances_sqr Output, end - begin squared distances.
+   */
+  void DistanceSquareTo(const Vec2d &point, int begin, int end,
+                        float *distances_sqr) const;
+
+  /**
+   * @brief Compute the float squared distances from a point to the segments
+   *        at the given indices.
+   * @param point The point, relative to the origin of the segments.
+   * @param indices The indices of the segments.
+   * @param num_indices The number of indices.
+   * @param distances_sqr Output, num_indices squared distances.
+   */
+  void DistanceSquareTo(const Vec2d &point, const int *indices,
+                        int num_indices, float *distances_sqr) const;
+
+ private:
+  float DistanceSquareTo(float point_x, float point_y, int index) const;
+
+  std::vector<float> start_x_;
+  std::vector<float> start_y_;
+  std::vector<float> end_x_;
+  std::vector<float> end_y_;
+  std::vector<float> unit_direction_x_;
+  std::vector<float> unit_direction_y_;
+  std::vector<float> length_;
+};
+
+}  // namespace math
+}  // namespace common
+}  // namespace apollo
@@ -0,0 +1,83 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "hdmap_element_table.h"
+
+/**
+ * @namespace apollo::hdmap
+ * @brief apollo::hdmap
+ */
+namespace apollo {
+namespace hdmap {
+
+/**
+ * @class QueryContext
+ *
+ * @brief Reusable scratch state for the map queries that report raw element
+ * pointers.
+ *
+ * The context only grows, to the size of the largest element table it has
+ * been used with, so once warmed up those queries make no heap allocations.
+ * A context must not be shared by concurrent queries; use one per thread.
+ */
+class QueryContext {
+ public:
+  /**
+   * @brief start a new pass of Mark() calls, forgetting all marks of the
+   * previous pass in O(1).
+   * @param num_handles one past the largest handle that will be marked
+   */
+  void StartPass(size_t num_handles) {
+    if (stamps_.size() < num_handles) {
+      stamps_.resize(num_handles, 0);
+    }
+    // A handle is marked in this pass iff its stamp equals the epoch.
+    if (++epoch_ == 0) {
+      std::fill(stamps_.begin(), stamps_.end(), 0);
+      epoch_ = 1;
+    }
+  }
+
+  /// Whether a handle is already marked in the current pass.
+  bool IsMarked(ElementHandle handle) const {
+    return stamps_[handle] == epoch_;
+  }
+
+  /**
+   * @brief mark a handle in the current pass
+   * @param handle a handle below the num_handles given to StartPass()
+   * @return true if the handle was not marked yet in this pass
+   */
+  bool Mark(ElementHandle handle) {
+    if (IsMarked(handle)) {
+      return false;
+    }
+    stamps_[handle] = epoch_;
+    return true;
+  }
+
+ private:
+  std::vector<uint32_t> stamps_;
+  uint32_t epoch_ = 0;
+};
+
+}  // namespace hdmap
+}  // namespace apollo
@@ -0,0 +1,179 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @namespace apollo::hdmap
+ * @brief apollo::hdmap
+ */
+namespace apollo {
+namespace hdmap {
+
+/**
+ * @class ThreadPool
+ *
+ * @brief A fixed set of worker threads for data-parallel map queries and
+ * map loading.
+ *
+ * ParallelFor may be called from inside a task of the same pool. A caller
+ * that waits for its chunks runs queued tasks in the meantime, so an idle
+ * thread always picks up the remaining work, whichever loop it belongs to.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_workers) {
+    for (int i = 0; i < num_workers; ++i) {
+      workers_.emplace_back([this]() { WorkerLoop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  int num_workers() const { return static_cast<int>(workers_.size()); }
+
+  /**
+   * @brief split [0, size) into num_chunks contiguous chunks and run
+   * fn(begin, end) on each of them. The calling thread takes part, and the
+   * call returns once every chunk is done.
+   * @param size number of items
+   * @param num_chunks number of chunks to split the items into
+   * @param fn chunk callback
+   */
+  void ParallelFor(size_t size, size_t num_chunks,
+                   const std::function<void(size_t, size_t)>& fn) {
+    num_chunks = std::max<size_t>(1, std::min(num_chunks, size));
+    if (num_chunks == 1 || workers_.empty()) {
+      if (size > 0) {
+        fn(0, size);
+      }
+      return;
+    }
+    const size_t chunk_size = (size + num_chunks - 1) / num_chunks;
+    std::atomic<size_t> next_chunk{0};
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    const size_t num_helpers = std::min(workers_.size(), num_chunks - 1);
+    size_t running_helpers = num_helpers;
+    auto run_chunks = [&]() {
+      size_t chunk = 0;
+      while ((chunk = next_chunk.fetch_add(1)) < num_chunks) {
+        const size_t begin = chunk * chunk_size;
+        const size_t end = std::min(size, begin + chunk_size);
+        if (begin < end) {
+          fn(begin, end);
+        }
+      }
+    };
+    for (size_t i = 0; i < num_helpers; ++i) {
+      Submit([&]() {
+        run_chunks();
+        std::lock_guard<std::mutex> lock(done_mutex);
+        if (--running_helpers == 0) {
+          done_cv.notify_one();
+        }
+      });
+    }
+    run_chunks();
+    // Helpers reference this frame, so wait for all of them to leave it.
+    // While any task is queued, which may be one of them, run it instead of
+    // blocking; otherwise nested calls could leave every worker waiting for
+    // helpers that none of them is free to run.
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        if (running_helpers == 0) {
+          return;
+        }
+      }
+      if (!RunQueuedTask()) {
+        break;
+      }
+    }
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done_cv.wait(lock, [&]() { return running_helpers == 0; });
+  }
+
+ private:
+  void Submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+  }
+
+  // Runs the oldest queued task, if there is one.
+  bool RunQueuedTask() {
+    std::function<void()> task;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (tasks_.empty()) {
+        return false;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+    return true;
+  }
+
+  void WorkerLoop() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+        if (stop_ && tasks_.empty()) {
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool stop_ = false;
+};
+
+}  // namespace hdmap
+}  // namespace apollo
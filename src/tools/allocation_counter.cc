@@ -0,0 +1,132 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+#include "tools/allocation_counter.h"
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace apollo {
+namespace hdmap {
+namespace tools {
+namespace {
+
+std::atomic<uint64_t> allocation_count{0};
+std::atomic<int64_t> allocated_bytes{0};
+
+void* Counted(void* pointer) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (pointer != nullptr) {
+    allocated_bytes.fetch_add(
+        static_cast<int64_t>(malloc_usable_size(pointer)),
+        std::memory_order_relaxed);
+  }
+  return pointer;
+}
+
+void* Allocate(const std::size_t size) {
+  return Counted(std::malloc(size == 0 ? 1 : size));
+}
+
+void* AllocateAligned(const std::size_t size, const std::align_val_t align) {
+  const std::size_t alignment = static_cast<std::size_t>(align);
+  // aligned_alloc takes a multiple of the alignment.
+  return Counted(std::aligned_alloc(
+      alignment, (std::max<std::size_t>(size, 1) + alignment - 1) /
+                     alignment * alignment));
+}
+
+void Free(void* pointer) {
+  if (pointer != nullptr) {
+    allocated_bytes.fetch_sub(
+        static_cast<int64_t>(malloc_usable_size(pointer)),
+        std::memory_order_relaxed);
+  }
+  std::free(pointer);
+}
+
+}  // namespace
+
+uint64_t AllocationCount() {
+  return allocation_count.load(std::memory_order_relaxed);
+}
+
+int64_t AllocatedBytes() {
+  return allocated_bytes.load(std::memory_order_relaxed);
+}
+
+}  // namespace tools
+}  // namespace hdmap
+}  // namespace apollo
+
+using apollo::hdmap::tools::Allocate;
+using apollo::hdmap::tools::AllocateAligned;
+using apollo::hdmap::tools::Free;
+
+void* operator new(std::size_t size) {
+  void* pointer = Allocate(size);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+  void* pointer = AllocateAligned(size, align);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+  return operator new(size, align);
+}
+
+void operator delete(void* pointer) noexcept { Free(pointer); }
+void operator delete[](void* pointer) noexcept { Free(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept {
+  Free(pointer);
+}
+void operator delete[](void* pointer, std::size_t) noexcept {
+  Free(pointer);
+}
+void operator delete(void* pointer, std::align_val_t) noexcept {
+  Free(pointer);
+}
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+  Free(pointer);
+}
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+  Free(pointer);
+}
+void operator delete[](void* pointer, std::size_t,
+                       std::align_val_t) noexcept {
+  Free(pointer);
+}
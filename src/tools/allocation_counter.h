@@ -0,0 +1,42 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Counts the heap allocations of a tool, and the bytes they hold.
+// allocation_counter.cc replaces the global operator new and delete, so only
+// the tools that are linked with it count allocations.
+
+#pragma once
+
+#include <cstdint>
+
+namespace apollo {
+namespace hdmap {
+namespace tools {
+
+/**
+ * @brief The number of calls to operator new, from any thread, since the
+ *        process started.
+ */
+uint64_t AllocationCount();
+
+/**
+ * @brief The bytes held by the blocks operator new returned and operator
+ *        delete has not freed yet, as malloc sizes them.
+ */
+int64_t AllocatedBytes();
+
+}  // namespace tools
+}  // namespace hdmap
+}  // namespace apollo
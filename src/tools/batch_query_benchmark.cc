@@ -0,0 +1,183 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Times GetNearestLaneBatch and GetLanesBatch against calling
+// GetNearestLane and GetLanes once per point, on trajectories that follow
+// the lanes, and checks that both give the same lanes. Usage:
+//
+//   batch_query_benchmark <map file> [num_points] [num_threads]
+//       [radius in meters]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "hdmap.h"
+#include "tools/tool_util.h"
+
+namespace apollo {
+namespace hdmap {
+namespace {
+
+using apollo::common::PointENU;
+using apollo::common::math::Vec2d;
+
+// Points per trajectory, about 1 meter apart along the lanes.
+constexpr int kTrajectoryLength = 100;
+
+void PrintRow(const char* name, const double per_point_ms,
+              const double batch_ms, const int num_threads,
+              const double threads_ms, const int num_mismatches) {
+  std::printf("%-14s %12.1f %10.1f %7.1fx %7d %10.1f %7.1fx %10d\n", name,
+              per_point_ms, batch_ms,
+              batch_ms > 0.0 ? per_point_ms / batch_ms : 0.0, num_threads,
+              threads_ms, threads_ms > 0.0 ? per_point_ms / threads_ms : 0.0,
+              num_mismatches);
+}
+
+int Run(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr,
+                 "Usage: %s <map file> [num_points] [num_threads] [radius]\n",
+                 argv[0]);
+    return 1;
+  }
+  const int num_points = argc > 2 ? std::atoi(argv[2]) : 100000;
+  const int num_threads =
+      argc > 3 ? std::atoi(argv[3])
+               : std::max(1, static_cast<int>(
+                                 std::thread::hardware_concurrency()));
+  const double radius = argc > 4 ? std::atof(argv[4]) : 5.0;
+
+  Map map;
+  if (!tools::LoadMap(argv[1], &map)) {
+    std::fprintf(stderr, "Failed to load map %s\n", argv[1]);
+    return 1;
+  }
+  const std::vector<Vec2d> lane_points = tools::GetLanePoints(map);
+  HDMap hdmap;
+  if (hdmap.LoadMapFromProto(std::move(map)) != 0 ||
+      lane_points.size() < kTrajectoryLength) {
+    std::fprintf(stderr, "Failed to build map %s\n", argv[1]);
+    return 1;
+  }
+
+  // Trajectories of consecutive lane points from random starts, up to a
+  // meter off the center lines.
+  std::mt19937 random_engine(1);
+  std::uniform_int_distribution<size_t> start_distribution(
+      0, lane_points.size() - kTrajectoryLength);
+  std::uniform_real_distribution<double> offset_distribution(-1.0, 1.0);
+  std::vector<Vec2d> points;
+  while (static_cast<int>(points.size()) < num_points) {
+    const size_t start = start_distribution(random_engine);
+    for (int i = 0; i < kTrajectoryLength &&
+                    static_cast<int>(points.size()) < num_points;
+         ++i) {
+      points.emplace_back(
+          lane_points[start + i].x() + offset_distribution(random_engine),
+          lane_points[start + i].y() + offset_distribution(random_engine));
+    }
+  }
+  std::vector<PointENU> points_enu;
+  for (const auto& point : points) {
+    points_enu.push_back(tools::ToPointENU(point));
+  }
+
+  std::printf("%zu points in trajectories of %d, radius %.1f m\n",
+              points.size(), kTrajectoryLength, radius);
+  std::printf("%-14s %12s %10s %8s %7s %10s %8s %10s\n", "query",
+              "per_point_ms", "batch_ms", "speedup", "threads", "threads_ms",
+              "speedup", "mismatches");
+
+  // Nearest lanes.
+  std::vector<const LaneInfo*> nearest_lanes;
+  nearest_lanes.reserve(points.size());
+  auto start = std::chrono::steady_clock::now();
+  for (const auto& point : points_enu) {
+    LaneInfoConstPtr lane;
+    double s = 0.0;
+    double l = 0.0;
+    hdmap.GetNearestLane(point, &lane, &s, &l);
+    nearest_lanes.push_back(lane.get());
+  }
+  const double nearest_ms = tools::MillisecondsSince(start);
+  std::vector<LaneProjection> projections;
+  start = std::chrono::steady_clock::now();
+  hdmap.GetNearestLaneBatch(points, 1, &projections);
+  const double nearest_batch_ms = tools::MillisecondsSince(start);
+  std::vector<LaneProjection> thread_projections;
+  start = std::chrono::steady_clock::now();
+  hdmap.GetNearestLaneBatch(points, num_threads, &thread_projections);
+  const double nearest_threads_ms = tools::MillisecondsSince(start);
+  int num_mismatches = 0;
+  for (size_t i = 0; i < points.size(); ++i) {
+    for (const auto* results : {&projections, &thread_projections}) {
+      num_mismatches +=
+          hdmap.GetLaneByHandle((*results)[i].lane_handle).get() !=
+          nearest_lanes[i];
+    }
+  }
+  PrintRow("nearest lane", nearest_ms, nearest_batch_ms, num_threads,
+           nearest_threads_ms, num_mismatches);
+
+  // Lanes in range, compared as sorted sets.
+  std::vector<std::vector<const LaneInfo*>> lanes_in_range;
+  lanes_in_range.reserve(points.size());
+  std::vector<LaneInfoConstPtr> lanes;
+  start = std::chrono::steady_clock::now();
+  for (const auto& point : points_enu) {
+    hdmap.GetLanes(point, radius, &lanes);
+    lanes_in_range.emplace_back();
+    for (const auto& lane : lanes) {
+      lanes_in_range.back().push_back(lane.get());
+    }
+  }
+  const double lanes_ms = tools::MillisecondsSince(start);
+  std::vector<std::vector<ElementHandle>> lane_handles;
+  start = std::chrono::steady_clock::now();
+  hdmap.GetLanesBatch(points, radius, 1, &lane_handles);
+  const double lanes_batch_ms = tools::MillisecondsSince(start);
+  std::vector<std::vector<ElementHandle>> thread_lane_handles;
+  start = std::chrono::steady_clock::now();
+  hdmap.GetLanesBatch(points, radius, num_threads, &thread_lane_handles);
+  const double lanes_threads_ms = tools::MillisecondsSince(start);
+  num_mismatches = 0;
+  for (size_t i = 0; i < points.size(); ++i) {
+    std::sort(lanes_in_range[i].begin(), lanes_in_range[i].end());
+    for (const auto* results : {&lane_handles, &thread_lane_handles}) {
+      std::vector<const LaneInfo*> batch_lanes;
+      for (const ElementHandle handle : (*results)[i]) {
+        batch_lanes.push_back(hdmap.GetLaneByHandle(handle).get());
+      }
+      std::sort(batch_lanes.begin(), batch_lanes.end());
+      num_mismatches += batch_lanes != lanes_in_range[i];
+    }
+  }
+  PrintRow("lanes in range", lanes_ms, lanes_batch_ms, num_threads,
+           lanes_threads_ms, num_mismatches);
+  return 0;
+}
+
+}  // namespace
+}  // namespace hdmap
+}  // namespace apollo
+
+int main(int argc, char** argv) { return apollo::hdmap::Run(argc, argv); }
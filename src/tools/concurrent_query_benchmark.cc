@@ -0,0 +1,152 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Runs GetNearestLane and GetLanes on one map from 1 to N threads at once
+// and reports the query throughput and how it scales with the threads. A
+// query is one call of each at a point near the lanes. Usage:
+//
+//   concurrent_query_benchmark <map file> [queries per thread]
+//       [max threads] [radius in meters]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "hdmap.h"
+#include "tools/tool_util.h"
+
+namespace apollo {
+namespace hdmap {
+namespace {
+
+using apollo::common::PointENU;
+using apollo::common::math::Vec2d;
+
+// Runs the queries of each thread from points[offset], and returns the
+// number of lanes found, so that the queries are not optimized away.
+size_t RunQueries(const HDMap& hdmap, const std::vector<PointENU>& points,
+                  const size_t offset, const int num_queries,
+                  const double radius) {
+  LaneInfoConstPtr nearest_lane;
+  std::vector<LaneInfoConstPtr> lanes;
+  double s = 0.0;
+  double l = 0.0;
+  size_t num_found = 0;
+  for (int i = 0; i < num_queries; ++i) {
+    const PointENU& point = points[(offset + i) % points.size()];
+    if (hdmap.GetNearestLane(point, &nearest_lane, &s, &l) == 0) {
+      ++num_found;
+    }
+    hdmap.GetLanes(point, radius, &lanes);
+    num_found += lanes.size();
+  }
+  return num_found;
+}
+
+int Run(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr,
+                 "Usage: %s <map file> [queries per thread] [max threads] "
+                 "[radius]\n",
+                 argv[0]);
+    return 1;
+  }
+  const int num_queries = argc > 2 ? std::atoi(argv[2]) : 20000;
+  const int max_threads =
+      argc > 3 ? std::atoi(argv[3])
+               : std::max(1, static_cast<int>(
+                                 std::thread::hardware_concurrency()));
+  const double radius = argc > 4 ? std::atof(argv[4]) : 5.0;
+
+  Map map;
+  if (!tools::LoadMap(argv[1], &map)) {
+    std::fprintf(stderr, "Failed to load map %s\n", argv[1]);
+    return 1;
+  }
+  const std::vector<Vec2d> lane_points = tools::GetLanePoints(map);
+  HDMap hdmap;
+  if (hdmap.LoadMapFromProto(std::move(map)) != 0 || lane_points.empty()) {
+    std::fprintf(stderr, "Failed to build map %s\n", argv[1]);
+    return 1;
+  }
+
+  // Points within 5 meters of the lanes, where vehicles are.
+  std::mt19937 random_engine(1);
+  std::uniform_real_distribution<double> offset_distribution(-5.0, 5.0);
+  std::vector<PointENU> points;
+  for (int i = 0; i < 100000; ++i) {
+    const Vec2d& point = lane_points[random_engine() % lane_points.size()];
+    points.push_back(
+        tools::ToPointENU({point.x() + offset_distribution(random_engine),
+                           point.y() + offset_distribution(random_engine)}));
+  }
+
+  std::printf("%zu lane points, %u hardware threads, radius %.1f m\n",
+              lane_points.size(), std::thread::hardware_concurrency(),
+              radius);
+  std::printf("%7s %10s %10s %12s %8s %10s\n", "threads", "queries",
+              "wall_ms", "queries/s", "scaling", "efficiency");
+  std::vector<int> thread_counts;
+  for (int num_threads = 1; num_threads < max_threads; num_threads *= 2) {
+    thread_counts.push_back(num_threads);
+  }
+  thread_counts.push_back(std::max(1, max_threads));
+  double single_thread_rate = 0.0;
+  for (const int num_threads : thread_counts) {
+    // Every thread waits for the others to be created before it starts.
+    std::promise<void> start_promise;
+    std::shared_future<void> start = start_promise.get_future().share();
+    std::vector<std::future<size_t>> results;
+    for (int t = 0; t < num_threads; ++t) {
+      results.push_back(std::async(std::launch::async, [&, start, t] {
+        start.wait();
+        return RunQueries(hdmap, points,
+                          static_cast<size_t>(t) * num_queries, num_queries,
+                          radius);
+      }));
+    }
+    const auto start_time = std::chrono::steady_clock::now();
+    start_promise.set_value();
+    for (auto& result : results) {
+      result.get();
+    }
+    const double wall_ms = tools::MillisecondsSince(start_time);
+
+    const double total_queries =
+        static_cast<double>(num_threads) * num_queries;
+    const double rate = wall_ms > 0.0 ? total_queries * 1000.0 / wall_ms : 0;
+    if (num_threads == 1) {
+      single_thread_rate = rate;
+    }
+    const double scaling =
+        single_thread_rate > 0.0 ? rate / single_thread_rate : 0.0;
+    std::printf("%7d %10.0f %10.1f %12.0f %7.2fx %9.0f%%\n", num_threads,
+                total_queries, wall_ms, rate, scaling,
+                100.0 * scaling / num_threads);
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace hdmap
+}  // namespace apollo
+
+int main(int argc, char** argv) { return apollo::hdmap::Run(argc, argv); }
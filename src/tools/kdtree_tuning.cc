@@ -0,0 +1,191 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Builds the lane segment and junction polygon KD-trees of a map with
+// different split strategies and leaf limits, and reports the shape of each
+// tree and the work a radius query does on it. Usage:
+//
+//   kdtree_tuning <map file> [num_queries] [query radius in meters]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "hdmap_common.h"
+#include "math/aaboxkdtree2d.h"
+#include "tools/tool_util.h"
+
+namespace apollo {
+namespace hdmap {
+namespace {
+
+using apollo::common::math::AABox2d;
+using apollo::common::math::AABoxKDTree2d;
+using apollo::common::math::AABoxKDTreeParams;
+using apollo::common::math::AABoxKDTreeQueryCost;
+using apollo::common::math::AABoxKDTreeSplit;
+using apollo::common::math::AABoxKDTreeStats;
+using apollo::common::math::Vec2d;
+using tools::MillisecondsSince;
+
+const char* SplitName(const AABoxKDTreeSplit split) {
+  switch (split) {
+    case AABoxKDTreeSplit::MIDPOINT:
+      return "midpoint";
+    case AABoxKDTreeSplit::OBJECT_MEDIAN:
+      return "median";
+    case AABoxKDTreeSplit::SURFACE_AREA:
+      return "sah";
+  }
+  return "";
+}
+
+template <class ObjectType>
+void ReportLayer(const std::string& name,
+                 const std::vector<ObjectType>& objects,
+                 const std::vector<Vec2d>& query_points,
+                 const double query_radius) {
+  std::printf("\n%s: %zu objects, %zu queries of radius %.1f m\n",
+              name.c_str(), objects.size(), query_points.size(),
+              query_radius);
+  std::printf(
+      "%-8s %5s %6s | %8s %8s %5s %10s %8s | %9s %9s %9s | %9s %9s\n",
+      "split", "leaf", "dim", "nodes", "leaves", "depth", "straddling",
+      "max_leaf", "nodes/q", "tested/q", "found/q", "build_ms", "query_us");
+  for (const AABoxKDTreeSplit split :
+       {AABoxKDTreeSplit::MIDPOINT, AABoxKDTreeSplit::OBJECT_MEDIAN,
+        AABoxKDTreeSplit::SURFACE_AREA}) {
+    for (const int max_leaf_size : {1, 4, 16, 64}) {
+      for (const double max_leaf_dimension : {-1.0, 5.0, 20.0}) {
+        AABoxKDTreeParams params;
+        params.split = split;
+        params.max_leaf_size = max_leaf_size;
+        params.max_leaf_dimension = max_leaf_dimension;
+
+        auto start = std::chrono::steady_clock::now();
+        const AABoxKDTree2d<ObjectType> tree(objects, params);
+        const double build_ms = MillisecondsSince(start);
+        const AABoxKDTreeStats stats = tree.GetStats();
+
+        double nodes_visited = 0.0;
+        double objects_tested = 0.0;
+        for (const auto& point : query_points) {
+          const AABoxKDTreeQueryCost cost =
+              tree.GetObjectsQueryCost(point, query_radius);
+          nodes_visited += cost.nodes_visited;
+          objects_tested += cost.objects_tested;
+        }
+        std::vector<const ObjectType*> found;
+        size_t num_found = 0;
+        start = std::chrono::steady_clock::now();
+        for (const auto& point : query_points) {
+          found.clear();
+          tree.GetObjects(point, query_radius, &found);
+          num_found += found.size();
+        }
+        const double query_ms = MillisecondsSince(start);
+
+        const double num_queries =
+            static_cast<double>(std::max<size_t>(1, query_points.size()));
+        std::printf(
+            "%-8s %5d %6.1f | %8d %8d %5d %10d %8d | %9.1f %9.1f %9.2f | "
+            "%9.1f %9.3f\n",
+            SplitName(split), max_leaf_size, max_leaf_dimension,
+            stats.num_nodes, stats.num_leaves, stats.depth,
+            stats.num_straddling_objects, stats.max_leaf_size,
+            nodes_visited / num_queries, objects_tested / num_queries,
+            static_cast<double>(num_found) / num_queries, build_ms,
+            query_ms * 1000.0 / num_queries);
+      }
+    }
+  }
+}
+
+int Run(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr,
+                 "Usage: %s <map file> [num_queries] [query radius]\n",
+                 argv[0]);
+    return 1;
+  }
+  const int num_queries = argc > 2 ? std::atoi(argv[2]) : 100000;
+  const double query_radius = argc > 3 ? std::atof(argv[3]) : 5.0;
+
+  Map map;
+  if (!tools::LoadMap(argv[1], &map)) {
+    std::fprintf(stderr, "Failed to load map %s\n", argv[1]);
+    return 1;
+  }
+
+  std::vector<LaneInfo> lanes;
+  lanes.reserve(map.lane_size());
+  for (const auto& lane : map.lane()) {
+    lanes.emplace_back(lane);
+  }
+  std::vector<JunctionInfo> junctions;
+  junctions.reserve(map.junction_size());
+  for (const auto& junction : map.junction()) {
+    junctions.emplace_back(junction);
+  }
+
+  std::vector<LaneSegmentBox> lane_segment_boxes;
+  for (const auto& lane : lanes) {
+    for (size_t id = 0; id < lane.segments().size(); ++id) {
+      const auto& segment = lane.segments()[id];
+      lane_segment_boxes.emplace_back(AABox2d(segment.start(), segment.end()),
+                                      &lane, &segment, id);
+    }
+  }
+  std::vector<JunctionPolygonBox> junction_polygon_boxes;
+  for (const auto& junction : junctions) {
+    junction_polygon_boxes.emplace_back(junction.polygon().AABoundingBox(),
+                                        &junction, &junction.polygon(), 0);
+  }
+
+  // Queries around the lanes, where vehicles are: a random point of a random
+  // segment, moved by up to 10 meters along each axis.
+  std::vector<Vec2d> query_points;
+  if (!lane_segment_boxes.empty()) {
+    std::mt19937 random_engine(1);
+    std::uniform_int_distribution<size_t> segment_distribution(
+        0, lane_segment_boxes.size() - 1);
+    std::uniform_real_distribution<double> ratio_distribution(0.0, 1.0);
+    std::uniform_real_distribution<double> offset_distribution(-10.0, 10.0);
+    for (int i = 0; i < num_queries; ++i) {
+      const auto* segment =
+          lane_segment_boxes[segment_distribution(random_engine)].geo_object();
+      const Vec2d point =
+          segment->start() + (segment->end() - segment->start()) *
+                                 ratio_distribution(random_engine);
+      query_points.emplace_back(point.x() + offset_distribution(random_engine),
+                                point.y() + offset_distribution(random_engine));
+    }
+  }
+
+  ReportLayer("lane segments", lane_segment_boxes, query_points,
+              query_radius);
+  ReportLayer("junction polygons", junction_polygon_boxes, query_points,
+              query_radius);
+  return 0;
+}
+
+}  // namespace
+}  // namespace hdmap
+}  // namespace apollo
+
+int main(int argc, char** argv) { return apollo::hdmap::Run(argc, argv); }
@@ -0,0 +1,136 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Compares the two ways a LaneInfo finds the center line segment nearest to
+// a point, a KD-tree over its segments and a scan of all of them, on
+// synthetic lanes of 2 meter segments with a slowly turning heading. For
+// each lane length, reports the time of a GetProjection plus DistanceTo
+// call and the heap bytes of the LaneInfo, both ways, and checks that both
+// give the same distances. --hdmap_lane_kdtree_min_segments picks between
+// them in a loaded map. Usage:
+//
+//   lane_geometry_benchmark [num_queries per lane length]
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "config_gflags.h"
+#include "hdmap_common.h"
+#include "tools/allocation_counter.h"
+#include "tools/tool_util.h"
+
+namespace apollo {
+namespace hdmap {
+namespace {
+
+using apollo::common::math::Vec2d;
+
+Lane MakeLane(const int num_segments, std::mt19937* random_engine) {
+  std::uniform_real_distribution<double> turn_distribution(-0.05, 0.05);
+  Lane lane;
+  lane.mutable_id()->set_id("lane");
+  auto* line_segment =
+      lane.mutable_central_curve()->add_segment()->mutable_line_segment();
+  double x = 0.0;
+  double y = 0.0;
+  double heading = 0.0;
+  for (int i = 0; i <= num_segments; ++i) {
+    auto* point = line_segment->add_point();
+    point->set_x(x);
+    point->set_y(y);
+    heading += turn_distribution(*random_engine);
+    x += 2.0 * std::cos(heading);
+    y += 2.0 * std::sin(heading);
+  }
+  return lane;
+}
+
+// A LaneInfo built with the given segment index, and the heap bytes it
+// holds.
+std::unique_ptr<LaneInfo> MakeLaneInfo(const Lane& lane, const bool use_tree,
+                                       size_t* num_bytes) {
+  FLAGS_hdmap_lane_kdtree_min_segments = use_tree ? 1 : INT_MAX;
+  const int64_t bytes_before = tools::AllocatedBytes();
+  std::unique_ptr<LaneInfo> lane_info(new LaneInfo(lane));
+  *num_bytes = static_cast<size_t>(tools::AllocatedBytes() - bytes_before);
+  return lane_info;
+}
+
+double TimeQueries(const LaneInfo& lane_info, const std::vector<Vec2d>& points,
+                   double* checksum) {
+  const auto start = std::chrono::steady_clock::now();
+  for (const auto& point : points) {
+    double s = 0.0;
+    double l = 0.0;
+    lane_info.GetProjection(point, &s, &l);
+    *checksum += s + lane_info.DistanceTo(point);
+  }
+  return tools::MillisecondsSince(start) * 1e6 /
+         static_cast<double>(std::max<size_t>(1, points.size()));
+}
+
+int Run(int argc, char** argv) {
+  const int num_queries = argc > 1 ? std::atoi(argv[1]) : 100000;
+
+  std::printf("%8s %10s %10s %11s %11s %10s\n", "segments", "tree_ns",
+              "scan_ns", "tree_bytes", "scan_bytes", "mismatches");
+  std::mt19937 random_engine(1);
+  std::uniform_real_distribution<double> offset_distribution(-4.0, 4.0);
+  double checksum = 0.0;
+  int num_mismatches = 0;
+  for (const int num_segments : {4, 8, 16, 32, 64, 128, 256, 1024}) {
+    const Lane lane = MakeLane(num_segments, &random_engine);
+    size_t tree_bytes = 0;
+    size_t scan_bytes = 0;
+    const auto tree_lane = MakeLaneInfo(lane, true, &tree_bytes);
+    const auto scan_lane = MakeLaneInfo(lane, false, &scan_bytes);
+
+    // Points up to 4 meters off the start of a random segment.
+    std::vector<Vec2d> points;
+    for (int i = 0; i < num_queries; ++i) {
+      const Vec2d& start =
+          tree_lane->segments()[random_engine() % num_segments].start();
+      points.emplace_back(start.x() + offset_distribution(random_engine),
+                          start.y() + offset_distribution(random_engine));
+    }
+    int lane_mismatches = 0;
+    for (const auto& point : points) {
+      lane_mismatches +=
+          tree_lane->DistanceTo(point) != scan_lane->DistanceTo(point);
+    }
+    num_mismatches += lane_mismatches;
+
+    const double tree_ns = TimeQueries(*tree_lane, points, &checksum);
+    const double scan_ns = TimeQueries(*scan_lane, points, &checksum);
+    std::printf("%8d %10.1f %10.1f %11zu %11zu %10d\n", num_segments,
+                tree_ns, scan_ns, tree_bytes, scan_bytes, lane_mismatches);
+  }
+  std::printf("(checksum %g)\n", checksum);
+  return num_mismatches == 0 ? 0 : 1;
+}
+
+}  // namespace
+}  // namespace hdmap
+}  // namespace apollo
+
+int main(int argc, char** argv) { return apollo::hdmap::Run(argc, argv); }
@@ -0,0 +1,268 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Builds the lane segment tree of a map, with the params HDMap uses, as the
+// node-per-allocation tree AABoxKDTree2d used to be and as AABoxKDTree2d
+// with and without compact storage. Checks that all three give the same
+// nearest segments and segments in range, and reports the latency and the
+// cache misses of both queries, counted by perf_event_open where the kernel
+// allows it. Usage:
+//
+//   lane_segment_tree_benchmark <map file> [num_queries]
+//       [query radius in meters]
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hdmap_common.h"
+#include "math/aaboxkdtree2d.h"
+#include "tools/pointer_kdtree2d.h"
+#include "tools/tool_util.h"
+
+namespace apollo {
+namespace hdmap {
+namespace {
+
+using apollo::common::math::AABox2d;
+using apollo::common::math::AABoxKDTree2d;
+using apollo::common::math::AABoxKDTreeParams;
+using apollo::common::math::Vec2d;
+
+// A hardware event counted for this thread, in user space.
+class PerfCounter {
+ public:
+  PerfCounter(const uint32_t type, const uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+  ~PerfCounter() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+  PerfCounter(const PerfCounter&) = delete;
+  PerfCounter& operator=(const PerfCounter&) = delete;
+
+  void Start() {
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+
+  // The count since Start(), or -1 if the event can not be counted.
+  double Stop() {
+    uint64_t count = 0;
+    if (fd_ < 0 || ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0) != 0 ||
+        read(fd_, &count, sizeof(count)) != sizeof(count)) {
+      return -1.0;
+    }
+    return static_cast<double>(count);
+  }
+
+ private:
+  int fd_ = -1;
+};
+
+struct QueryResult {
+  double query_us = 0.0;
+  double l1d_misses = -1.0;
+  double llc_misses = -1.0;
+};
+
+// Runs query at every point and reports the time and cache misses per query.
+template <class Query>
+QueryResult Measure(const std::vector<Vec2d>& points, const Query& query) {
+  PerfCounter l1d_counter(PERF_TYPE_HW_CACHE,
+                          PERF_COUNT_HW_CACHE_L1D |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+  PerfCounter llc_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  l1d_counter.Start();
+  llc_counter.Start();
+  const auto start = std::chrono::steady_clock::now();
+  for (const auto& point : points) {
+    query(point);
+  }
+  const double query_ms = tools::MillisecondsSince(start);
+  QueryResult result;
+  result.l1d_misses = l1d_counter.Stop();
+  result.llc_misses = llc_counter.Stop();
+  const double num_queries =
+      static_cast<double>(std::max<size_t>(1, points.size()));
+  result.query_us = query_ms * 1000.0 / num_queries;
+  for (double* misses : {&result.l1d_misses, &result.llc_misses}) {
+    if (*misses >= 0.0) {
+      *misses /= num_queries;
+    }
+  }
+  return result;
+}
+
+void PrintMisses(const double misses) {
+  if (misses < 0.0) {
+    std::printf(" %10s", "n/a");
+  } else {
+    std::printf(" %10.1f", misses);
+  }
+}
+
+template <class Tree>
+void ReportTree(const char* name, const double build_ms, const Tree& tree,
+                const std::vector<Vec2d>& points, const double radius) {
+  const QueryResult nearest = Measure(points, [&tree](const Vec2d& point) {
+    tree.GetNearestObject(point);
+  });
+  std::vector<const LaneSegmentBox*> segments;
+  const QueryResult in_range =
+      Measure(points, [&tree, &segments, radius](const Vec2d& point) {
+        segments.clear();
+        tree.GetObjects(point, radius, &segments);
+      });
+  for (const auto& row : {std::make_pair("nearest", nearest),
+                          std::make_pair("in range", in_range)}) {
+    std::printf("%-8s %-9s %9.1f %9.3f", name, row.first, build_ms,
+                row.second.query_us);
+    PrintMisses(row.second.l1d_misses);
+    PrintMisses(row.second.llc_misses);
+    std::printf("\n");
+  }
+}
+
+int Run(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr,
+                 "Usage: %s <map file> [num_queries] [query radius]\n",
+                 argv[0]);
+    return 1;
+  }
+  const int num_queries = argc > 2 ? std::atoi(argv[2]) : 200000;
+  const double radius = argc > 3 ? std::atof(argv[3]) : 5.0;
+
+  Map map;
+  if (!tools::LoadMap(argv[1], &map)) {
+    std::fprintf(stderr, "Failed to load map %s\n", argv[1]);
+    return 1;
+  }
+  std::vector<LaneInfo> lanes;
+  lanes.reserve(map.lane_size());
+  for (const auto& lane : map.lane()) {
+    lanes.emplace_back(lane);
+  }
+  std::vector<LaneSegmentBox> lane_segment_boxes;
+  for (const auto& lane : lanes) {
+    for (size_t id = 0; id < lane.segments().size(); ++id) {
+      const auto& segment = lane.segments()[id];
+      lane_segment_boxes.emplace_back(AABox2d(segment.start(), segment.end()),
+                                      &lane, &segment, id);
+    }
+  }
+  if (lane_segment_boxes.empty()) {
+    std::fprintf(stderr, "Map %s has no lane segments\n", argv[1]);
+    return 1;
+  }
+
+  // Points around the lanes: a random point of a random segment, moved by
+  // up to 10 meters along each axis.
+  std::mt19937 random_engine(1);
+  std::uniform_int_distribution<size_t> segment_distribution(
+      0, lane_segment_boxes.size() - 1);
+  std::uniform_real_distribution<double> ratio_distribution(0.0, 1.0);
+  std::uniform_real_distribution<double> offset_distribution(-10.0, 10.0);
+  std::vector<Vec2d> points;
+  for (int i = 0; i < num_queries; ++i) {
+    const auto* segment =
+        lane_segment_boxes[segment_distribution(random_engine)].geo_object();
+    const Vec2d point =
+        segment->start() +
+        (segment->end() - segment->start()) * ratio_distribution(random_engine);
+    points.emplace_back(point.x() + offset_distribution(random_engine),
+                        point.y() + offset_distribution(random_engine));
+  }
+
+  // The params of HDMapImpl::BuildLaneSegmentKDTree.
+  AABoxKDTreeParams params;
+  params.max_leaf_dimension = 5.0;
+  params.max_leaf_size = 16;
+  auto start = std::chrono::steady_clock::now();
+  const tools::PointerKDTree2d<LaneSegmentBox> pointer_tree(
+      lane_segment_boxes, params);
+  const double pointer_build_ms = tools::MillisecondsSince(start);
+  start = std::chrono::steady_clock::now();
+  const AABoxKDTree2d<LaneSegmentBox> flat_tree(lane_segment_boxes, params);
+  const double flat_build_ms = tools::MillisecondsSince(start);
+  AABoxKDTreeParams compact_params = params;
+  compact_params.compact = true;
+  start = std::chrono::steady_clock::now();
+  const AABoxKDTree2d<LaneSegmentBox> compact_tree(lane_segment_boxes,
+                                                   compact_params);
+  const double compact_build_ms = tools::MillisecondsSince(start);
+
+  // Nearest segments are compared as distances, since segments can tie.
+  int num_mismatches = 0;
+  std::vector<const LaneSegmentBox*> expected;
+  std::vector<const LaneSegmentBox*> actual;
+  for (const auto& point : points) {
+    const double distance =
+        pointer_tree.GetNearestObject(point)->DistanceTo(point);
+    expected.clear();
+    pointer_tree.GetObjects(point, radius, &expected);
+    std::sort(expected.begin(), expected.end());
+    for (const auto* tree : {&flat_tree, &compact_tree}) {
+      num_mismatches +=
+          tree->GetNearestObject(point)->DistanceTo(point) != distance;
+      actual.clear();
+      tree->GetObjects(point, radius, &actual);
+      std::sort(actual.begin(), actual.end());
+      num_mismatches += actual != expected;
+    }
+  }
+
+  std::printf("%zu lane segments, %zu queries of radius %.1f m, "
+              "%d mismatches\n",
+              lane_segment_boxes.size(), points.size(), radius,
+              num_mismatches);
+  std::printf("%-8s %-9s %9s %9s %10s %10s\n", "tree", "query", "build_ms",
+              "query_us", "l1d_miss/q", "llc_miss/q");
+  ReportTree("pointer", pointer_build_ms, pointer_tree, points, radius);
+  ReportTree("flat", flat_build_ms, flat_tree, points, radius);
+  ReportTree("compact", compact_build_ms, compact_tree, points, radius);
+  return num_mismatches == 0 ? 0 : 1;
+}
+
+}  // namespace
+}  // namespace hdmap
+}  // namespace apollo
+
+int main(int argc, char** argv) { return apollo::hdmap::Run(argc, argv); }
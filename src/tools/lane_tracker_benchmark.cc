@@ -0,0 +1,204 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Replays a drive through LaneTracker and through HDMap::GetNearestLane,
+// and reports the tracker's warm hit rate, the latency of both and any
+// pose where they disagree. The drive is a text file with one "x y" pose
+// per line; without one, a drive at 100 Hz and 15 m/s is made up by
+// following the lanes of the map from lane to successor. Usage:
+//
+//   lane_tracker_benchmark <map file> [drive file | num_poses]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hdmap.h"
+#include "lane_tracker.h"
+#include "tools/tool_util.h"
+
+namespace apollo {
+namespace hdmap {
+namespace {
+
+using apollo::common::PointENU;
+using apollo::common::math::Vec2d;
+
+// Distance between poses of the made up drive, 15 m/s at 100 Hz.
+constexpr double kPoseSpacing = 0.15;
+
+bool ReadDrive(const std::string& filename, std::vector<Vec2d>* poses) {
+  std::ifstream fin(filename);
+  if (!fin) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(fin, line)) {
+    std::istringstream line_stream(line);
+    double x = 0.0;
+    double y = 0.0;
+    if (line.empty() || line[0] == '#' || !(line_stream >> x >> y)) {
+      continue;
+    }
+    poses->emplace_back(x, y);
+  }
+  return !poses->empty();
+}
+
+// Follows the central curves from a random lane, on to the first successor
+// at each lane end, with a few centimeters of localization noise.
+std::vector<Vec2d> MakeDrive(const Map& map, const int num_poses) {
+  std::unordered_map<std::string, int> lane_indices;
+  for (int i = 0; i < map.lane_size(); ++i) {
+    lane_indices[map.lane(i).id().id()] = i;
+  }
+  std::mt19937 random_engine(1);
+  std::normal_distribution<double> noise_distribution(0.0, 0.03);
+  std::vector<Vec2d> poses;
+  int lane_index = static_cast<int>(random_engine() % map.lane_size());
+  double offset = 0.0;  // Along the current lane piece, in meters.
+  while (static_cast<int>(poses.size()) < num_poses) {
+    const Lane& lane = map.lane(lane_index);
+    std::vector<Vec2d> points;
+    for (const auto& segment : lane.central_curve().segment()) {
+      for (const auto& point : segment.line_segment().point()) {
+        points.emplace_back(point.x(), point.y());
+      }
+    }
+    for (size_t i = 0; i + 1 < points.size(); ++i) {
+      const double length = points[i].DistanceTo(points[i + 1]);
+      for (; offset < length && static_cast<int>(poses.size()) < num_poses;
+           offset += kPoseSpacing) {
+        const Vec2d point =
+            points[i] + (points[i + 1] - points[i]) * (offset / length);
+        poses.emplace_back(point.x() + noise_distribution(random_engine),
+                           point.y() + noise_distribution(random_engine));
+      }
+      offset -= length;
+    }
+    const auto& successors = lane.successor_id();
+    const auto successor = successors.empty()
+                               ? lane_indices.end()
+                               : lane_indices.find(successors[0].id());
+    if (successor == lane_indices.end()) {
+      // A dead end: start over somewhere else.
+      lane_index = static_cast<int>(random_engine() % map.lane_size());
+      offset = 0.0;
+    } else {
+      lane_index = successor->second;
+    }
+  }
+  return poses;
+}
+
+void PrintLatencies(const char* name, std::vector<double>* latencies) {
+  double total_us = 0.0;
+  for (const double latency : *latencies) {
+    total_us += latency;
+  }
+  std::printf("%-8s %10.3f %10.3f %10.3f %10.1f\n", name,
+              total_us / static_cast<double>(latencies->size()),
+              tools::Percentile(latencies, 0.5),
+              tools::Percentile(latencies, 0.99), total_us / 1000.0);
+}
+
+int Run(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s <map file> [drive file | num_poses]\n",
+                 argv[0]);
+    return 1;
+  }
+  Map map;
+  if (!tools::LoadMap(argv[1], &map) || map.lane_size() == 0) {
+    std::fprintf(stderr, "Failed to load map %s\n", argv[1]);
+    return 1;
+  }
+  std::vector<Vec2d> poses;
+  if (argc > 2 && std::atoi(argv[2]) == 0) {
+    if (!ReadDrive(argv[2], &poses)) {
+      std::fprintf(stderr, "Failed to read drive %s\n", argv[2]);
+      return 1;
+    }
+  } else {
+    poses = MakeDrive(map, argc > 2 ? std::atoi(argv[2]) : 60000);
+  }
+  HDMap hdmap;
+  if (hdmap.LoadMapFromProto(std::move(map)) != 0) {
+    std::fprintf(stderr, "Failed to build map %s\n", argv[1]);
+    return 1;
+  }
+
+  struct Answer {
+    const LaneInfo* lane = nullptr;
+    double s = 0.0;
+    double l = 0.0;
+  };
+  std::vector<Answer> cold_answers(poses.size());
+  std::vector<double> cold_latencies;
+  for (size_t i = 0; i < poses.size(); ++i) {
+    const PointENU point = tools::ToPointENU(poses[i]);
+    LaneInfoConstPtr lane;
+    const auto start = std::chrono::steady_clock::now();
+    hdmap.GetNearestLane(point, &lane, &cold_answers[i].s,
+                         &cold_answers[i].l);
+    cold_latencies.push_back(tools::MillisecondsSince(start) * 1000.0);
+    cold_answers[i].lane = lane.get();
+  }
+
+  LaneTracker tracker(&hdmap);
+  std::vector<double> tracker_latencies;
+  int num_mismatches = 0;
+  for (size_t i = 0; i < poses.size(); ++i) {
+    const PointENU point = tools::ToPointENU(poses[i]);
+    LaneInfoConstPtr lane;
+    Answer answer;
+    const auto start = std::chrono::steady_clock::now();
+    tracker.GetNearestLane(point, &lane, &answer.s, &answer.l);
+    tracker_latencies.push_back(tools::MillisecondsSince(start) * 1000.0);
+    num_mismatches += lane.get() != cold_answers[i].lane ||
+                      answer.s != cold_answers[i].s ||
+                      answer.l != cold_answers[i].l;
+  }
+
+  std::printf("%zu poses, %llu of %llu tracker queries answered warm "
+              "(%.1f%%), %d mismatches\n",
+              poses.size(),
+              static_cast<unsigned long long>(tracker.num_warm_hits()),
+              static_cast<unsigned long long>(tracker.num_queries()),
+              100.0 * static_cast<double>(tracker.num_warm_hits()) /
+                  static_cast<double>(std::max<uint64_t>(
+                      1, tracker.num_queries())),
+              num_mismatches);
+  std::printf("%-8s %10s %10s %10s %10s\n", "lookup", "mean_us", "p50_us",
+              "p99_us", "total_ms");
+  PrintLatencies("cold", &cold_latencies);
+  PrintLatencies("tracker", &tracker_latencies);
+  return num_mismatches == 0 ? 0 : 1;
+}
+
+}  // namespace
+}  // namespace hdmap
+}  // namespace apollo
+
+int main(int argc, char** argv) { return apollo::hdmap::Run(argc, argv); }
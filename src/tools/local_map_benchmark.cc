@@ -0,0 +1,117 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Times HDMap::GetLocalMap at 50, 150 and 300 meter ranges around points
+// on the lanes, and reports the latency percentiles and the size of the
+// local maps. Usage:
+//
+//   local_map_benchmark <map file> [num_queries] [range in meters]...
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "hdmap.h"
+#include "tools/tool_util.h"
+
+namespace apollo {
+namespace hdmap {
+namespace {
+
+using apollo::common::PointENU;
+using apollo::common::math::Vec2d;
+
+int Run(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s <map file> [num_queries] [range]...\n",
+                 argv[0]);
+    return 1;
+  }
+  const int num_queries = argc > 2 ? std::atoi(argv[2]) : 200;
+  std::vector<double> ranges;
+  for (int i = 3; i < argc; ++i) {
+    ranges.push_back(std::atof(argv[i]));
+  }
+  if (ranges.empty()) {
+    ranges = {50.0, 150.0, 300.0};
+  }
+
+  Map map;
+  if (!tools::LoadMap(argv[1], &map)) {
+    std::fprintf(stderr, "Failed to load map %s\n", argv[1]);
+    return 1;
+  }
+  const std::vector<Vec2d> lane_points = tools::GetLanePoints(map);
+  HDMap hdmap;
+  if (hdmap.LoadMapFromProto(std::move(map)) != 0 || lane_points.empty()) {
+    std::fprintf(stderr, "Failed to build map %s\n", argv[1]);
+    return 1;
+  }
+
+  std::mt19937 random_engine(1);
+  std::vector<PointENU> points;
+  for (int i = 0; i < num_queries; ++i) {
+    points.push_back(tools::ToPointENU(
+        lane_points[random_engine() % lane_points.size()]));
+  }
+
+  std::printf("%zu queries at lane points\n", points.size());
+  std::printf("%8s %10s %10s %10s %10s | %8s %9s %9s %9s\n", "range_m",
+              "mean_ms", "p50_ms", "p99_ms", "max_ms", "lanes", "junctions",
+              "overlaps", "elements");
+  for (const double range : ranges) {
+    std::vector<double> latencies;
+    double num_lanes = 0.0;
+    double num_junctions = 0.0;
+    double num_overlaps = 0.0;
+    double num_elements = 0.0;
+    double total_ms = 0.0;
+    for (const auto& point : points) {
+      Map local_map;
+      const auto start = std::chrono::steady_clock::now();
+      hdmap.GetLocalMap(point, {range, range}, &local_map);
+      latencies.push_back(tools::MillisecondsSince(start));
+      total_ms += latencies.back();
+      num_lanes += local_map.lane_size();
+      num_junctions += local_map.junction_size();
+      num_overlaps += local_map.overlap_size();
+      num_elements += local_map.lane_size() + local_map.junction_size() +
+                      local_map.crosswalk_size() + local_map.signal_size() +
+                      local_map.stop_sign_size() + local_map.yield_size() +
+                      local_map.clear_area_size() +
+                      local_map.speed_bump_size() + local_map.road_size() +
+                      local_map.parking_space_size() +
+                      local_map.overlap_size();
+    }
+    const double n = static_cast<double>(std::max<size_t>(1, points.size()));
+    std::printf(
+        "%8.0f %10.3f %10.3f %10.3f %10.3f | %8.1f %9.1f %9.1f %9.1f\n",
+        range, total_ms / n, tools::Percentile(&latencies, 0.5),
+        tools::Percentile(&latencies, 0.99),
+        tools::Percentile(&latencies, 1.0), num_lanes / n, num_junctions / n,
+        num_overlaps / n, num_elements / n);
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace hdmap
+}  // namespace apollo
+
+int main(int argc, char** argv) { return apollo::hdmap::Run(argc, argv); }
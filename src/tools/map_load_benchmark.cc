@@ -0,0 +1,326 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Times HDMap::LoadMapFromFile on a proto map file: with the spatial
+// indices built, with them built and saved to the index file, and with them
+// loaded from that file. Then times building the map on 1, 2, 4, ... up to
+// max_threads load threads. Also times destroying a loaded HDMap, and
+// parsing a binary map file into a Map, from a mapping of the file and
+// through a stream, with the peak memory of the parse, and freeing the Map.
+// Checks that every map answers nearest lane queries like the one built
+// from scratch on a single thread. Overwrites <map file>.index, and removes
+// it when done.
+//
+// First of all, while the heap is fresh, reports the resident memory of
+// the process with the map proto parsed, and its peak and steady state,
+// after malloc_trim, while HDMap::LoadMapFromProto copies that proto and
+// while it moves a copy of it in. Usage:
+//
+//   map_load_benchmark <map file> [num_runs] [max_threads]
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "config_gflags.h"
+#include "file.h"
+#include "hdmap.h"
+#include "tools/tool_util.h"
+
+namespace apollo {
+namespace hdmap {
+namespace {
+
+using apollo::common::math::Vec2d;
+
+// The median time of num_runs loads of a fresh HDMap; before runs ahead of
+// each one, untimed. The median time to destroy the loaded HDMap goes to
+// teardown_ms, if given.
+double TimeLoads(const std::string& filename, const int num_runs,
+                 const std::function<void()>& before,
+                 double* teardown_ms = nullptr) {
+  std::vector<double> load_ms;
+  std::vector<double> destroy_ms;
+  for (int i = 0; i < num_runs; ++i) {
+    before();
+    std::unique_ptr<HDMap> map(new HDMap());
+    auto start = std::chrono::steady_clock::now();
+    if (map->LoadMapFromFile(filename) != 0) {
+      return -1.0;
+    }
+    load_ms.push_back(tools::MillisecondsSince(start));
+    start = std::chrono::steady_clock::now();
+    map.reset();
+    destroy_ms.push_back(tools::MillisecondsSince(start));
+  }
+  if (teardown_ms != nullptr) {
+    *teardown_ms = tools::Percentile(&destroy_ms, 0.5);
+  }
+  return tools::Percentile(&load_ms, 0.5);
+}
+
+// The distance to the nearest lane from a point near every 7th lane point,
+// or -1 where there is none. Lanes can tie, so distances are compared.
+std::vector<double> NearestLaneDistances(const HDMap& map,
+                                         const std::vector<Vec2d>& points) {
+  std::vector<double> distances;
+  for (size_t i = 0; i < points.size(); i += 7) {
+    const auto point =
+        tools::ToPointENU({points[i].x() + 1.5, points[i].y() - 2.5});
+    LaneInfoConstPtr lane;
+    double s = 0.0;
+    double l = 0.0;
+    distances.push_back(map.GetNearestLane(point, &lane, &s, &l) == 0
+                            ? lane->DistanceTo({point.x(), point.y()})
+                            : -1.0);
+  }
+  return distances;
+}
+
+// The resident memory of the process, and its peak since the last
+// ResetPeakMemory(), in MB.
+struct Memory {
+  double resident_mb = 0.0;
+  double peak_mb = 0.0;
+};
+
+Memory ReadMemory() {
+  Memory memory;
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    const double mb = std::atof(line.c_str() + line.find(':') + 1) / 1024.0;
+    if (line.rfind("VmRSS:", 0) == 0) {
+      memory.resident_mb = mb;
+    } else if (line.rfind("VmHWM:", 0) == 0) {
+      memory.peak_mb = mb;
+    }
+  }
+  return memory;
+}
+
+void ResetPeakMemory() { std::ofstream("/proc/self/clear_refs") << "5"; }
+
+// Loads a fresh HDMap with load, and prints the peak memory while loading
+// and the memory with the map loaded, both above before_mb.
+void ReportLoadMemory(const char* name, const double before_mb,
+                      const std::function<void(HDMap*)>& load) {
+  ResetPeakMemory();
+  HDMap hdmap;
+  load(&hdmap);
+  const double peak_mb = ReadMemory().peak_mb;
+  malloc_trim(0);
+  const double steady_mb = ReadMemory().resident_mb;
+  std::printf("%-12s %10.1f %10.1f %10.1f\n", name, before_mb,
+              peak_mb - before_mb, steady_mb - before_mb);
+}
+
+struct ParseTimes {
+  double parse_ms = -1.0;
+  double free_ms = 0.0;
+  double peak_mb = 0.0;
+};
+
+// Parses the map file into a fresh Map on the heap with parse, num_runs
+// times. Reports the median time of the parse and of freeing the Map, and
+// the highest peak memory of a parse above the memory before it.
+ParseTimes TimeParses(const int num_runs,
+                      const std::function<bool(Map*)>& parse) {
+  std::vector<double> parse_ms;
+  std::vector<double> free_ms;
+  ParseTimes times;
+  for (int i = 0; i < num_runs; ++i) {
+    malloc_trim(0);
+    const double before_mb = ReadMemory().resident_mb;
+    ResetPeakMemory();
+    std::unique_ptr<Map> parsed_map(new Map());
+    auto start = std::chrono::steady_clock::now();
+    if (!parse(parsed_map.get())) {
+      return ParseTimes();
+    }
+    parse_ms.push_back(tools::MillisecondsSince(start));
+    times.peak_mb = std::max(times.peak_mb, ReadMemory().peak_mb - before_mb);
+    start = std::chrono::steady_clock::now();
+    parsed_map.reset();
+    free_ms.push_back(tools::MillisecondsSince(start));
+  }
+  times.parse_ms = tools::Percentile(&parse_ms, 0.5);
+  times.free_ms = tools::Percentile(&free_ms, 0.5);
+  return times;
+}
+
+void PrintParseTimes(const char* name, const ParseTimes& times) {
+  if (times.parse_ms < 0.0) {
+    std::printf("%-12s %10s\n", name, "failed");
+    return;
+  }
+  std::printf("%-12s %10.1f %10.1f %10.1f\n", name, times.parse_ms,
+              times.free_ms, times.peak_mb);
+}
+
+int CountMismatches(const std::vector<double>& expected,
+                    const std::vector<double>& actual) {
+  int num_mismatches = 0;
+  for (size_t i = 0; i < expected.size(); ++i) {
+    num_mismatches += i >= actual.size() || actual[i] != expected[i];
+  }
+  return num_mismatches;
+}
+
+int Run(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s <map file> [num_runs] [max_threads]\n",
+                 argv[0]);
+    return 1;
+  }
+  const std::string filename = argv[1];
+  const std::string index_filename = filename + ".index";
+  const int num_runs = std::max(1, argc > 2 ? std::atoi(argv[2]) : 5);
+  const int max_threads = std::max(
+      1, argc > 3 ? std::atoi(argv[3])
+                  : static_cast<int>(std::thread::hardware_concurrency()));
+
+  Map map;
+  if (!tools::LoadMap(filename, &map)) {
+    std::fprintf(stderr, "Failed to load map %s\n", filename.c_str());
+    return 1;
+  }
+  const std::vector<Vec2d> points = tools::GetLanePoints(map);
+  FLAGS_hdmap_use_index_file = false;
+
+  malloc_trim(0);
+  std::printf("%s: %d lanes, %.1f MB resident with the proto parsed\n",
+              filename.c_str(), map.lane_size(), ReadMemory().resident_mb);
+  std::printf("%-12s %10s %10s %10s\n", "memory", "before_mb", "+peak_mb",
+              "+steady_mb");
+  ReportLoadMemory("copy", ReadMemory().resident_mb,
+                   [&map](HDMap* hdmap) { hdmap->LoadMapFromProto(map); });
+  malloc_trim(0);
+  {
+    Map map_copy = map;
+    ReportLoadMemory("move", ReadMemory().resident_mb,
+                     [&map_copy](HDMap* hdmap) {
+                       hdmap->LoadMapFromProto(std::move(map_copy));
+                     });
+  }
+  malloc_trim(0);
+
+  // The parse of the map file alone, into a Map on the heap, from a
+  // mapping of the file as GetProtoFromBinaryFile does and through a
+  // stream. HDMap parses onto an arena of its own instead, as part of the
+  // loads below.
+  const ParseTimes mapped =
+      TimeParses(num_runs, [&filename](Map* parsed_map) {
+        return cyber::common::GetProtoFromBinaryFile(filename, parsed_map);
+      });
+  const ParseTimes streamed =
+      TimeParses(num_runs, [&filename](Map* parsed_map) {
+        std::ifstream input(filename, std::ios::binary);
+        return parsed_map->ParseFromIstream(&input);
+      });
+
+  FLAGS_hdmap_load_threads = 1;
+  std::vector<double> expected;
+  {
+    HDMap built_map;
+    if (built_map.LoadMapFromFile(filename) != 0) {
+      std::fprintf(stderr, "Failed to load map %s\n", filename.c_str());
+      return 1;
+    }
+    expected = NearestLaneDistances(built_map, points);
+  }
+  FLAGS_hdmap_load_threads = 0;
+
+  const auto remove_index = [&index_filename]() {
+    std::remove(index_filename.c_str());
+  };
+  double teardown_ms = 0.0;
+  const double build_ms = TimeLoads(filename, num_runs, [] {}, &teardown_ms);
+  FLAGS_hdmap_use_index_file = true;
+  const double save_ms = TimeLoads(filename, num_runs, remove_index);
+  const double index_ms = TimeLoads(filename, num_runs, [] {});
+  std::ifstream index_file(index_filename, std::ios::binary | std::ios::ate);
+  const double index_mb = static_cast<double>(index_file.tellg()) / (1 << 20);
+  index_file.close();
+  int num_mismatches = 0;
+  {
+    HDMap index_map;
+    index_map.LoadMapFromFile(filename);
+    num_mismatches =
+        CountMismatches(expected, NearestLaneDistances(index_map, points));
+  }
+  remove_index();
+  FLAGS_hdmap_use_index_file = false;
+  if (build_ms < 0.0 || save_ms < 0.0 || index_ms < 0.0) {
+    std::fprintf(stderr, "Failed to load map %s\n", filename.c_str());
+    return 1;
+  }
+
+  std::printf("index file of %.1f MB, %d mismatches\n", index_mb,
+              num_mismatches);
+  std::printf("%-12s %10s %8s\n", "load", "median_ms", "speedup");
+  std::printf("%-12s %10.1f %8s\n", "build", build_ms, "");
+  std::printf("%-12s %10.1f %7.2fx\n", "build+save", save_ms,
+              save_ms > 0.0 ? build_ms / save_ms : 0.0);
+  std::printf("%-12s %10.1f %7.2fx\n", "index file", index_ms,
+              index_ms > 0.0 ? build_ms / index_ms : 0.0);
+
+  std::printf("%-12s %10.1f\n", "teardown", teardown_ms);
+
+  std::printf("%-12s %10s %10s %10s\n", "parse", "median_ms", "free_ms",
+              "+peak_mb");
+  PrintParseTimes("mmap", mapped);
+  PrintParseTimes("stream", streamed);
+
+  std::printf("%-12s %10s %8s %10s\n", "threads", "median_ms", "speedup",
+              "mismatches");
+  double single_thread_ms = 0.0;
+  for (int threads = 1;; threads = std::min(2 * threads, max_threads)) {
+    FLAGS_hdmap_load_threads = threads;
+    const double load_ms = TimeLoads(filename, num_runs, [] {});
+    HDMap thread_map;
+    thread_map.LoadMapFromFile(filename);
+    const int thread_mismatches =
+        CountMismatches(expected, NearestLaneDistances(thread_map, points));
+    num_mismatches += thread_mismatches;
+    if (threads == 1) {
+      single_thread_ms = load_ms;
+    }
+    std::printf("%-12d %10.1f %7.2fx %10d\n", threads, load_ms,
+                load_ms > 0.0 ? single_thread_ms / load_ms : 0.0,
+                thread_mismatches);
+    if (threads == max_threads) {
+      break;
+    }
+  }
+  FLAGS_hdmap_load_threads = 0;
+  return num_mismatches == 0 ? 0 : 1;
+}
+
+}  // namespace
+}  // namespace hdmap
+}  // namespace apollo
+
+int main(int argc, char** argv) { return apollo::hdmap::Run(argc, argv); }
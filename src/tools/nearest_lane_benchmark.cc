@@ -0,0 +1,186 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Times HDMap::GetNearestLane with and without a max distance, for query
+// points on the lanes, in the sparse area around them and off the map, and
+// checks that both give the same lane whenever it is in range. Usage:
+//
+//   nearest_lane_benchmark <map file> [num_queries] [max distance in meters]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "hdmap.h"
+#include "math/math_utils.h"
+#include "tools/tool_util.h"
+
+namespace apollo {
+namespace hdmap {
+namespace {
+
+using apollo::common::PointENU;
+using apollo::common::math::Vec2d;
+using tools::MillisecondsSince;
+using tools::ToPointENU;
+
+void ReportQueries(const std::string& name, const HDMap& hdmap,
+                   const std::vector<Vec2d>& query_points,
+                   const double max_distance) {
+  std::vector<PointENU> points;
+  points.reserve(query_points.size());
+  for (const auto& point : query_points) {
+    points.push_back(ToPointENU(point));
+  }
+  const LaneInfo* lane = nullptr;
+  double s = 0.0;
+  double l = 0.0;
+
+  std::vector<const LaneInfo*> unbounded_lanes;
+  auto start = std::chrono::steady_clock::now();
+  for (const auto& point : points) {
+    lane = nullptr;
+    hdmap.GetNearestLane(point, &lane, &s, &l);
+    unbounded_lanes.push_back(lane);
+  }
+  const double unbounded_ms = MillisecondsSince(start);
+
+  std::vector<const LaneInfo*> bounded_lanes;
+  start = std::chrono::steady_clock::now();
+  for (const auto& point : points) {
+    lane = nullptr;
+    hdmap.GetNearestLane(point, max_distance, &lane, &s, &l);
+    bounded_lanes.push_back(lane);
+  }
+  const double bounded_ms = MillisecondsSince(start);
+
+  // Equidistant lanes may be picked either way, so compare distances.
+  int num_in_range = 0;
+  int num_mismatches = 0;
+  for (size_t i = 0; i < query_points.size(); ++i) {
+    const double distance =
+        unbounded_lanes[i] == nullptr
+            ? std::numeric_limits<double>::infinity()
+            : unbounded_lanes[i]->DistanceTo(query_points[i]);
+    if (bounded_lanes[i] == nullptr) {
+      num_mismatches += distance <= max_distance;
+      continue;
+    }
+    ++num_in_range;
+    num_mismatches +=
+        std::abs(bounded_lanes[i]->DistanceTo(query_points[i]) - distance) >
+        apollo::common::math::kMathEpsilon;
+  }
+
+  const double num_queries =
+      static_cast<double>(std::max<size_t>(1, query_points.size()));
+  std::printf("%-10s %8zu %9d %10.3f %10.3f %7.1fx %10d\n", name.c_str(),
+              query_points.size(), num_in_range,
+              unbounded_ms * 1000.0 / num_queries,
+              bounded_ms * 1000.0 / num_queries,
+              bounded_ms > 0.0 ? unbounded_ms / bounded_ms : 0.0,
+              num_mismatches);
+}
+
+int Run(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr,
+                 "Usage: %s <map file> [num_queries] [max distance]\n",
+                 argv[0]);
+    return 1;
+  }
+  const int num_queries = argc > 2 ? std::atoi(argv[2]) : 100000;
+  const double max_distance = argc > 3 ? std::atof(argv[3]) : 5.0;
+
+  Map map;
+  if (!tools::LoadMap(argv[1], &map)) {
+    std::fprintf(stderr, "Failed to load map %s\n", argv[1]);
+    return 1;
+  }
+  HDMap hdmap;
+  if (hdmap.LoadMapFromProto(map) != 0) {
+    std::fprintf(stderr, "Failed to build map %s\n", argv[1]);
+    return 1;
+  }
+
+  const std::vector<Vec2d> lane_points = tools::GetLanePoints(map);
+  double min_x = std::numeric_limits<double>::infinity();
+  double min_y = std::numeric_limits<double>::infinity();
+  double max_x = -std::numeric_limits<double>::infinity();
+  double max_y = -std::numeric_limits<double>::infinity();
+  for (const auto& point : lane_points) {
+    min_x = std::min(min_x, point.x());
+    min_y = std::min(min_y, point.y());
+    max_x = std::max(max_x, point.x());
+    max_y = std::max(max_y, point.y());
+  }
+  if (lane_points.empty()) {
+    std::fprintf(stderr, "Map %s has no lanes\n", argv[1]);
+    return 1;
+  }
+
+  // On the lanes: within 2 meters of a lane point, where vehicles are.
+  // Sparse: 20 to 200 meters from a lane point, as between rural roads.
+  // Off the map: 1 to 10 kilometers outside its bounding box.
+  std::mt19937 random_engine(1);
+  std::uniform_int_distribution<size_t> lane_point_distribution(
+      0, lane_points.size() - 1);
+  std::uniform_real_distribution<double> angle_distribution(-M_PI, M_PI);
+  std::uniform_real_distribution<double> near_distribution(0.0, 2.0);
+  std::uniform_real_distribution<double> sparse_distribution(20.0, 200.0);
+  std::uniform_real_distribution<double> off_map_distribution(1000.0,
+                                                              10000.0);
+  auto around = [&](const Vec2d& center, const double distance) {
+    return center +
+           Vec2d::CreateUnitVec2d(angle_distribution(random_engine)) *
+               distance;
+  };
+  std::vector<Vec2d> near_points;
+  std::vector<Vec2d> sparse_points;
+  std::vector<Vec2d> off_map_points;
+  const Vec2d map_center((min_x + max_x) / 2.0, (min_y + max_y) / 2.0);
+  const double map_radius = std::hypot(max_x - min_x, max_y - min_y) / 2.0;
+  for (int i = 0; i < num_queries; ++i) {
+    near_points.push_back(
+        around(lane_points[lane_point_distribution(random_engine)],
+               near_distribution(random_engine)));
+    sparse_points.push_back(
+        around(lane_points[lane_point_distribution(random_engine)],
+               sparse_distribution(random_engine)));
+    off_map_points.push_back(around(
+        map_center, map_radius + off_map_distribution(random_engine)));
+  }
+
+  std::printf("%d lanes, max distance %.1f m\n", map.lane_size(),
+              max_distance);
+  std::printf("%-10s %8s %9s %10s %10s %8s %10s\n", "points", "queries",
+              "in_range", "inf_us", "bounded_us", "speedup", "mismatches");
+  ReportQueries("on-lane", hdmap, near_points, max_distance);
+  ReportQueries("sparse", hdmap, sparse_points, max_distance);
+  ReportQueries("off-map", hdmap, off_map_points, max_distance);
+  return 0;
+}
+
+}  // namespace
+}  // namespace hdmap
+}  // namespace apollo
+
+int main(int argc, char** argv) { return apollo::hdmap::Run(argc, argv); }
@@ -0,0 +1,167 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Counts the heap allocations and times the radius queries of HDMap that
+// return shared pointers, at points near the lanes. For lanes it also runs
+// the string id pipeline the queries used to resolve hits with (tree hits
+// -> set of id strings -> Id protos -> GetLaneById) for comparison. Usage:
+//
+//   query_allocation_benchmark <map file> [num_queries] [radius in meters]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "hdmap.h"
+#include "tools/allocation_counter.h"
+#include "tools/tool_util.h"
+
+namespace apollo {
+namespace hdmap {
+namespace {
+
+using apollo::common::PointENU;
+using apollo::common::math::Vec2d;
+
+// Runs query at every point once to warm up, then again counting the
+// allocations. query returns the number of results.
+void ReportQuery(const std::string& name, const std::vector<PointENU>& points,
+                 const std::function<size_t(const PointENU&)>& query) {
+  for (const auto& point : points) {
+    query(point);
+  }
+  size_t num_results = 0;
+  const uint64_t allocations_before = tools::AllocationCount();
+  const auto start = std::chrono::steady_clock::now();
+  for (const auto& point : points) {
+    num_results += query(point);
+  }
+  const double query_ms = tools::MillisecondsSince(start);
+  const uint64_t allocations = tools::AllocationCount() - allocations_before;
+
+  const double num_queries =
+      static_cast<double>(std::max<size_t>(1, points.size()));
+  std::printf("%-16s %10.2f %12.2f %10.3f\n", name.c_str(),
+              static_cast<double>(num_results) / num_queries,
+              static_cast<double>(allocations) / num_queries,
+              query_ms * 1000.0 / num_queries);
+}
+
+// Runs an HDMap radius query into a result vector reused across queries,
+// cleared first since GetRoads appends to it.
+template <class InfoConstPtr>
+std::function<size_t(const PointENU&)> RadiusQuery(
+    int (HDMap::*query)(const PointENU&, double,
+                        std::vector<InfoConstPtr>*) const,
+    const HDMap& hdmap, const double radius) {
+  auto results = std::make_shared<std::vector<InfoConstPtr>>();
+  return [query, &hdmap, radius, results](const PointENU& point) {
+    results->clear();
+    (hdmap.*query)(point, radius, results.get());
+    return results->size();
+  };
+}
+
+int Run(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s <map file> [num_queries] [radius]\n",
+                 argv[0]);
+    return 1;
+  }
+  const int num_queries = argc > 2 ? std::atoi(argv[2]) : 10000;
+  const double radius = argc > 3 ? std::atof(argv[3]) : 10.0;
+
+  Map map;
+  if (!tools::LoadMap(argv[1], &map)) {
+    std::fprintf(stderr, "Failed to load map %s\n", argv[1]);
+    return 1;
+  }
+  const std::vector<Vec2d> lane_points = tools::GetLanePoints(map);
+  HDMap hdmap;
+  if (hdmap.LoadMapFromProto(std::move(map)) != 0 || lane_points.empty()) {
+    std::fprintf(stderr, "Failed to build map %s\n", argv[1]);
+    return 1;
+  }
+
+  // Points within 5 meters of the lanes, where vehicles are.
+  std::mt19937 random_engine(1);
+  std::uniform_real_distribution<double> offset_distribution(-5.0, 5.0);
+  std::vector<PointENU> points;
+  for (int i = 0; i < num_queries; ++i) {
+    const Vec2d& point = lane_points[random_engine() % lane_points.size()];
+    points.push_back(
+        tools::ToPointENU({point.x() + offset_distribution(random_engine),
+                           point.y() + offset_distribution(random_engine)}));
+  }
+
+  std::printf("%zu queries of radius %.1f m\n", points.size(), radius);
+  std::printf("%-16s %10s %12s %10s\n", "query", "results/q", "allocations/q",
+              "us/q");
+  ReportQuery("lanes", points, RadiusQuery(&HDMap::GetLanes, hdmap, radius));
+
+  std::vector<const LaneSegmentBox*> segments;
+  std::vector<LaneInfoConstPtr> lanes;
+  ReportQuery("lanes by id", points, [&](const PointENU& point) {
+    hdmap.GetLaneSegments({point.x(), point.y()}, radius, &segments);
+    std::unordered_set<std::string> result_ids;
+    result_ids.reserve(segments.size());
+    for (const auto* segment : segments) {
+      result_ids.insert(segment->object()->id().id());
+    }
+    const std::vector<std::string> ids(result_ids.begin(), result_ids.end());
+    lanes.clear();
+    for (const auto& id : ids) {
+      Id lane_id;
+      lane_id.set_id(id);
+      lanes.push_back(hdmap.GetLaneById(lane_id));
+    }
+    return lanes.size();
+  });
+
+  ReportQuery("junctions", points,
+              RadiusQuery(&HDMap::GetJunctions, hdmap, radius));
+  ReportQuery("signals", points,
+              RadiusQuery(&HDMap::GetSignals, hdmap, radius));
+  ReportQuery("crosswalks", points,
+              RadiusQuery(&HDMap::GetCrosswalks, hdmap, radius));
+  ReportQuery("stop signs", points,
+              RadiusQuery(&HDMap::GetStopSigns, hdmap, radius));
+  ReportQuery("yield signs", points,
+              RadiusQuery(&HDMap::GetYieldSigns, hdmap, radius));
+  ReportQuery("clear areas", points,
+              RadiusQuery(&HDMap::GetClearAreas, hdmap, radius));
+  ReportQuery("speed bumps", points,
+              RadiusQuery(&HDMap::GetSpeedBumps, hdmap, radius));
+  ReportQuery("roads", points, RadiusQuery(&HDMap::GetRoads, hdmap, radius));
+  ReportQuery("parking spaces", points,
+              RadiusQuery(&HDMap::GetParkingSpaces, hdmap, radius));
+  ReportQuery("pnc junctions", points,
+              RadiusQuery(&HDMap::GetPNCJunctions, hdmap, radius));
+  return 0;
+}
+
+}  // namespace
+}  // namespace hdmap
+}  // namespace apollo
+
+int main(int argc, char** argv) { return apollo::hdmap::Run(argc, argv); }
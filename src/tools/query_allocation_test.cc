@@ -0,0 +1,284 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Checks that the HDMap queries that report raw pointers into caller-owned
+// buffers make no heap allocations once warmed up. Each query runs once at
+// every test point to warm up its QueryContext and result buffer, then
+// again while operator new is counted; the test fails if any query
+// allocated. It runs on a grid of roads it builds itself, with elements of
+// every type, where it also fails if a query never found anything, which
+// would make the check vacuous; or on a given map. Usage:
+//
+//   query_allocation_test [map file]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hdmap.h"
+#include "tools/allocation_counter.h"
+#include "tools/tool_util.h"
+
+namespace apollo {
+namespace hdmap {
+namespace {
+
+using apollo::common::PointENU;
+using apollo::common::math::Vec2d;
+
+// Side of a block of the test grid, in meters.
+constexpr double kBlockSize = 100.0;
+constexpr int kNumBlocks = 3;
+
+void AddLine(const Vec2d& start, const Vec2d& end, Curve* curve) {
+  auto* line_segment = curve->add_segment()->mutable_line_segment();
+  const int num_points =
+      std::max(2, static_cast<int>(start.DistanceTo(end) / 2.0) + 1);
+  for (int i = 0; i < num_points; ++i) {
+    const Vec2d point = start + (end - start) * (i / (num_points - 1.0));
+    auto* point_enu = line_segment->add_point();
+    point_enu->set_x(point.x());
+    point_enu->set_y(point.y());
+  }
+}
+
+void AddSquare(const Vec2d& center, const double half_size,
+               Polygon* polygon) {
+  for (const auto& corner : {Vec2d(-1, -1), Vec2d(1, -1), Vec2d(1, 1),
+                             Vec2d(-1, 1)}) {
+    auto* point = polygon->add_point();
+    point->set_x(center.x() + corner.x() * half_size);
+    point->set_y(center.y() + corner.y() * half_size);
+  }
+}
+
+// A grid of two-lane roads between junctions, with one element of every
+// other type per block or intersection.
+Map MakeGridMap() {
+  Map map;
+  for (int i = 0; i <= kNumBlocks; ++i) {
+    for (int j = 0; j <= kNumBlocks; ++j) {
+      const std::string suffix = std::to_string(i) + "_" + std::to_string(j);
+      const Vec2d center(i * kBlockSize, j * kBlockSize);
+      auto* junction = map.add_junction();
+      junction->mutable_id()->set_id("junction_" + suffix);
+      AddSquare(center, 10.0, junction->mutable_polygon());
+      auto* pnc_junction = map.add_pnc_junction();
+      pnc_junction->mutable_id()->set_id("pnc_junction_" + suffix);
+      AddSquare(center, 10.0, pnc_junction->mutable_polygon());
+      auto* clear_area = map.add_clear_area();
+      clear_area->mutable_id()->set_id("clear_area_" + suffix);
+      AddSquare(center, 5.0, clear_area->mutable_polygon());
+      auto* crosswalk = map.add_crosswalk();
+      crosswalk->mutable_id()->set_id("crosswalk_" + suffix);
+      AddSquare(center + Vec2d(14.0, 0.0), 3.0, crosswalk->mutable_polygon());
+    }
+  }
+  for (int horizontal = 0; horizontal < 2; ++horizontal) {
+    for (int k = 0; k <= kNumBlocks; ++k) {
+      for (int b = 0; b < kNumBlocks; ++b) {
+        // Along x or y, from b * kBlockSize to the next junction.
+        auto at = [&](const double along, const double across) {
+          return horizontal ? Vec2d(b * kBlockSize + along,
+                                    k * kBlockSize + across)
+                            : Vec2d(k * kBlockSize + across,
+                                    b * kBlockSize + along);
+        };
+        const std::string suffix = std::to_string(horizontal) + "_" +
+                                   std::to_string(k) + "_" +
+                                   std::to_string(b);
+        auto* road = map.add_road();
+        road->mutable_id()->set_id("road_" + suffix);
+        auto* section = road->add_section();
+        section->mutable_id()->set_id("1");
+        for (const double across : {-1.75, 1.75}) {
+          auto* lane = map.add_lane();
+          lane->mutable_id()->set_id("lane_" + suffix +
+                                     (across < 0.0 ? "_0" : "_1"));
+          const bool forward = across < 0.0;
+          const Vec2d start = at(forward ? 12.0 : kBlockSize - 12.0, across);
+          const Vec2d end = at(forward ? kBlockSize - 12.0 : 12.0, across);
+          AddLine(start, end, lane->mutable_central_curve());
+          lane->set_type(Lane::CITY_DRIVING);
+          lane->set_length(start.DistanceTo(end));
+          *section->add_lane_id() = lane->id();
+        }
+        auto* signal = map.add_signal();
+        signal->mutable_id()->set_id("signal_" + suffix);
+        AddLine(at(kBlockSize - 13.0, -3.5), at(kBlockSize - 13.0, 0.0),
+                signal->add_stop_line());
+        auto* stop_sign = map.add_stop_sign();
+        stop_sign->mutable_id()->set_id("stop_sign_" + suffix);
+        AddLine(at(13.0, 0.0), at(13.0, 3.5), stop_sign->add_stop_line());
+        auto* yield_sign = map.add_yield();
+        yield_sign->mutable_id()->set_id("yield_sign_" + suffix);
+        AddLine(at(20.0, -3.5), at(20.0, 0.0), yield_sign->add_stop_line());
+        auto* speed_bump = map.add_speed_bump();
+        speed_bump->mutable_id()->set_id("speed_bump_" + suffix);
+        AddLine(at(kBlockSize / 2.0, -3.5), at(kBlockSize / 2.0, 3.5),
+                speed_bump->add_position());
+        auto* parking_space = map.add_parking_space();
+        parking_space->mutable_id()->set_id("parking_space_" + suffix);
+        AddSquare(at(kBlockSize / 2.0, 6.0), 1.5,
+                  parking_space->mutable_polygon());
+      }
+    }
+  }
+  return map;
+}
+
+struct Query {
+  std::string name;
+  // Runs the query at a point and returns the number of results.
+  std::function<size_t(const PointENU&)> run;
+};
+
+template <class Info>
+Query RadiusQuery(const std::string& name,
+                  int (HDMap::*query)(const PointENU&, double, QueryContext*,
+                                      std::vector<const Info*>*) const,
+                  const HDMap& hdmap, const double radius,
+                  QueryContext* context, std::vector<const Info*>* results) {
+  return {name, [=, &hdmap](const PointENU& point) {
+            (hdmap.*query)(point, radius, context, results);
+            return results->size();
+          }};
+}
+
+int Run(int argc, char** argv) {
+  Map map;
+  const bool require_results = argc <= 1;
+  if (argc > 1) {
+    if (!tools::LoadMap(argv[1], &map)) {
+      std::fprintf(stderr, "Failed to load map %s\n", argv[1]);
+      return 1;
+    }
+  } else {
+    map = MakeGridMap();
+  }
+  std::vector<Vec2d> lane_points = tools::GetLanePoints(map);
+  HDMap hdmap;
+  if (hdmap.LoadMapFromProto(std::move(map)) != 0 || lane_points.empty()) {
+    std::fprintf(stderr, "Failed to build the map\n");
+    return 1;
+  }
+
+  std::mt19937 random_engine(1);
+  std::uniform_real_distribution<double> offset_distribution(-20.0, 20.0);
+  std::vector<PointENU> points;
+  for (int i = 0; i < 2000; ++i) {
+    const Vec2d& point = lane_points[random_engine() % lane_points.size()];
+    points.push_back(
+        tools::ToPointENU({point.x() + offset_distribution(random_engine),
+                           point.y() + offset_distribution(random_engine)}));
+  }
+
+  // One context and result buffer per query, as a caller would keep them.
+  constexpr double kRadius = 30.0;
+  QueryContext context;
+  std::vector<const LaneInfo*> lanes;
+  std::vector<const JunctionInfo*> junctions;
+  std::vector<const SignalInfo*> signals;
+  std::vector<const CrosswalkInfo*> crosswalks;
+  std::vector<const StopSignInfo*> stop_signs;
+  std::vector<const YieldSignInfo*> yield_signs;
+  std::vector<const ClearAreaInfo*> clear_areas;
+  std::vector<const SpeedBumpInfo*> speed_bumps;
+  std::vector<const ParkingSpaceInfo*> parking_spaces;
+  std::vector<const PNCJunctionInfo*> pnc_junctions;
+  std::vector<const RoadInfo*> roads;
+  std::vector<const LaneSegmentBox*> segments;
+  const LaneSegmentBox* last_segment = nullptr;
+  const std::vector<Query> queries = {
+      RadiusQuery("GetLanes", &HDMap::GetLanes, hdmap, kRadius, &context,
+                  &lanes),
+      RadiusQuery("GetJunctions", &HDMap::GetJunctions, hdmap, kRadius,
+                  &context, &junctions),
+      RadiusQuery("GetSignals", &HDMap::GetSignals, hdmap, kRadius, &context,
+                  &signals),
+      RadiusQuery("GetCrosswalks", &HDMap::GetCrosswalks, hdmap, kRadius,
+                  &context, &crosswalks),
+      RadiusQuery("GetStopSigns", &HDMap::GetStopSigns, hdmap, kRadius,
+                  &context, &stop_signs),
+      RadiusQuery("GetYieldSigns", &HDMap::GetYieldSigns, hdmap, kRadius,
+                  &context, &yield_signs),
+      RadiusQuery("GetClearAreas", &HDMap::GetClearAreas, hdmap, kRadius,
+                  &context, &clear_areas),
+      RadiusQuery("GetSpeedBumps", &HDMap::GetSpeedBumps, hdmap, kRadius,
+                  &context, &speed_bumps),
+      RadiusQuery("GetParkingSpaces", &HDMap::GetParkingSpaces, hdmap,
+                  kRadius, &context, &parking_spaces),
+      RadiusQuery("GetPNCJunctions", &HDMap::GetPNCJunctions, hdmap, kRadius,
+                  &context, &pnc_junctions),
+      RadiusQuery("GetRoads", &HDMap::GetRoads, hdmap, kRadius, &context,
+                  &roads),
+      {"GetNearestLane",
+       [&hdmap](const PointENU& point) -> size_t {
+         const LaneInfo* lane = nullptr;
+         double s = 0.0;
+         double l = 0.0;
+         return hdmap.GetNearestLane(point, &lane, &s, &l) == 0;
+       }},
+      {"GetNearestLane(max_distance)",
+       [&hdmap](const PointENU& point) -> size_t {
+         const LaneInfo* lane = nullptr;
+         double s = 0.0;
+         double l = 0.0;
+         return hdmap.GetNearestLane(point, kRadius, &lane, &s, &l) == 0;
+       }},
+      {"GetNearestLaneSegment",
+       [&hdmap, &last_segment](const PointENU& point) -> size_t {
+         return hdmap.GetNearestLaneSegment({point.x(), point.y()},
+                                            last_segment, &last_segment) == 0;
+       }},
+      {"GetLaneSegments",
+       [&hdmap, &segments](const PointENU& point) {
+         hdmap.GetLaneSegments({point.x(), point.y()}, kRadius, &segments);
+         return segments.size();
+       }},
+  };
+
+  int num_failures = 0;
+  for (const auto& query : queries) {
+    for (const auto& point : points) {
+      query.run(point);
+    }
+    size_t num_results = 0;
+    const uint64_t allocations_before = tools::AllocationCount();
+    for (const auto& point : points) {
+      num_results += query.run(point);
+    }
+    const uint64_t allocations =
+        tools::AllocationCount() - allocations_before;
+    const bool passed =
+        allocations == 0 && (num_results > 0 || !require_results);
+    num_failures += !passed;
+    std::printf("%-6s %-30s %8llu allocations %8zu results\n",
+                passed ? "OK" : "FAILED", query.name.c_str(),
+                static_cast<unsigned long long>(allocations), num_results);
+  }
+  return num_failures == 0 ? 0 : 1;
+}
+
+}  // namespace
+}  // namespace hdmap
+}  // namespace apollo
+
+int main(int argc, char** argv) { return apollo::hdmap::Run(argc, argv); }
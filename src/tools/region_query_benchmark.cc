@@ -0,0 +1,244 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Compares one GetObjectsAlongPath query for the lanes, crosswalks and
+// signals near a 200 meter path against the circular GetLanes,
+// GetCrosswalks and GetSignals queries that cover the same corridor, one
+// every few meters, merged into sets. The paths follow the lanes from lane
+// to successor. Reports the time per path, the elements found, and those
+// that the circles found outside the corridor or missed. Usage:
+//
+//   region_query_benchmark <map file> [num_paths] [half width in meters]
+//       [circle spacing in meters]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "hdmap.h"
+#include "tools/tool_util.h"
+
+namespace apollo {
+namespace hdmap {
+namespace {
+
+using apollo::common::PointENU;
+using apollo::common::math::Vec2d;
+
+constexpr double kPathLength = 200.0;
+constexpr double kPathPointSpacing = 1.0;
+
+// A path of kPathLength from the start of a random lane, on to the first
+// successor at each lane end, with a point every kPathPointSpacing. Empty
+// if it runs into a dead end first.
+std::vector<Vec2d> MakePath(
+    const Map& map,
+    const std::unordered_map<std::string, int>& lane_indices,
+    std::mt19937* random_engine) {
+  std::vector<Vec2d> path;
+  int lane_index = static_cast<int>((*random_engine)() % map.lane_size());
+  double offset = 0.0;  // Along the current lane piece, in meters.
+  const size_t num_points =
+      static_cast<size_t>(kPathLength / kPathPointSpacing) + 1;
+  while (path.size() < num_points) {
+    const Lane& lane = map.lane(lane_index);
+    std::vector<Vec2d> points;
+    for (const auto& segment : lane.central_curve().segment()) {
+      for (const auto& point : segment.line_segment().point()) {
+        points.emplace_back(point.x(), point.y());
+      }
+    }
+    for (size_t i = 0; i + 1 < points.size(); ++i) {
+      const double length = points[i].DistanceTo(points[i + 1]);
+      for (; offset < length && path.size() < num_points;
+           offset += kPathPointSpacing) {
+        path.push_back(points[i] +
+                       (points[i + 1] - points[i]) * (offset / length));
+      }
+      offset -= length;
+    }
+    const auto& successors = lane.successor_id();
+    const auto successor = successors.empty()
+                               ? lane_indices.end()
+                               : lane_indices.find(successors[0].id());
+    if (successor == lane_indices.end()) {
+      return {};
+    }
+    lane_index = successor->second;
+  }
+  return path;
+}
+
+struct Counts {
+  size_t found = 0;
+  size_t extra = 0;
+  size_t missed = 0;
+};
+
+// Counts the elements found by the path query, and those the circles found
+// on top of them or missed.
+template <class InfoConstPtr>
+void CountElements(const std::vector<InfoConstPtr>& path_results,
+                   const std::unordered_set<const void*>& circle_results,
+                   Counts* counts) {
+  counts->found += path_results.size();
+  size_t num_shared = 0;
+  for (const auto& element : path_results) {
+    num_shared += circle_results.count(element.get());
+  }
+  counts->missed += path_results.size() - num_shared;
+  counts->extra += circle_results.size() - num_shared;
+}
+
+int Run(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr,
+                 "Usage: %s <map file> [num_paths] [half width] "
+                 "[circle spacing]\n",
+                 argv[0]);
+    return 1;
+  }
+  const int num_paths = argc > 2 ? std::atoi(argv[2]) : 1000;
+  const double half_width = argc > 3 ? std::atof(argv[3]) : 5.0;
+  const double spacing = argc > 4 ? std::atof(argv[4]) : 5.0;
+  // Circles at this radius every spacing meters cover the corridor.
+  const double radius = std::hypot(half_width, spacing / 2.0);
+
+  Map map;
+  if (!tools::LoadMap(argv[1], &map) || map.lane_size() == 0) {
+    std::fprintf(stderr, "Failed to load map %s\n", argv[1]);
+    return 1;
+  }
+  std::unordered_map<std::string, int> lane_indices;
+  for (int i = 0; i < map.lane_size(); ++i) {
+    lane_indices[map.lane(i).id().id()] = i;
+  }
+  std::mt19937 random_engine(1);
+  std::vector<std::vector<Vec2d>> paths;
+  for (int i = 0; i < 100 * num_paths &&
+                  static_cast<int>(paths.size()) < num_paths;
+       ++i) {
+    std::vector<Vec2d> path = MakePath(map, lane_indices, &random_engine);
+    if (!path.empty()) {
+      paths.push_back(std::move(path));
+    }
+  }
+  HDMap hdmap;
+  if (hdmap.LoadMapFromProto(std::move(map)) != 0 || paths.empty()) {
+    std::fprintf(stderr, "Failed to build map %s\n", argv[1]);
+    return 1;
+  }
+
+  const MapElementTypeMask type_mask =
+      MapElementTypeBit(MapElementType::LANE) |
+      MapElementTypeBit(MapElementType::CROSSWALK) |
+      MapElementTypeBit(MapElementType::SIGNAL);
+  std::vector<MapObjects> path_results(paths.size());
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    hdmap.GetObjectsAlongPath(paths[i], half_width, type_mask,
+                              &path_results[i]);
+  }
+  const double path_ms = tools::MillisecondsSince(start);
+
+  struct CircleResults {
+    std::unordered_set<const void*> lanes;
+    std::unordered_set<const void*> crosswalks;
+    std::unordered_set<const void*> signals;
+  };
+  std::vector<CircleResults> circle_results(paths.size());
+  size_t num_circles = 0;
+  std::vector<LaneInfoConstPtr> lanes;
+  std::vector<CrosswalkInfoConstPtr> crosswalks;
+  std::vector<SignalInfoConstPtr> signals;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    const auto& path = paths[i];
+    // Centers every spacing meters, and one at the end of the path.
+    const size_t step = std::max<size_t>(
+        1, static_cast<size_t>(spacing / kPathPointSpacing));
+    for (size_t j = 0; j < path.size() + step - 1; j += step) {
+      const PointENU point =
+          tools::ToPointENU(path[std::min(j, path.size() - 1)]);
+      hdmap.GetLanes(point, radius, &lanes);
+      hdmap.GetCrosswalks(point, radius, &crosswalks);
+      hdmap.GetSignals(point, radius, &signals);
+      for (const auto& lane : lanes) {
+        circle_results[i].lanes.insert(lane.get());
+      }
+      for (const auto& crosswalk : crosswalks) {
+        circle_results[i].crosswalks.insert(crosswalk.get());
+      }
+      for (const auto& signal : signals) {
+        circle_results[i].signals.insert(signal.get());
+      }
+      ++num_circles;
+    }
+  }
+  const double circles_ms = tools::MillisecondsSince(start);
+
+  Counts lane_counts;
+  Counts crosswalk_counts;
+  Counts signal_counts;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    CountElements(path_results[i].lanes, circle_results[i].lanes,
+                  &lane_counts);
+    CountElements(path_results[i].crosswalks, circle_results[i].crosswalks,
+                  &crosswalk_counts);
+    CountElements(path_results[i].signals, circle_results[i].signals,
+                  &signal_counts);
+  }
+
+  const double n = static_cast<double>(paths.size());
+  std::printf("%zu paths of %.0f m, half width %.1f m, %.1f circles of "
+              "radius %.2f m per path\n",
+              paths.size(), kPathLength, half_width,
+              static_cast<double>(num_circles) / n, radius);
+  std::printf("%-10s %12s %12s %8s\n", "query", "ms_per_path", "total_ms",
+              "speedup");
+  std::printf("%-10s %12.3f %12.1f %7.2fx\n", "path", path_ms / n, path_ms,
+              path_ms > 0.0 ? circles_ms / path_ms : 0.0);
+  std::printf("%-10s %12.3f %12.1f %8s\n", "circles", circles_ms / n,
+              circles_ms, "");
+  std::printf("%-10s %12s %12s %12s\n", "elements", "found/path",
+              "extra/path", "missed/path");
+  const std::pair<const char*, const Counts*> rows[] = {
+      {"lanes", &lane_counts},
+      {"crosswalks", &crosswalk_counts},
+      {"signals", &signal_counts}};
+  for (const auto& row : rows) {
+    std::printf("%-10s %12.2f %12.2f %12.2f\n", row.first,
+                static_cast<double>(row.second->found) / n,
+                static_cast<double>(row.second->extra) / n,
+                static_cast<double>(row.second->missed) / n);
+  }
+  const size_t num_missed =
+      lane_counts.missed + crosswalk_counts.missed + signal_counts.missed;
+  return num_missed == 0 ? 0 : 1;
+}
+
+}  // namespace
+}  // namespace hdmap
+}  // namespace apollo
+
+int main(int argc, char** argv) { return apollo::hdmap::Run(argc, argv); }
@@ -0,0 +1,198 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Times the point-to-segment distance kernels of LineSegment2dBatch, which
+// use AVX2 where the CPU has it, against LineSegment2d::DistanceSquareTo
+// called once per segment, on groups of lane segments the size of a lane
+// segment tree leaf. Both the kernel over a range of segments and the one
+// over gathered indices are timed, and their results must match the scalar
+// ones bit for bit. Usage:
+//
+//   segment_distance_benchmark <map file> [num_queries] [group size]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "math/line_segment2d.h"
+#include "math/line_segment2d_batch.h"
+#include "tools/tool_util.h"
+
+namespace apollo {
+namespace hdmap {
+namespace {
+
+using apollo::common::math::LineSegment2d;
+using apollo::common::math::LineSegment2dBatch;
+using apollo::common::math::Vec2d;
+
+// The segments of the queries, consecutive along a lane for a range, or
+// picked out of a wider window of segments for gathered indices.
+struct Query {
+  Vec2d point;
+  int begin = 0;
+  std::vector<int> indices;
+};
+
+const char* Avx2Support() {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  return __builtin_cpu_supports("avx2") ? "available" : "unavailable";
+#else
+  return "not built";
+#endif
+}
+
+void PrintRow(const char* name, const double scalar_ms, const double batch_ms,
+              const double num_distances, const int num_mismatches) {
+  std::printf("%-8s %10.2f %10.2f %8.2fx %10d\n", name,
+              scalar_ms * 1e6 / num_distances, batch_ms * 1e6 / num_distances,
+              batch_ms > 0.0 ? scalar_ms / batch_ms : 0.0, num_mismatches);
+}
+
+int Run(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s <map file> [num_queries] [group size]\n",
+                 argv[0]);
+    return 1;
+  }
+  const int num_queries = argc > 2 ? std::atoi(argv[2]) : 1000000;
+  // The max_leaf_size of the lane segment tree.
+  const int group_size = std::max(1, argc > 3 ? std::atoi(argv[3]) : 16);
+
+  Map map;
+  if (!tools::LoadMap(argv[1], &map)) {
+    std::fprintf(stderr, "Failed to load map %s\n", argv[1]);
+    return 1;
+  }
+  std::vector<LineSegment2d> segments;
+  for (const auto& lane : map.lane()) {
+    for (const auto& curve_segment : lane.central_curve().segment()) {
+      const auto& points = curve_segment.line_segment().point();
+      for (int i = 0; i + 1 < points.size(); ++i) {
+        segments.emplace_back(Vec2d(points[i].x(), points[i].y()),
+                              Vec2d(points[i + 1].x(), points[i + 1].y()));
+      }
+    }
+  }
+  const int window_size = 4 * group_size;
+  if (static_cast<int>(segments.size()) < window_size) {
+    std::fprintf(stderr, "Map %s has too few lane segments\n", argv[1]);
+    return 1;
+  }
+  LineSegment2dBatch batch;
+  batch.Reserve(static_cast<int>(segments.size()));
+  for (const auto& segment : segments) {
+    batch.Append(segment);
+  }
+
+  // Points up to 10 meters off the first segment of their group.
+  std::mt19937 random_engine(1);
+  std::uniform_int_distribution<int> begin_distribution(
+      0, static_cast<int>(segments.size()) - window_size);
+  std::uniform_real_distribution<double> offset_distribution(-10.0, 10.0);
+  std::vector<Query> queries(num_queries);
+  std::vector<int> window(window_size);
+  for (auto& query : queries) {
+    query.begin = begin_distribution(random_engine);
+    const Vec2d& start = segments[query.begin].start();
+    query.point = {start.x() + offset_distribution(random_engine),
+                   start.y() + offset_distribution(random_engine)};
+    std::iota(window.begin(), window.end(), query.begin);
+    std::shuffle(window.begin(), window.end(), random_engine);
+    query.indices.assign(window.begin(), window.begin() + group_size);
+  }
+
+  std::vector<double> scalar_distances(group_size);
+  std::vector<double> batch_distances(group_size);
+  double checksum = 0.0;
+  auto start = std::chrono::steady_clock::now();
+  for (const auto& query : queries) {
+    for (int i = 0; i < group_size; ++i) {
+      checksum += segments[query.begin + i].DistanceSquareTo(query.point);
+    }
+  }
+  const double scalar_range_ms = tools::MillisecondsSince(start);
+  start = std::chrono::steady_clock::now();
+  for (const auto& query : queries) {
+    batch.DistanceSquareTo(query.point, query.begin, query.begin + group_size,
+                           batch_distances.data());
+    checksum += std::accumulate(batch_distances.begin(),
+                                batch_distances.end(), 0.0);
+  }
+  const double batch_range_ms = tools::MillisecondsSince(start);
+  start = std::chrono::steady_clock::now();
+  for (const auto& query : queries) {
+    for (const int index : query.indices) {
+      checksum += segments[index].DistanceSquareTo(query.point);
+    }
+  }
+  const double scalar_indexed_ms = tools::MillisecondsSince(start);
+  start = std::chrono::steady_clock::now();
+  for (const auto& query : queries) {
+    batch.DistanceSquareTo(query.point, query.indices.data(), group_size,
+                           batch_distances.data());
+    checksum += std::accumulate(batch_distances.begin(),
+                                batch_distances.end(), 0.0);
+  }
+  const double batch_indexed_ms = tools::MillisecondsSince(start);
+
+  int num_range_mismatches = 0;
+  int num_indexed_mismatches = 0;
+  for (const auto& query : queries) {
+    for (int i = 0; i < group_size; ++i) {
+      scalar_distances[i] =
+          segments[query.begin + i].DistanceSquareTo(query.point);
+    }
+    batch.DistanceSquareTo(query.point, query.begin, query.begin + group_size,
+                           batch_distances.data());
+    num_range_mismatches +=
+        std::memcmp(scalar_distances.data(), batch_distances.data(),
+                    group_size * sizeof(double)) != 0;
+    for (int i = 0; i < group_size; ++i) {
+      scalar_distances[i] =
+          segments[query.indices[i]].DistanceSquareTo(query.point);
+    }
+    batch.DistanceSquareTo(query.point, query.indices.data(), group_size,
+                           batch_distances.data());
+    num_indexed_mismatches +=
+        std::memcmp(scalar_distances.data(), batch_distances.data(),
+                    group_size * sizeof(double)) != 0;
+  }
+
+  std::printf("%zu lane segments, %d queries of %d segments, AVX2 %s "
+              "(checksum %g)\n",
+              segments.size(), num_queries, group_size, Avx2Support(),
+              checksum);
+  std::printf("%-8s %10s %10s %9s %10s\n", "kernel", "scalar_ns", "batch_ns",
+              "speedup", "mismatches");
+  const double num_distances =
+      static_cast<double>(std::max(1, num_queries)) * group_size;
+  PrintRow("range", scalar_range_ms, batch_range_ms, num_distances,
+           num_range_mismatches);
+  PrintRow("indexed", scalar_indexed_ms, batch_indexed_ms, num_distances,
+           num_indexed_mismatches);
+  return num_range_mismatches + num_indexed_mismatches == 0 ? 0 : 1;
+}
+
+}  // namespace
+}  // namespace hdmap
+}  // namespace apollo
+
+int main(int argc, char** argv) { return apollo::hdmap::Run(argc, argv); }
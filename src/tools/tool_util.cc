@@ -0,0 +1,78 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+#include "tools/tool_util.h"
+
+#include <algorithm>
+
+#include "file.h"
+#include "adapter/opendrive_adapter.h"
+
+namespace apollo {
+namespace hdmap {
+namespace tools {
+
+using apollo::common::PointENU;
+using apollo::common::math::Vec2d;
+
+bool LoadMap(const std::string& filename, Map* map) {
+  const std::string xml_suffix = ".xml";
+  if (filename.size() >= xml_suffix.size() &&
+      filename.compare(filename.size() - xml_suffix.size(), xml_suffix.size(),
+                       xml_suffix) == 0) {
+    return adapter::OpendriveAdapter::LoadData(filename, map);
+  }
+  return cyber::common::GetProtoFromFile(filename, map);
+}
+
+double MillisecondsSince(const std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+double Percentile(std::vector<double>* const values, const double fraction) {
+  if (values->empty()) {
+    return 0.0;
+  }
+  std::sort(values->begin(), values->end());
+  const size_t index = std::min(
+      values->size() - 1,
+      static_cast<size_t>(fraction * static_cast<double>(values->size())));
+  return (*values)[index];
+}
+
+PointENU ToPointENU(const Vec2d& point) {
+  PointENU point_enu;
+  point_enu.set_x(point.x());
+  point_enu.set_y(point.y());
+  return point_enu;
+}
+
+std::vector<Vec2d> GetLanePoints(const Map& map) {
+  std::vector<Vec2d> points;
+  for (const auto& lane : map.lane()) {
+    for (const auto& segment : lane.central_curve().segment()) {
+      for (const auto& point : segment.line_segment().point()) {
+        points.emplace_back(point.x(), point.y());
+      }
+    }
+  }
+  return points;
+}
+
+}  // namespace tools
+}  // namespace hdmap
+}  // namespace apollo
@@ -0,0 +1,55 @@
+/* Copyright 2017 The Apollo Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=========================================================================*/
+
+// Helpers shared by the command line tools under src/tools.
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "geometry.pb.h"
+#include "map.pb.h"
+#include "math/vec2d.h"
+
+namespace apollo {
+namespace hdmap {
+namespace tools {
+
+/**
+ * @brief Load a map file: OpenDRIVE if its name ends in ".xml", and a
+ *        binary or text map proto otherwise.
+ */
+bool LoadMap(const std::string& filename, Map* map);
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start);
+
+/**
+ * @brief The value below which a fraction of the values lie, e.g. 0.99 for
+ *        the 99th percentile; values is sorted in place. 0 if it is empty.
+ */
+double Percentile(std::vector<double>* values, double fraction);
+
+apollo::common::PointENU ToPointENU(const apollo::common::math::Vec2d& point);
+
+/**
+ * @brief The points of the central curves of the lanes of a map.
+ */
+std::vector<apollo::common::math::Vec2d> GetLanePoints(const Map& map);
+
+}  // namespace tools
+}  // namespace hdmap
+}  // namespace apollo